@@ -250,6 +250,16 @@ BaseApp::Init(int argc,     // IN
    InitPoll();
    BasicHttp_Init(Poll_Callback, Poll_CallbackRemove);
 
+   /*
+    * Log lines are batched; make sure they reach the file while we're
+    * idle too.
+    */
+   uint32 flushInterval = Log_GetFlushInterval();
+   if (flushInterval > 0) {
+      Poll_Callback(POLL_CS_MAIN, POLL_FLAG_PERIODIC, FlushLog, NULL,
+                    POLL_REALTIME, flushInterval * 1000, NULL);
+   }
+
    InitPrefs();
 
 #ifdef VIEW_POSIX
@@ -292,6 +302,8 @@ BaseApp::Init(int argc,     // IN
 void
 BaseApp::Fini()
 {
+   Poll_CallbackRemove(POLL_CS_MAIN, POLL_FLAG_PERIODIC, FlushLog, NULL,
+                       POLL_REALTIME);
    Log_Exit();
 #ifdef VIEW_POSIX
    Sig_Exit();
@@ -299,6 +311,29 @@ BaseApp::Fini()
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::BaseApp::FlushLog --
+ *
+ *      Periodic Poll callback to write out batched log lines.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Log file written.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+BaseApp::FlushLog(void *data) // IN/UNUSED
+{
+   Log_Flush();
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
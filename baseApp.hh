@@ -95,6 +95,7 @@ private:
                          gpointer user_data);
 
    static void WarningHelper(const gchar *string);
+   static void FlushLog(void *data);
 
    static BaseApp *sApp;
 };
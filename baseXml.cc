@@ -605,6 +605,55 @@ BaseXml::OnResponse(BasicHttpRequest *request,   // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::BaseXml::OnResponseData --
+ *
+ *      BasicHttp receive progress callback.  Feeds each piece of the
+ *      response body to the request's XML push parser as it arrives, so
+ *      the document is built while the transfer is still running and the
+ *      body is never buffered as a whole.
+ *
+ * Results:
+ *      TRUE to continue the transfer.
+ *
+ * Side effects:
+ *      Creates the request's parser on the first piece.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+BaseXml::OnResponseData(BasicHttpRequest *request, // IN
+                        size_t bufferSize,         // IN
+                        void *buffer,              // IN
+                        uint64 totalTransferred,   // IN/UNUSED
+                        uint64 transferRate,       // IN/UNUSED
+                        void *data)                // IN
+{
+   BaseXml *that = reinterpret_cast<BaseXml *>(data);
+   ASSERT(that);
+
+   for (std::list<RequestState *>::iterator i = that->mActiveRequests.begin();
+        i != that->mActiveRequests.end(); i++) {
+      RequestState *state = *i;
+      if (state->request == request) {
+         if (!state->parser) {
+            state->parser = xmlCreatePushParserCtxt(NULL, NULL,
+                                                    (const char *)buffer,
+                                                    bufferSize,
+                                                    "notused.xml");
+         } else {
+            xmlParseChunk(state->parser, (const char *)buffer, bufferSize, 0);
+         }
+         break;
+      }
+   }
+   return TRUE;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -706,6 +755,16 @@ BaseXml::ProcessResponse(RequestState *state) // IN
    }
 #endif // !defined(_WIN32) || defined(__MINGW32)
 
+   /*
+    * Through a proxy, the peer is the proxy rather than the broker, so
+    * don't remember that.
+    */
+   if (state->proxyType != BASICHTTP_PROXY_NONE) {
+      mPeerAddress.clear();
+   } else if (response->primaryIP) {
+      mPeerAddress = response->primaryIP;
+   }
+
    MultiRequestState *multi = dynamic_cast<MultiRequestState *>(state);
    std::list<RequestState *> requests;
 
@@ -731,8 +790,16 @@ BaseXml::ProcessResponse(RequestState *state) // IN
 
    DEBUG_ONLY(Warning("BROKER RESPONSE: %s\n", response->content));
 
-   doc = xmlReadMemory(response->content, strlen(response->content),
-                       "notused.xml", NULL, 0);
+   /*
+    * Without progress callbacks (old libcurl) nothing was fed to the push
+    * parser, and the response was collected in response->content instead.
+    */
+   if (state->parser) {
+      doc = state->FinishParse();
+   } else if (response->content) {
+      doc = xmlReadMemory(response->content, strlen(response->content),
+                          "notused.xml", NULL, 0);
+   }
 
    if (!doc) {
       Warning("The response could not be parsed as XML.\n");
@@ -1011,6 +1078,12 @@ BaseXml::SetCookieFile(const Util::string &cookieFile) // IN
  *      which is a bit heavy handed, but we are wading through a lot
  *      of layers of abstractions, and this works.
  *
+ *      The DNS cache and TLS sessions shared through our cookie jar
+ *      survive this, so the next connection resumes rather than doing
+ *      a full handshake.  Pass newSslSessions when the client
+ *      certificate we present has changed, so that the server asks
+ *      for it again, which a resumed session would skip.
+ *
  * Results:
  *      None
  *
@@ -1021,11 +1094,27 @@ BaseXml::SetCookieFile(const Util::string &cookieFile) // IN
  */
 
 void
-BaseXml::ResetConnections()
+BaseXml::ResetConnections(bool newSslSessions) // IN/OPT
 {
+   BasicHttpConnectionStats stats;
+   CdkProxyStats proxyStats;
+
    CancelRequests();
+
+   BasicHttp_GetConnectionStats(mCookieJar, &stats);
+   CdkProxy_GetStats(&proxyStats);
+   Log("Connections to %s: %" FMT64 "u requests, %" FMT64 "u connections opened, "
+       "%" FMT64 "u reused, %" FMT64 "u TLS session resets; "
+       "proxy lookups: %lu cached, %lu resolved.\n",
+       mHostname.c_str(), stats.requests, stats.connections,
+       stats.reusedConnections, stats.sslSessionFlushes, proxyStats.hits,
+       proxyStats.misses);
+
    BasicHttp_Shutdown();
    BasicHttp_Init(Poll_Callback, Poll_CallbackRemove);
+   if (newSslSessions) {
+      BasicHttp_ForgetSslSessions(mCookieJar);
+   }
    if (mResetWatch) {
       *mResetWatch = true;
    }
@@ -1111,6 +1200,66 @@ BaseXml::OnCertificateRequest(SSL *ssl,           // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::BaseXml::RequestState::~RequestState --
+ *
+ *      Destructor - frees any unfinished response parse.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+BaseXml::RequestState::~RequestState()
+{
+   xmlFreeDoc(FinishParse());
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::BaseXml::RequestState::FinishParse --
+ *
+ *      Finish parsing the response fed to the push parser by
+ *      OnResponseData, and free the parser.
+ *
+ * Results:
+ *      The response document, or NULL if there was no response body or it
+ *      was not well-formed XML.  The caller frees the document.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+xmlDoc *
+BaseXml::RequestState::FinishParse()
+{
+   xmlDoc *doc = NULL;
+
+   if (parser) {
+      xmlParseChunk(parser, NULL, 0, 1);
+      doc = parser->myDoc;
+      parser->myDoc = NULL;
+      if (!parser->wellFormed) {
+         xmlFreeDoc(doc);
+         doc = NULL;
+      }
+      xmlFreeParserCtxt(parser);
+      parser = NULL;
+   }
+   return doc;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1298,7 +1447,7 @@ BaseXml::SendHttpRequest(RequestState *req,        // IN:
 	    break;
          }
          req->proxy = proxy;
-         free(proxy);
+         g_free(proxy);
       } else {
          req->proxyType = BASICHTTP_PROXY_NONE;
       }
@@ -1315,8 +1464,21 @@ BaseXml::SendHttpRequest(RequestState *req,        // IN:
                                     req->extraHeaders[i].c_str());
    }
 
-   Bool success = BasicHttp_SendRequest(req->request, &BaseXml::OnResponse,
-                                        this);
+   /*
+    * The response is parsed as it arrives by OnResponseData.  Release
+    * builds don't need BasicHttp to collect a copy of it as well, unless
+    * BasicHttp can't call OnResponseData; debug builds keep it for
+    * logging.
+    */
+   BasicHttpOptions options = 0;
+#ifndef VMX86_DEBUG
+   if (BasicHttp_HasProgressCallbacks()) {
+      options = BASICHTTP_NO_RESPONSE_CONTENT;
+   }
+#endif
+   Bool success = BasicHttp_SendRequestEx(req->request, options, NULL,
+                                          &BaseXml::OnResponseData,
+                                          &BaseXml::OnResponse, this);
    if (success) {
       mActiveRequests.push_back(req);
    }
@@ -94,6 +94,7 @@ public:
 
    Util::string GetHostname() const { return mHostname; }
    int GetPort() const { return mPort; }
+   Util::string GetPeerAddress() const { return mPeerAddress; }
    bool GetSecure() const { return mSecure; }
    unsigned int GetRequestId() const { return mRequestId; }
 
@@ -114,7 +115,7 @@ public:
    int CancelRequests();
    void ForgetCookies();
    void SetCookieFile(const Util::string &cookieFile);
-   void ResetConnections();
+   void ResetConnections(bool newSslSessions = false);
 
    boost::signal3<int, SSL *, X509 **, EVP_PKEY **> certificateRequested;
 
@@ -140,6 +141,7 @@ protected:
       Util::string proxy;
       BasicHttpProxyType proxyType;
       unsigned long connectTimeoutSec;
+      xmlParserCtxt *parser; // Parses the response as it arrives
 
       RequestState() :
          alwaysDispatchResponse(false),
@@ -147,11 +149,13 @@ protected:
          request(NULL),
          response(NULL),
          proxyType(BASICHTTP_PROXY_NONE),
-         connectTimeoutSec(0)
+         connectTimeoutSec(0),
+         parser(NULL)
       {
       }
 
-      virtual ~RequestState() { }
+      virtual ~RequestState();
+      xmlDoc *FinishParse();
    };
 
    struct MultiRequestState
@@ -191,6 +195,9 @@ private:
    static void OnResponse(BasicHttpRequest *request,
                           BasicHttpResponse *response,
                           void *data);
+   static Bool OnResponseData(BasicHttpRequest *request, size_t bufferSize,
+                              void *buffer, uint64 totalTransferred,
+                              uint64 transferRate, void *data);
    static void OnIdleProcessResponses(void *data);
    static void OnSslCtx(BasicHttpRequest *request, void *sslctx,
                         void *clientData);
@@ -202,6 +209,7 @@ private:
    Util::string mHostname;
    unsigned short mPort;
    bool mSecure;
+   Util::string mPeerAddress;
    BasicHttpCookieJar *mCookieJar;
    Version mVersion;
    MultiRequestState *mMulti;
@@ -29,6 +29,7 @@
  */
 
 
+#include <set>
 #include <boost/bind.hpp>
 #include <glib.h>
 #ifdef __APPLE__
@@ -38,6 +39,7 @@
 #include "baseApp.hh"
 #include "broker.hh"
 #include "cdkErrors.h"
+#include "cdkProxy.h"
 #include "desktop.hh"
 #include "tunnel.hh"
 #include "util.hh"
@@ -56,6 +58,31 @@
 namespace cdk {
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BrokerElapsedMS --
+ *
+ *      Milliseconds between two wall-clock times.
+ *
+ * Results:
+ *      end - start, in ms.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static long
+BrokerElapsedMS(const GTimeVal *start, // IN
+                const GTimeVal *end)   // IN
+{
+   return (end->tv_sec - start->tv_sec) * 1000 +
+          (end->tv_usec - start->tv_usec) / 1000;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -84,8 +111,12 @@ Broker::Broker()
      mAuthRequestId(0),
      mAcceptedDisclaimer(false),
      mCert(NULL),
-     mKey(NULL)
+     mKey(NULL),
+     mBatchDepth(0),
+     mLoginBatches(0)
 {
+   mLoginStart.tv_sec = mLoginStart.tv_usec = 0;
+   mLastBatchSent.tv_sec = mLastBatchSent.tv_usec = 0;
 }
 
 
@@ -146,6 +177,7 @@ Broker::Reset()
       delete *i;
    }
    mDesktops.clear();
+   mDesktopsById.clear();
    // already deleted above
    mDesktop = NULL;
 
@@ -155,6 +187,8 @@ Broker::Reset()
    delete mXml;
    mXml = NULL;
    mAuthRequestId = 0;
+   mBatchDepth = 0;
+   mLoginStart.tv_sec = 0;
 
    ClearSmartCardPinAndReader();
 
@@ -201,6 +235,9 @@ Broker::Initialize(const Util::string &hostname,      // IN
    Log("Initializing connection to broker %s://%s:%d\n",
        secure ? "https" : "http", hostname.c_str(), port);
 
+   // Pick up any proxy changes made since the last broker we talked to.
+   CdkProxy_Invalidate();
+
    mXml = CreateNewXmlConnection(hostname, port, secure);
    if (!mCookieFile.empty()) {
       mXml->SetCookieFile(mCookieFile);
@@ -211,10 +248,105 @@ Broker::Initialize(const Util::string &hostname,      // IN
    mUsername = defaultUser;
    mDomain = defaultDomain;
 
-   mXml->QueueRequests();
+   g_get_current_time(&mLoginStart);
+   mLoginBatches = 0;
+
+   BeginRequestBatch();
    SetLocale();
    GetConfiguration();
-   mXml->SendQueuedRequests();
+   SendRequestBatch();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::Broker::BeginRequestBatch --
+ *
+ *      Start collecting RPCs into a single broker document.  Batches
+ *      nest, so a helper that plans its own batch may be called while
+ *      the caller is already building one; only the outermost
+ *      SendRequestBatch() puts the document on the wire.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Subsequent RPCs are queued rather than sent.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Broker::BeginRequestBatch()
+{
+   if (mBatchDepth++ == 0) {
+      mXml->QueueRequests();
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::Broker::SendRequestBatch --
+ *
+ *      Close a batch opened by BeginRequestBatch(), sending the queued
+ *      RPCs as one request if this is the outermost batch.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Request may be sent.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Broker::SendRequestBatch()
+{
+   ASSERT(mBatchDepth > 0);
+   if (--mBatchDepth == 0) {
+      mLoginBatches++;
+      g_get_current_time(&mLastBatchSent);
+      mXml->SendQueuedRequests();
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::Broker::QueuePostAuthRequests --
+ *
+ *      Queue every RPC whose only input is a successful authentication,
+ *      so they ride along with the authentication RPC instead of
+ *      waiting for its reply.  The broker processes the operations of
+ *      a document in order, and answers them with "notexecuted" if the
+ *      authentication preceding them did not complete.
+ *
+ *      get-tunnel-connection is skipped if we already have a tunnel,
+ *      and get-desktops is always needed to populate the list.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      RPCs queued in the current batch.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Broker::QueuePostAuthRequests()
+{
+   ASSERT(mBatchDepth > 0);
+
+   if (!mTunnel) {
+      InitTunnel();
+   }
+   GetDesktops();
 }
 
 
@@ -296,13 +428,12 @@ Broker::AcceptDisclaimer()
          mDelegate->RequestCertificate(mTrustedIssuers);
       }
    } else {
-      mXml->QueueRequests();
+      BeginRequestBatch();
       mXml->AcceptDisclaimer(
          boost::bind(&Broker::OnInitialRPCAbort, this, _1, _2),
          boost::bind(&Broker::OnAuthResult, this, _1, _2));
-      InitTunnel();
-      GetDesktops();
-      mXml->SendQueuedRequests();
+      QueuePostAuthRequests();
+      SendRequestBatch();
    }
 }
 
@@ -346,17 +477,16 @@ Broker::SubmitCertificate(X509 *cert,                 // IN/OPT
    mSmartCardReader = reader;
 
    mCertState = CERT_SHOULD_RESPOND;
-   mXml->ResetConnections();
+   mXml->ResetConnections(true);
 
    if (mAcceptedDisclaimer) {
       Log("Accepting disclaimer with cert response enabled.\n");
-      mXml->QueueRequests();
+      BeginRequestBatch();
       mXml->AcceptDisclaimer(
          boost::bind(&Broker::OnInitialRPCAbort, this, _1, _2),
          boost::bind(&Broker::OnAuthResult, this, _1, _2));
-      InitTunnel();
-      GetDesktops();
-      mXml->SendQueuedRequests();
+      QueuePostAuthRequests();
+      SendRequestBatch();
    } else {
       Log("Getting configuration with cert response enabled.\n");
       GetConfiguration();
@@ -385,14 +515,13 @@ Broker::SubmitPasscode(const Util::string &username, // IN
                        const Util::string &passcode) // IN
 {
    mUsername = username;
-   mXml->QueueRequests();
+   BeginRequestBatch();
    mXml->SecurIDUsernamePasscode(
       username, passcode,
       boost::bind(&Broker::OnAbort, this, _1, _2),
       boost::bind(&Broker::OnAuthResult, this, _1, _2));
-   InitTunnel();
-   GetDesktops();
-   mXml->SendQueuedRequests();
+   QueuePostAuthRequests();
+   SendRequestBatch();
 }
 
 
@@ -415,14 +544,13 @@ Broker::SubmitPasscode(const Util::string &username, // IN
 void
 Broker::SubmitNextTokencode(const Util::string &tokencode) // IN
 {
-   mXml->QueueRequests();
+   BeginRequestBatch();
    mXml->SecurIDNextTokencode(
       tokencode,
       boost::bind(&Broker::OnAbort, this, _1, _2),
       boost::bind(&Broker::OnAuthResult, this, _1, _2));
-   InitTunnel();
-   GetDesktops();
-   mXml->SendQueuedRequests();
+   QueuePostAuthRequests();
+   SendRequestBatch();
 }
 
 
@@ -446,14 +574,13 @@ void
 Broker::SubmitPins(const Util::string &pin1, // IN
                    const Util::string &pin2) // IN
 {
-   mXml->QueueRequests();
+   BeginRequestBatch();
    mXml->SecurIDPins(
       pin1, pin2,
       boost::bind(&Broker::OnAbort, this, _1, _2),
       boost::bind(&Broker::OnAuthResult, this, _1, _2));
-   InitTunnel();
-   GetDesktops();
-   mXml->SendQueuedRequests();
+   QueuePostAuthRequests();
+   SendRequestBatch();
 }
 
 
@@ -480,14 +607,13 @@ Broker::SubmitPassword(const Util::string &username, // IN
 {
    mUsername = username;
    mDomain = domain;
-   mXml->QueueRequests();
+   BeginRequestBatch();
    mXml->PasswordAuthentication(
       username, password, domain,
       boost::bind(&Broker::OnAbort, this, _1, _2),
       boost::bind(&Broker::OnAuthResult, this, _1, _2));
-   InitTunnel();
-   GetDesktops();
-   mXml->SendQueuedRequests();
+   QueuePostAuthRequests();
+   SendRequestBatch();
 }
 
 
@@ -512,13 +638,12 @@ Broker::ChangePassword(const Util::string &oldPassword, // IN
                        const Util::string &newPassword, // IN
                        const Util::string &confirm)     // IN
 {
-   mXml->QueueRequests();
+   BeginRequestBatch();
    mXml->ChangePassword(oldPassword, newPassword, confirm,
                         boost::bind(&Broker::OnAbort, this, _1,_2),
                         boost::bind(&Broker::OnAuthResult, this, _1, _2));
-   InitTunnel();
-   GetDesktops();
-   mXml->SendQueuedRequests();
+   QueuePostAuthRequests();
+   SendRequestBatch();
 }
 
 
@@ -563,7 +688,8 @@ Broker::ConnectDesktop(Desktop *desktop) // IN
       desktop->Connect(boost::bind(&Broker::OnAbort, this, _1, _2),
                        boost::bind(&Broker::MaybeLaunchDesktop, this),
                        Util::GetClientInfo(mXml->GetHostname(),
-                                           mXml->GetPort()));
+                                           mXml->GetPort(),
+                                           mXml->GetPeerAddress()));
       break;
    case TUNNEL_DOWN:
       InitTunnel();
@@ -1008,14 +1134,13 @@ Broker::OnAuthInfo(BrokerXml::Result &result,     // IN
       }
       break;
    case BrokerXml::AUTH_CERT_AUTH:
-      mXml->QueueRequests();
+      BeginRequestBatch();
       mXml->SubmitCertAuth(
          true, mSmartCardPin, mSmartCardReader,
          boost::bind(&Broker::OnInitialRPCAbort, this, _1, _2),
          boost::bind(&Broker::OnAuthResult, this, _1, _2));
-      InitTunnel();
-      GetDesktops();
-      mXml->SendQueuedRequests();
+      QueuePostAuthRequests();
+      SendRequestBatch();
       ClearSmartCardPinAndReader();
       break;
    default:
@@ -1300,6 +1425,17 @@ Broker::OnGetDesktopsSet(BrokerXml::EntitledDesktops &desktops) // IN
 {
    mGettingDesktops = false;
 
+   if (mLoginStart.tv_sec) {
+      GTimeVal now;
+      g_get_current_time(&now);
+      Log("Desktop list received %ld ms after login started and %ld ms "
+          "after the last request was sent; %u round trips, %u batched.\n",
+          BrokerElapsedMS(&mLoginStart, &now),
+          BrokerElapsedMS(&mLastBatchSent, &now),
+          mXml->GetRequestId(), mLoginBatches);
+      mLoginStart.tv_sec = 0;
+   }
+
    if (desktops.desktops.empty()) {
       OnAbort(false,
               Util::exception(_("You are not entitled to use the system."),
@@ -1307,20 +1443,59 @@ Broker::OnGetDesktopsSet(BrokerXml::EntitledDesktops &desktops) // IN
       return;
    }
 
-   std::vector<Desktop *> newDesktops;
+   /*
+    * Any desktops from an earlier list are replaced wholesale; keep them
+    * around until the delegate has switched to the new ones.
+    */
+   std::vector<Desktop *> oldDesktops;
+   oldDesktops.swap(mDesktops);
+   mDesktopsById.clear();
    for (BrokerXml::DesktopList::iterator i = desktops.desktops.begin();
         i != desktops.desktops.end(); i++) {
-      Desktop *desktop = new Desktop(*mXml, *i);
-      newDesktops.push_back(desktop);
-      desktop->changed.connect(boost::bind(&Broker::Delegate::UpdateDesktops,
-                                           mDelegate));
+      Desktop *desktop = CreateDesktop(*i);
+      mDesktops.push_back(desktop);
+      mDesktopsById[desktop->GetID()] = desktop;
    }
 
-   mDesktops = newDesktops;
    if (mDelegate) {
       // This is a superset of UpdateDesktops().
       mDelegate->RequestDesktop();
    }
+
+   for (std::vector<Desktop *>::iterator i = oldDesktops.begin();
+        i != oldDesktops.end(); i++) {
+      if (*i == mDesktop) {
+         mDesktop = NULL;
+      }
+      delete *i;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::Broker::CreateDesktop --
+ *
+ *      Create a Desktop for an entitlement and route its changed() signal
+ *      to the delegate.
+ *
+ * Results:
+ *      A new Desktop.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Desktop *
+Broker::CreateDesktop(BrokerXml::Desktop &desktopInfo) // IN
+{
+   Desktop *desktop = new Desktop(*mXml, desktopInfo);
+   desktop->changed.connect(boost::bind(&Broker::Delegate::UpdateDesktop,
+                                        mDelegate, desktop));
+   return desktop;
 }
 
 
@@ -1331,6 +1506,8 @@ Broker::OnGetDesktopsSet(BrokerXml::EntitledDesktops &desktops) // IN
  *
  *      Done handler for getting list of desktops. Refreshes desktops in the
  *      list, updating their information, adding and removing as necessary.
+ *      Desktops are matched by ID, and the delegate is told only what was
+ *      added, removed or changed.
  *
  * Results:
  *      None
@@ -1353,39 +1530,73 @@ Broker::OnGetDesktopsRefresh(BrokerXml::EntitledDesktops &desktops) // IN
       return;
    }
 
+   DesktopDiff diff;
    std::vector<Desktop *> newDesktops;
+   std::map<Util::string, Desktop *> newDesktopsById;
    for (BrokerXml::DesktopList::iterator i = desktops.desktops.begin();
         i != desktops.desktops.end(); i++) {
-      bool found = false;
-      for (std::vector<Desktop *>::iterator j = mDesktops.begin();
-           j != mDesktops.end(); j++) {
-         if (i->id == (*j)->GetID()) {
-            Desktop *desktop = *j;
-            mDesktops.erase(j);
-            desktop->SetInfo(*i);
-            newDesktops.push_back(desktop);
-            found = true;
-            break;
+      Desktop *desktop;
+      std::map<Util::string, Desktop *>::iterator j = mDesktopsById.find(i->id);
+      if (j != mDesktopsById.end()) {
+         desktop = j->second;
+         mDesktopsById.erase(j);
+         if (desktop->SetInfo(*i)) {
+            diff.changed.push_back(desktop);
          }
-      }
-      if (!found) {
+      } else {
          // New desktop--add it.
-         Desktop *desktop = new Desktop(*mXml, *i);
-         newDesktops.push_back(desktop);
-         desktop->changed.connect(boost::bind(&Broker::Delegate::UpdateDesktops,
-                                              mDelegate));
+         desktop = CreateDesktop(*i);
+         diff.added.push_back(desktop);
       }
+      newDesktops.push_back(desktop);
+      newDesktopsById.insert(std::make_pair(i->id, desktop));
    }
-   // Delete desktops that aren't still in the list.
+
+   // Whatever was not matched is no longer in the list.
+   for (std::map<Util::string, Desktop *>::iterator i = mDesktopsById.begin();
+        i != mDesktopsById.end(); i++) {
+      diff.removed.push_back(i->second);
+   }
+
+   // Check whether the desktops that stayed kept their relative order.
+   std::set<Desktop *> added(diff.added.begin(), diff.added.end());
+   std::vector<Desktop *>::iterator next = newDesktops.begin();
    for (std::vector<Desktop *>::iterator i = mDesktops.begin();
         i != mDesktops.end(); i++) {
-      delete *i;
+      std::map<Util::string, Desktop *>::iterator kept =
+         newDesktopsById.find((*i)->GetID());
+      if (kept == newDesktopsById.end() || kept->second != *i) {
+         continue;
+      }
+      while (next != newDesktops.end() && added.count(*next)) {
+         next++;
+      }
+      if (next == newDesktops.end() || *next != *i) {
+         diff.reordered = true;
+         break;
+      }
+      next++;
    }
-   mDesktops.clear();
 
    mDesktops = newDesktops;
-   if (mDelegate) {
-      mDelegate->UpdateDesktops();
+   mDesktopsById.swap(newDesktopsById);
+
+   Log("Desktop list refreshed: %u entitlements, %u added, %u removed, "
+       "%u changed%s.\n", (unsigned int)mDesktops.size(),
+       (unsigned int)diff.added.size(), (unsigned int)diff.removed.size(),
+       (unsigned int)diff.changed.size(), diff.reordered ? ", reordered" : "");
+
+   if (mDelegate && !diff.IsEmpty()) {
+      mDelegate->DesktopsChanged(diff);
+   }
+
+   // Delete desktops that aren't still in the list.
+   for (std::vector<Desktop *>::iterator i = diff.removed.begin();
+        i != diff.removed.end(); i++) {
+      if (*i == mDesktop) {
+         mDesktop = NULL;
+      }
+      delete *i;
    }
 }
 
@@ -1594,10 +1805,10 @@ Broker::OnInitialRPCAbort(bool cancelled,      // IN
          case BrokerXml::VERSION_3:
             mXml->SetProtocolVersion(BrokerXml::VERSION_2);
          retry_with_setlocale:
-            mXml->QueueRequests();
+            BeginRequestBatch();
             SetLocale();
             GetConfiguration();
-            mXml->SendQueuedRequests();
+            SendRequestBatch();
             return;
          case BrokerXml::VERSION_2:
             mXml->SetProtocolVersion(BrokerXml::VERSION_1);
@@ -1608,29 +1819,23 @@ Broker::OnInitialRPCAbort(bool cancelled,      // IN
             break;
          }
       } else if (err.code() == ERR_ALREADY_AUTHENTICATED) {
-         if (mTunnel) {
-            GetDesktops();
-         } else {
-            mXml->QueueRequests();
-            InitTunnel();
-            GetDesktops();
-            mXml->SendQueuedRequests();
-         }
+         BeginRequestBatch();
+         QueuePostAuthRequests();
+         SendRequestBatch();
          return;
       } else if (err.code() == ERR_BASICHTTP_ERROR_SSL_CONNECT_ERROR &&
                  mCertState == CERT_DID_RESPOND) {
-         mXml->ResetConnections();
+         mXml->ResetConnections(true);
          if (mAcceptedDisclaimer) {
             Log("Accepting disclaimer and cert response failed; "
                 "disabling cert response and accepting disclaimer "
                 "again.\n");
-            mXml->QueueRequests();
+            BeginRequestBatch();
             mXml->AcceptDisclaimer(
                boost::bind(&Broker::OnInitialRPCAbort, this, _1, _2),
                boost::bind(&Broker::OnAuthResult, this, _1, _2));
-            InitTunnel();
-            GetDesktops();
-            mXml->SendQueuedRequests();
+            QueuePostAuthRequests();
+            SendRequestBatch();
          } else {
             Log("No disclaimer seen, but cert response failed; just trying to "
                 "GetConfiguration() again.\n");
@@ -1811,8 +2016,7 @@ Broker::ClearSmartCardPinAndReader()
  *
  * cdk::Broker::GetDesktopName --
  *
- *      Runs through the list of desktops and if the desktop with the given ID
- *      is in the list, returns it's name.
+ *      If the desktop with the given ID is in the list, returns its name.
  *
  * Results:
  *      Util::string holding the desktop name, or empty.
@@ -1826,14 +2030,9 @@ Broker::ClearSmartCardPinAndReader()
 Util::string
 Broker::GetDesktopName(Util::string desktopID) // IN
 {
-   for (std::vector<Desktop *>::iterator iter = mDesktops.begin();
-        iter != mDesktops.end(); iter++) {
-      if ((*iter)->GetID() == desktopID) {
-         return (*iter)->GetName();
-      }
-   }
-
-   return "";
+   std::map<Util::string, Desktop *>::iterator iter =
+      mDesktopsById.find(desktopID);
+   return iter == mDesktopsById.end() ? "" : iter->second->GetName();
 }
 
 
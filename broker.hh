@@ -32,6 +32,7 @@
 #define BROKER_HH
 
 
+#include <map>
 #include <vector>
 #include <glib.h>
 
@@ -51,6 +52,23 @@ class Desktop;
 class Broker
 {
 public:
+   /*
+    * What a desktop list refresh changed.  Desktops in removed are deleted
+    * once the delegate has been notified.
+    */
+   struct DesktopDiff
+   {
+      std::vector<Desktop *> added;
+      std::vector<Desktop *> removed;
+      std::vector<Desktop *> changed;
+      bool reordered;
+
+      DesktopDiff() : reordered(false) { }
+      bool IsEmpty() const
+         { return added.empty() && removed.empty() && changed.empty() &&
+                  !reordered; }
+   };
+
    class Delegate
    {
    public:
@@ -90,6 +108,10 @@ public:
       virtual void TunnelDisconnected(Util::string disconnectReason) { }
 
       virtual void UpdateDesktops() { }
+      // By default these fall back to refreshing the whole list.
+      virtual void UpdateDesktop(Desktop *desktop) { UpdateDesktops(); }
+      virtual void DesktopsChanged(const DesktopDiff &diff)
+         { UpdateDesktops(); }
 
       virtual void UpdateForwardButton(bool sensitive, bool visible = true) { }
       virtual void UpdateCancelButton(bool sensitive, bool visible = true) { }
@@ -157,6 +179,8 @@ public:
    std::vector<Desktop*> mDesktops;
 
 protected:
+   Desktop *CreateDesktop(BrokerXml::Desktop &desktopInfo);
+
    virtual void SetLocale();
    virtual bool GetTunnelReady();
    virtual bool GetDesktopReady();
@@ -200,6 +224,10 @@ protected:
    std::vector<Util::string> GetSupportedProtocols() const
       { return mSupportedProtocols; }
 
+   void BeginRequestBatch();
+   void SendRequestBatch();
+   virtual void QueuePostAuthRequests();
+
 private:
    enum CertState {
       // The server has not requested a certificate from us.
@@ -227,6 +255,8 @@ private:
    BrokerXml *mXml;
    Tunnel *mTunnel;
    Desktop *mDesktop;
+   // mDesktops indexed by desktop ID.
+   std::map<Util::string, Desktop *> mDesktopsById;
    Util::string mUsername;
    Util::string mDomain;
    boost::signals::connection mTunnelDisconnectCnx;
@@ -243,6 +273,10 @@ private:
    std::list<Util::string> mTrustedIssuers;
    X509 *mCert;
    EVP_PKEY *mKey;
+   int mBatchDepth;
+   unsigned int mLoginBatches;
+   GTimeVal mLoginStart;
+   GTimeVal mLastBatchSent;
 };
 
 
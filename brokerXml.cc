@@ -1603,17 +1603,64 @@ BrokerXml::Tunnel::Tunnel()
  */
 
 BrokerXml::Desktop::Desktop()
-   : offlineState(OFFLINE_NONE),
+   : offlineEnabled(false),
+     endpointEnabled(false),
+     offlineState(OFFLINE_NONE),
+     checkedOutByOther(false),
      resetAllowed(false),
      resetAllowedOnSession(false),
      inMaintenance(false),
      defaultProtocol(0),
+     expired(false),
      progressWorkDoneSoFar(0),
-     progressTotalWork(0)
+     progressTotalWork(0),
+     checkedOutHereAndDisabled(false)
 {
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::BrokerXml::Desktop::operator== --
+ *
+ *      Compare two desktop entitlements field by field.
+ *
+ * Results:
+ *      true if they are the same.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+bool
+BrokerXml::Desktop::operator==(const Desktop &other) // IN
+   const
+{
+   return id == other.id &&
+          name == other.name &&
+          type == other.type &&
+          state == other.state &&
+          offlineEnabled == other.offlineEnabled &&
+          endpointEnabled == other.endpointEnabled &&
+          offlineState == other.offlineState &&
+          checkedOutByOther == other.checkedOutByOther &&
+          sessionId == other.sessionId &&
+          resetAllowed == other.resetAllowed &&
+          resetAllowedOnSession == other.resetAllowedOnSession &&
+          inMaintenance == other.inMaintenance &&
+          userPreferences.preferences == other.userPreferences.preferences &&
+          protocols == other.protocols &&
+          defaultProtocol == other.defaultProtocol &&
+          expired == other.expired &&
+          progressWorkDoneSoFar == other.progressWorkDoneSoFar &&
+          progressTotalWork == other.progressTotalWork &&
+          checkedOutHereAndDisabled == other.checkedOutHereAndDisabled;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -159,6 +159,7 @@ public:
       Desktop();
       virtual ~Desktop() {}
       virtual bool Parse(xmlNode *parentNode, Util::AbortSlot onAbort);
+      bool operator==(const Desktop &other) const;
    };
 
    typedef std::vector<Desktop> DesktopList;
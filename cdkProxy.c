@@ -26,6 +26,10 @@
  * cdkProxy.c --
  *
  *      Implementation of CdkProxy based on environment variables.
+ *
+ *      Results are cached per scheme and host, so that callers issuing
+ *      many requests to the same server do not re-read and re-parse the
+ *      environment each time.
  */
 
 #ifndef _WIN32
@@ -35,6 +39,9 @@
 
 
 #include "cdkProxy.h"
+#ifndef _WIN32
+#include "cdkUrl.h"
+#endif
 
 
 #define SCHEME_HTTP "http://"
@@ -44,44 +51,214 @@
 #define SCHEME_HTTP_SEC_LEN (sizeof(SCHEME_HTTP_SEC) - 1)
 
 
+#ifndef _WIN32
+
+typedef struct CdkProxyEntry {
+   CdkProxyType type;
+   char *url;             /* As found in the environment. */
+   char *host;            /* NULL if url could not be parsed. */
+   unsigned short port;
+} CdkProxyEntry;
+
+
+/* "<scheme>://<host>" -> CdkProxyEntry */
+static GHashTable *proxyCache = NULL;
+static CdkProxyStats proxyStats = { 0, 0 };
+
+
 /*
  *-----------------------------------------------------------------------------
  *
- * CdkProxy_GetProxyForUrl --
+ * CdkProxyFreeEntry --
  *
- *      Retrieve proxy settings for a given URL, using the http_proxy,
- *      https_proxy, or HTTPS_PROXY environment variables.
+ *      Free a cache entry.
  *
- *      PAC and SOCKS are not supported.
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+CdkProxyFreeEntry(gpointer data) // IN
+{
+   CdkProxyEntry *entry = data;
+
+   g_free(entry->url);
+   g_free(entry->host);
+   g_free(entry);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxy_GetCacheKey --
+ *
+ *      Build the cache key for a URL: its scheme and host, lower-cased,
+ *      without user info, port or path.
  *
  * Results:
- *      If no proxy is needed, or no proxy could be found, NULL is
- *      returned, and proxyType is set to CDK_PROXY_NONE.  Otherwise,
- *      a string containing the proxy host and port is returned,
- *      likely formatted as http://<host>:<port>.
+ *      Newly allocated key; *host points at the host part of it.
  *
  * Side effects:
- *      The returned string should be freed by the caller.
+ *      None
  *
  *-----------------------------------------------------------------------------
  */
 
 char *
-CdkProxy_GetProxyForUrl(const char *aUrl,        // IN
-                        CdkProxyType *proxyType) // OUT
+CdkProxy_GetCacheKey(const char *aUrl,  // IN
+                     const char **host) // OUT
 {
-#ifdef _WIN32
-   // We need this stub here so ovditest builds on Windows.
-   *proxyType = CDK_PROXY_NONE;
-   return (char *)0;
-#else
+   const char *start = strstr(aUrl, "://");
+   const char *end;
+   const char *at;
+   size_t schemeLen;
+   char *url;
+   char *key;
+
+   if (start) {
+      schemeLen = start - aUrl;
+      start += 3;
+   } else {
+      schemeLen = 0;
+      start = aUrl;
+   }
+
+   end = start + strcspn(start, "/?#");
+   at = memchr(start, '@', end - start);
+   if (at) {
+      start = at + 1;
+   }
+   if (*start == '[') {
+      const char *bracket = memchr(start, ']', end - start);
+      if (bracket) {
+         end = bracket + 1;
+      }
+   } else {
+      const char *colon = memchr(start, ':', end - start);
+      if (colon) {
+         end = colon;
+      }
+   }
+
+   url = g_strdup_printf("%.*s://%.*s", (int)schemeLen, aUrl,
+                         (int)(end - start), start);
+   key = g_ascii_strdown(url, -1);
+   g_free(url);
+   *host = key + schemeLen + 3;
+   return key;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxy_IsExcluded --
+ *
+ *      Check a host against the no_proxy (or NO_PROXY) environment
+ *      variable: a comma or space separated list of host names or
+ *      domain suffixes, optionally with a leading dot, or "*" to
+ *      bypass the proxy for everything.  IPv6 addresses match with or
+ *      without their brackets.
+ *
+ * Results:
+ *      TRUE if host should be connected to directly.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+gboolean
+CdkProxy_IsExcluded(const char *host) // IN: lower case
+{
+   const char *noProxy = g_getenv("no_proxy");
+   gboolean excluded = FALSE;
+   size_t hostLen = strlen(host);
+   char **patterns;
+   int i;
+
+   if (!noProxy || !*noProxy) {
+      noProxy = g_getenv("NO_PROXY");
+   }
+   if (!noProxy || !*noProxy) {
+      return FALSE;
+   }
+
+   if (hostLen >= 2 && host[0] == '[' && host[hostLen - 1] == ']') {
+      host++;
+      hostLen -= 2;
+   }
+
+   patterns = g_strsplit_set(noProxy, ", \t", -1);
+   for (i = 0; patterns[i] && !excluded; i++) {
+      char *pattern = patterns[i];
+      char *colon;
+      size_t len;
+
+      if (!strcmp(pattern, "*")) {
+         excluded = TRUE;
+         break;
+      }
+      while (*pattern == '.') {
+         pattern++;
+      }
+      if (*pattern == '[') {
+         char *bracket = strchr(++pattern, ']');
+         if (bracket) {
+            *bracket = '\0';
+         }
+      } else {
+         /* A port, unless this is a bare IPv6 address. */
+         colon = strchr(pattern, ':');
+         if (colon && !strchr(colon + 1, ':')) {
+            *colon = '\0';
+         }
+      }
+      len = strlen(pattern);
+      if (len == 0 || len > hostLen) {
+         continue;
+      }
+      excluded = !g_ascii_strncasecmp(host + hostLen - len, pattern, len) &&
+                 (len == hostLen || host[hostLen - len - 1] == '.');
+   }
+   g_strfreev(patterns);
+
+   return excluded;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxyResolve --
+ *
+ *      Work out the proxy for a URL from the environment.
+ *
+ * Results:
+ *      A new cache entry.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static CdkProxyEntry *
+CdkProxyResolve(const char *aUrl, // IN
+                const char *host) // IN
+{
+   CdkProxyEntry *entry = g_new0(CdkProxyEntry, 1);
    const char *proxy = NULL;
    const unsigned char *c;
 
-   g_assert(aUrl);
-   g_assert(proxyType);
-
-   *proxyType = CDK_PROXY_NONE;
+   entry->type = CDK_PROXY_NONE;
 
    if (!g_ascii_strncasecmp(aUrl, SCHEME_HTTP, SCHEME_HTTP_LEN)) {
       proxy = g_getenv("http_proxy");
@@ -94,7 +271,7 @@ CdkProxy_GetProxyForUrl(const char *aUrl,        // IN
    }
 
    if (!proxy || !*proxy) {
-      return NULL;
+      return entry;
    }
 
    /* Ensure that url is ASCII. */
@@ -105,11 +282,208 @@ CdkProxy_GetProxyForUrl(const char *aUrl,        // IN
             warned = 1;
             g_debug("Non-ASCII character found in proxy environment variable.\n");
          }
-         return NULL;
+         return entry;
       }
    }
 
-   *proxyType = CDK_PROXY_HTTP;
-   return g_strdup(proxy);
+   if (CdkProxy_IsExcluded(host)) {
+      return entry;
+   }
+
+   entry->type = CDK_PROXY_HTTP;
+   entry->url = g_strdup(proxy);
+   if (!CdkUrl_Parse(proxy, NULL, &entry->host, &entry->port, NULL, NULL)) {
+      entry->host = NULL;
+      entry->port = 0;
+   }
+   return entry;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxyLookup --
+ *
+ *      Find the cached proxy for a URL, resolving it on a miss.
+ *
+ * Results:
+ *      Cache entry, valid until CdkProxy_Invalidate() is called.
+ *
+ * Side effects:
+ *      Cache and statistics updated.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static const CdkProxyEntry *
+CdkProxyLookup(const char *aUrl) // IN
+{
+   const char *host;
+   char *key = CdkProxy_GetCacheKey(aUrl, &host);
+   CdkProxyEntry *entry;
+
+   if (!proxyCache) {
+      proxyCache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         CdkProxyFreeEntry);
+   }
+
+   entry = g_hash_table_lookup(proxyCache, key);
+   if (entry) {
+      proxyStats.hits++;
+      g_free(key);
+      return entry;
+   }
+
+   proxyStats.misses++;
+   entry = CdkProxyResolve(aUrl, host);
+   g_hash_table_insert(proxyCache, key, entry);
+   return entry;
+}
+
+#endif // !_WIN32
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxy_GetProxyForUrl --
+ *
+ *      Retrieve proxy settings for a given URL, using the http_proxy,
+ *      https_proxy, or HTTPS_PROXY environment variables, unless the
+ *      host is listed in no_proxy.
+ *
+ *      PAC and SOCKS are not supported.
+ *
+ * Results:
+ *      If no proxy is needed, or no proxy could be found, NULL is
+ *      returned, and proxyType is set to CDK_PROXY_NONE.  Otherwise,
+ *      a string containing the proxy host and port is returned,
+ *      likely formatted as http://<host>:<port>.
+ *
+ * Side effects:
+ *      The returned string should be freed by the caller.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+char *
+CdkProxy_GetProxyForUrl(const char *aUrl,        // IN
+                        CdkProxyType *proxyType) // OUT
+{
+#ifdef _WIN32
+   // We need this stub here so ovditest builds on Windows.
+   *proxyType = CDK_PROXY_NONE;
+   return (char *)0;
+#else
+   const CdkProxyEntry *entry;
+
+   g_assert(aUrl);
+   g_assert(proxyType);
+
+   entry = CdkProxyLookup(aUrl);
+   *proxyType = entry->type;
+   return g_strdup(entry->url);
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxy_GetProxyHostForUrl --
+ *
+ *      Like CdkProxy_GetProxyForUrl(), but return the proxy already
+ *      split into host and port.
+ *
+ * Results:
+ *      NULL if no proxy is needed, in which case proxyType is
+ *      CDK_PROXY_NONE, or if the proxy setting could not be parsed, in
+ *      which case it is not.  Otherwise the proxy host, and its port in
+ *      proxyPort.
+ *
+ * Side effects:
+ *      The returned string should be freed by the caller.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+char *
+CdkProxy_GetProxyHostForUrl(const char *aUrl,          // IN
+                            CdkProxyType *proxyType,   // OUT
+                            unsigned short *proxyPort) // OUT
+{
+#ifdef _WIN32
+   *proxyType = CDK_PROXY_NONE;
+   *proxyPort = 0;
+   return (char *)0;
+#else
+   const CdkProxyEntry *entry;
+
+   g_assert(aUrl);
+   g_assert(proxyType);
+   g_assert(proxyPort);
+
+   entry = CdkProxyLookup(aUrl);
+   *proxyType = entry->type;
+   *proxyPort = entry->port;
+   return g_strdup(entry->host);
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxy_Invalidate --
+ *
+ *      Forget cached proxy settings, so that changes to the environment
+ *      are picked up by the next lookup.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+CdkProxy_Invalidate(void)
+{
+#ifndef _WIN32
+   if (proxyCache) {
+      g_hash_table_destroy(proxyCache);
+      proxyCache = NULL;
+   }
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxy_GetStats --
+ *
+ *      Report how often lookups were answered from the cache.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+CdkProxy_GetStats(CdkProxyStats *stats) // OUT
+{
+#ifdef _WIN32
+   stats->hits = 0;
+   stats->misses = 0;
+#else
+   *stats = proxyStats;
 #endif
 }
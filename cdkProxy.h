@@ -50,13 +50,32 @@ typedef enum {
 } CdkProxyType;
 
 
-/* Don't forget to free the returned string with g_free(). */
+typedef struct {
+   unsigned long hits;
+   unsigned long misses;
+} CdkProxyStats;
+
+
+/* Don't forget to free the returned strings with g_free(). */
 char *CdkProxy_GetProxyForUrl(const char *aUrl, CdkProxyType *proxyType);
+char *CdkProxy_GetProxyHostForUrl(const char *aUrl, CdkProxyType *proxyType,
+                                  unsigned short *proxyPort);
+
+void CdkProxy_Invalidate(void);
+void CdkProxy_GetStats(CdkProxyStats *stats);
 
 #ifdef __APPLE__
 char *CdkProxy_CFStringToUTF8CString(CFStringRef s);
 #endif
 
+#if !defined(_WIN32) && !defined(VIEW_COCOA)
+#include <glib.h>
+
+/* Helpers of the environment variable implementation, for testUrl. */
+char *CdkProxy_GetCacheKey(const char *aUrl, const char **host);
+gboolean CdkProxy_IsExcluded(const char *host);
+#endif
+
 
 #ifdef __cplusplus
 }
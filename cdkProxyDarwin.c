@@ -34,6 +34,10 @@
 
 
 #include "cdkProxy.h"
+#include "cdkUrl.h"
+
+
+static CdkProxyStats proxyStats = { 0, 0 };
 
 
 /* TODO: Move this to libMisc instead of libUser? */
@@ -209,6 +213,7 @@ CdkProxy_GetProxyForUrl(const char *aUrl,        /* IN */
    g_assert(proxyType);
 
    *proxyType = CDK_PROXY_NONE;
+   proxyStats.misses++;
 
    /* Turn the URL string into a CFURL. */
    url = CFURLCreateWithBytes(NULL, (const UInt8 *)aUrl, strlen(aUrl),
@@ -274,3 +279,88 @@ out:
 
    return ret;
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxy_GetProxyHostForUrl --
+ *
+ *      Like CdkProxy_GetProxyForUrl(), but return the proxy already
+ *      split into host and port.
+ *
+ * Results:
+ *      NULL if no proxy is needed, in which case proxyType is
+ *      CDK_PROXY_NONE, or if the proxy setting could not be parsed, in
+ *      which case it is not.  Otherwise the proxy host, and its port in
+ *      proxyPort.
+ *
+ * Side effects:
+ *      The returned string should be freed by the caller.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+char *
+CdkProxy_GetProxyHostForUrl(const char *aUrl,          /* IN */
+                            CdkProxyType *proxyType,   /* OUT */
+                            unsigned short *proxyPort) /* OUT */
+{
+   char *proxy = CdkProxy_GetProxyForUrl(aUrl, proxyType);
+   char *host = NULL;
+
+   *proxyPort = 0;
+   if (proxy && !CdkUrl_Parse(proxy, NULL, &host, proxyPort, NULL, NULL)) {
+      host = NULL;
+      *proxyPort = 0;
+   }
+   g_free(proxy);
+
+   return host;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxy_Invalidate --
+ *
+ *      The SystemConfiguration framework tracks changes to the proxy
+ *      settings itself, so nothing is cached here.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+CdkProxy_Invalidate(void)
+{
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkProxy_GetStats --
+ *
+ *      Report proxy lookups; every one is a miss, as nothing is cached.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+CdkProxy_GetStats(CdkProxyStats *stats) /* OUT */
+{
+   *stats = proxyStats;
+}
@@ -0,0 +1,109 @@
+/*********************************************************
+ * Copyright (C) 2010 VMware, Inc. All rights reserved.
+ *
+ * This file is part of VMware View Open Client.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is released with an additional exemption that
+ * compiling, linking, and/or using the OpenSSL libraries with this
+ * program is allowed.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * cdkTimeZone.c --
+ *
+ *      Implementation of CdkTimeZone.
+ */
+
+#include <string.h>
+
+
+#include "cdkTimeZone.h"
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CdkTimeZone_ParseSysconfigClock --
+ *
+ *      Find the time zone in the contents of /etc/sysconfig/clock, a
+ *      shell fragment of the form TIMEZONE="..." (SuSE) or ZONE="..."
+ *      (RHEL).  As when sourcing it, comments are skipped, surrounding
+ *      white space and quotes are dropped, and a later assignment replaces
+ *      an earlier one.
+ *
+ * Results:
+ *      TIMEZONE if set, otherwise ZONE, otherwise "".  Free with g_free().
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+char *
+CdkTimeZone_ParseSysconfigClock(const char *contents) // IN
+{
+   char *tzVar = NULL;
+   char *zoneVar = NULL;
+   char **lines = g_strsplit(contents, "\n", -1);
+   char **line;
+
+   for (line = lines; *line; line++) {
+      const char *p = *line;
+      char **var;
+
+      while (g_ascii_isspace(*p)) {
+         p++;
+      }
+      if (g_str_has_prefix(p, "export ")) {
+         p += strlen("export ");
+         while (g_ascii_isspace(*p)) {
+            p++;
+         }
+      }
+
+      if (g_str_has_prefix(p, "TIMEZONE=")) {
+         var = &tzVar;
+         p += strlen("TIMEZONE=");
+      } else if (g_str_has_prefix(p, "ZONE=")) {
+         var = &zoneVar;
+         p += strlen("ZONE=");
+      } else {
+         continue;
+      }
+
+      g_free(*var);
+      if (*p == '"' || *p == '\'') {
+         const char *close = strchr(p + 1, *p);
+         *var = close ? g_strndup(p + 1, close - p - 1) : g_strdup(p + 1);
+      } else {
+         const char *end = p;
+         while (*end && !g_ascii_isspace(*end) && *end != '#' && *end != ';') {
+            end++;
+         }
+         *var = g_strndup(p, end - p);
+      }
+   }
+   g_strfreev(lines);
+
+   if (tzVar && *tzVar) {
+      g_free(zoneVar);
+      return tzVar;
+   }
+   g_free(tzVar);
+   return zoneVar ? zoneVar : g_strdup("");
+}
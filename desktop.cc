@@ -107,7 +107,7 @@ Desktop::~Desktop()
  *      This will NOT emit the changed() signal.
  *
  * Results:
- *      None
+ *      true if the desktop's info or connection state changed.
  *
  * Side effects:
  *      None
@@ -115,13 +115,16 @@ Desktop::~Desktop()
  *-----------------------------------------------------------------------------
  */
 
-void
+bool
 Desktop::SetInfo(BrokerXml::Desktop &desktopInfo)
 {
+   bool changed = !(mDesktopInfo == desktopInfo);
+
    mDesktopInfo = desktopInfo;
    if (mConnectionState == STATE_ROLLING_BACK ||
        mConnectionState == STATE_RESETTING ||
        mConnectionState == STATE_KILLING_SESSION) {
+      changed = true;
       // Don't use SetConnectionState to avoid emitting changed(); see below.
       mConnectionState = STATE_DISCONNECTED;
       /*
@@ -133,9 +136,10 @@ Desktop::SetInfo(BrokerXml::Desktop &desktopInfo)
    }
    /*
     * Don't explicitly emit changed() here. So far the only use of SetInfo is
-    * in Broker::OnGetDesktopsRefresh, which will call UpdateDesktops() once
-    * after all desktops have been refreshed.
+    * in Broker::OnGetDesktopsRefresh, which reports all changed desktops
+    * at once after the list has been refreshed.
     */
+   return changed;
 }
 
 
@@ -112,7 +112,7 @@ public:
    Desktop(BrokerXml &xml, BrokerXml::Desktop &desktopInfo);
    ~Desktop();
 
-   void SetInfo(BrokerXml::Desktop &desktopInfo);
+   bool SetInfo(BrokerXml::Desktop &desktopInfo);
    ConnectionState GetConnectionState() const { return mConnectionState; }
 
    void Connect(Util::AbortSlot onAbort, Util::DoneSlot onDone,
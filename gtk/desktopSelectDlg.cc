@@ -29,6 +29,7 @@
  */
 
 
+#include <set>
 #include <boost/bind.hpp>
 
 
@@ -419,37 +420,173 @@ DesktopSelectDlg::UpdateList(std::vector<Desktop *> &desktops, // IN
         i != desktops.end(); i++) {
       Desktop *desktop = *i;
       gtk_list_store_append(mStore, &iter);
+      SetRow(&iter, desktop);
 
-      Util::string name = desktop->GetName();
-      Util::string status = desktop->GetStatusMsg(mIsOffline);
-      GdkPixbuf *pb = GetDesktopIcon(desktop->GetStatus());
-
-      char *label = g_markup_printf_escaped(
-         "<b>%s</b>\n<span size=\"smaller\">%s</span>",
-         name.c_str(),
-         status.c_str());
-      gtk_list_store_set(mStore, &iter,
-                         ICON_COLUMN, pb,
-                         LABEL_COLUMN, label,
-                         NAME_COLUMN, name.c_str(),
-                         DESKTOP_COLUMN, desktop,
-                         BUTTON_COLUMN, desktop->IsCVP() ? NULL : mButtonNormal,
-                         -1);
-      g_free(label);
-
-      if (name == select || i == desktops.begin()) {
+      if (desktop->GetName() == select || i == desktops.begin()) {
          gtk_tree_selection_select_iter(
             gtk_tree_view_get_selection(mDesktopList),
             &iter);
       }
-      if (pb) {
-         g_object_unref(pb);
+   }
+   UpdateButton(this);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::DesktopSelectDlg::UpdateList --
+ *
+ *      Applies a refresh of the desktop list to the rows: removed desktops'
+ *      rows are deleted, changed ones are redrawn and added ones inserted
+ *      at their position in desktops.  Other rows, and the selection, are
+ *      left alone.  If the result does not match desktops, the list is
+ *      rebuilt.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+DesktopSelectDlg::UpdateList(std::vector<Desktop *> &desktops,        // IN
+                             const std::vector<Desktop *> &added,     // IN
+                             const std::vector<Desktop *> &removed,   // IN
+                             const std::vector<Desktop *> &changed)   // IN
+{
+   std::set<Desktop *> removedSet(removed.begin(), removed.end());
+   std::set<Desktop *> changedSet(changed.begin(), changed.end());
+   std::set<Desktop *> addedSet(added.begin(), added.end());
+   GtkTreeModel *model = GTK_TREE_MODEL(mStore);
+   GtkTreeIter iter;
+
+   bool valid = gtk_tree_model_get_iter_first(model, &iter);
+   while (valid) {
+      Desktop *desktop = GetDesktopAt(&iter);
+      if (removedSet.count(desktop)) {
+         valid = gtk_list_store_remove(mStore, &iter);
+         continue;
+      }
+      if (changedSet.count(desktop)) {
+         SetRow(&iter, desktop);
+      }
+      valid = gtk_tree_model_iter_next(model, &iter);
+   }
+
+   /*
+    * Inserting in list order puts each new row at its final position, as
+    * long as the remaining rows were already in order.
+    */
+   int pos = 0;
+   for (std::vector<Desktop *>::iterator i = desktops.begin();
+        i != desktops.end(); i++, pos++) {
+      if (addedSet.count(*i)) {
+         gtk_list_store_insert(mStore, &iter, pos);
+         SetRow(&iter, *i);
       }
    }
+
+   pos = 0;
+   valid = gtk_tree_model_get_iter_first(model, &iter);
+   while (valid && pos < (int)desktops.size() &&
+          GetDesktopAt(&iter) == desktops[pos]) {
+      valid = gtk_tree_model_iter_next(model, &iter);
+      pos++;
+   }
+   if (valid || pos != (int)desktops.size()) {
+      UpdateList(desktops);
+      return;
+   }
+
+   GtkTreeSelection *sel = gtk_tree_view_get_selection(mDesktopList);
+   if (!gtk_tree_selection_get_selected(sel, NULL, NULL) &&
+       gtk_tree_model_get_iter_first(model, &iter)) {
+      gtk_tree_selection_select_iter(sel, &iter);
+   }
    UpdateButton(this);
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::DesktopSelectDlg::UpdateDesktop --
+ *
+ *      Redraws the row of a desktop whose state changed.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+DesktopSelectDlg::UpdateDesktop(Desktop *desktop) // IN
+{
+   GtkTreeModel *model = GTK_TREE_MODEL(mStore);
+   GtkTreeIter iter;
+
+   for (bool valid = gtk_tree_model_get_iter_first(model, &iter); valid;
+        valid = gtk_tree_model_iter_next(model, &iter)) {
+      if (GetDesktopAt(&iter) == desktop) {
+         SetRow(&iter, desktop);
+         break;
+      }
+   }
+   UpdateButton(this);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::DesktopSelectDlg::SetRow --
+ *
+ *      Fills in a list row for a desktop.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+DesktopSelectDlg::SetRow(GtkTreeIter *iter,  // IN
+                         Desktop *desktop)   // IN
+{
+   Util::string name = desktop->GetName();
+   Util::string status = desktop->GetStatusMsg(mIsOffline);
+   GdkPixbuf *pb = GetDesktopIcon(desktop->GetStatus());
+
+   char *label = g_markup_printf_escaped(
+      "<b>%s</b>\n<span size=\"smaller\">%s</span>",
+      name.c_str(),
+      status.c_str());
+   gtk_list_store_set(mStore, iter,
+                      ICON_COLUMN, pb,
+                      LABEL_COLUMN, label,
+                      NAME_COLUMN, name.c_str(),
+                      DESKTOP_COLUMN, desktop,
+                      BUTTON_COLUMN, desktop->IsCVP() ? NULL : mButtonNormal,
+                      -1);
+   g_free(label);
+
+   if (pb) {
+      g_object_unref(pb);
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -67,6 +67,11 @@ public:
    virtual ~DesktopSelectDlg();
 
    void UpdateList(std::vector<Desktop *> &desktops, Util::string select = "");
+   void UpdateList(std::vector<Desktop *> &desktops,
+                   const std::vector<Desktop *> &added,
+                   const std::vector<Desktop *> &removed,
+                   const std::vector<Desktop *> &changed);
+   void UpdateDesktop(Desktop *desktop);
    Desktop *GetDesktop();
    Desktop *GetDesktopAt(GtkTreeIter *iter);
 
@@ -111,6 +116,7 @@ private:
    void UpdateCustomSize();
 
    GdkPixbuf *GetDesktopIcon(Desktop::Status status);
+   void SetRow(GtkTreeIter *iter, Desktop *desktop);
 
    static void OnConnect(GtkButton *button, gpointer userData);
    static void OnResetDesktop(GtkMenuItem *item, gpointer data);
@@ -736,6 +736,65 @@ Window::UpdateDesktops()
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::Window::UpdateDesktop --
+ *
+ *      If mDlg is a DesktopSelectDlg, updates the row for desktop.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Window::UpdateDesktop(Desktop *desktop) // IN
+{
+   DesktopSelectDlg *dlg = dynamic_cast<DesktopSelectDlg *>(mDlg);
+   if (dlg) {
+      dlg->UpdateDesktop(desktop);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::Window::DesktopsChanged --
+ *
+ *      If mDlg is a DesktopSelectDlg, updates the rows a desktop list
+ *      refresh affected.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Window::DesktopsChanged(const Broker::DesktopDiff &diff) // IN
+{
+   DesktopSelectDlg *dlg = dynamic_cast<DesktopSelectDlg *>(mDlg);
+   if (!dlg) {
+      return;
+   }
+   if (diff.reordered) {
+      dlg->UpdateList(mBroker->mDesktops);
+   } else {
+      dlg->UpdateList(mBroker->mDesktops, diff.added, diff.removed,
+                      diff.changed);
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
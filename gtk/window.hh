@@ -81,6 +81,8 @@ public:
    // Implements Broker::Delegate
    virtual void SetLogoutOnCertRemoval(bool enabled);
    virtual void UpdateDesktops();
+   virtual void UpdateDesktop(Desktop *desktop);
+   virtual void DesktopsChanged(const Broker::DesktopDiff &diff);
 
    // State change actions, implements Broker::Delegate
    virtual void RequestBroker();
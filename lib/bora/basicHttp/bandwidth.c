@@ -45,6 +45,13 @@
 
 #define BANDWIDTH_WINDOW_SIZE    64 * 1024  // 64K
 
+/*
+ * Default bucket depth is 100ms worth of the limit, but never less than
+ * one full curl buffer, so that a single write can always complete.
+ */
+#define BANDWIDTH_DEFAULT_BURST_DIVISOR   10
+#define BANDWIDTH_MIN_BURST               CURL_MAX_WRITE_SIZE
+
 void BasicHttpBandwidthReset(BandwidthStatistics *bwStat);
 
 void BasicHttpBandwidthUpdate(BandwidthStatistics *bwStat,
@@ -56,6 +63,11 @@ VmTimeType BasicHttpBandwidthGetDelay(BasicHttpBandwidthGroup *group,
                                       BasicHttpRequest *request,
                                       BandwidthDirection direction);
 
+void BasicHttpBandwidthConsume(BasicHttpBandwidthGroup *group,
+                               BasicHttpRequest *request,
+                               BandwidthDirection direction,
+                               uint64 bytes);
+
 extern void BasicHttpRemoveResumePollCallback(BasicHttpRequest *request);
 
 
@@ -122,6 +134,10 @@ BasicHttp_AddRequestToBandwidthGroup(BasicHttpBandwidthGroup *group,    // IN
    request->bwGroup = group;
    request->nextInBwGroup = group->requestList;
    group->requestList = request;
+   if (0 == request->bwWeight) {
+      request->bwWeight = 1;
+   }
+   memset(request->bwBuckets, 0, sizeof request->bwBuckets);
 
    success = TRUE;
 
@@ -209,6 +225,68 @@ BasicHttp_ChangeBandwidthGroup(BasicHttpBandwidthGroup *group,       // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_SetBandwidthGroupBurst --
+ *
+ *       Set how many bytes the group may send or receive back to back
+ *       after being idle, i.e. the depth of its token buckets.  0 selects
+ *       the default of 100ms worth of the limit.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+BasicHttp_SetBandwidthGroupBurst(BasicHttpBandwidthGroup *group,     // IN
+                                 uint64 uploadBurst,                 // IN
+                                 uint64 downloadBurst)               // IN
+{
+   if (NULL == group) {
+      return;
+   }
+
+   group->bursts[BASICHTTP_UPLOAD] = uploadBurst;
+   group->bursts[BASICHTTP_DOWNLOAD] = downloadBurst;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_SetRequestBandwidthWeight --
+ *
+ *       Set the share of its group's bandwidth a request is entitled to,
+ *       relative to the other active requests in the group.  The
+ *       default weight is 1.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+BasicHttp_SetRequestBandwidthWeight(BasicHttpRequest *request,       // IN
+                                    uint32 weight)                   // IN
+{
+   if (NULL == request) {
+      return;
+   }
+
+   request->bwWeight = MAX(weight, 1);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -413,15 +491,79 @@ BasicHttpBandwidthSlideWindow(BandwidthStatistics *bwStat)        // IN
 /*
  *-----------------------------------------------------------------------------
  *
- * BasicHttpBandwidthGetDelay --
+ * BasicHttpBandwidthGetBurst --
+ *
+ *       Depth of a bucket refilled at rate bytes per second.
+ *
+ * Results:
+ *       Burst in bytes.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int64
+BasicHttpBandwidthGetBurst(BasicHttpBandwidthGroup *group,        // IN
+                           BandwidthDirection direction,          // IN
+                           uint64 rate)                           // IN
+{
+   uint64 burst = group->bursts[direction];
+
+   if (0 == burst) {
+      burst = group->limits[direction] / BANDWIDTH_DEFAULT_BURST_DIVISOR;
+   }
+   if (rate < group->limits[direction]) {
+      burst = burst * rate / group->limits[direction];
+   }
+   return (int64) MAX(burst, BANDWIDTH_MIN_BURST);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpBandwidthRefill --
+ *
+ *       Add the tokens earned since the last refill, up to burst.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BasicHttpBandwidthRefill(BandwidthBucket *bucket,       // IN/OUT
+                         VmTimeType now,                // IN
+                         uint64 rate,                   // IN
+                         int64 burst)                   // IN
+{
+   if (0 == bucket->lastRefill) {
+      bucket->tokens = burst;
+   } else if (now > bucket->lastRefill) {
+      bucket->tokens += (now - bucket->lastRefill) * rate / TIMERATE_FACTOR;
+   }
+   bucket->tokens = MIN(bucket->tokens, burst);
+   bucket->lastRefill = now;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpBandwidthGetShare --
  *
- *       Calculate the needed delay period. If the transfer doesn't exceed the
- *       entitled limit, no delay is needed hence return 0. Otherwise, delay
- *       an amount of time so that the next time when the transfer is resumed,
- *       windowedRate is the same as the entitlement.
+ *       Compute a request's rate within its group: the group's limit
+ *       split between the transfers that are not paused, in proportion
+ *       to their weights.
  *
  * Results:
- *       Delay time in microsecond.
+ *       Rate in bytes per second, 0 if the request is paused.
  *
  * Side effects:
  *       None.
@@ -429,6 +571,55 @@ BasicHttpBandwidthSlideWindow(BandwidthStatistics *bwStat)        // IN
  *-----------------------------------------------------------------------------
  */
 
+static uint64
+BasicHttpBandwidthGetShare(BasicHttpBandwidthGroup *group,        // IN
+                           BasicHttpRequest *request,             // IN
+                           BandwidthDirection direction)          // IN
+{
+   uint32 pausedMaskToCheck;
+   uint64 totalWeight = 0;
+   BasicHttpRequest *curRequest;
+
+   pausedMaskToCheck = (BASICHTTP_UPLOAD == direction) ? CURLPAUSE_SEND
+                                                       : CURLPAUSE_RECV;
+   if (request->pausedMask & pausedMaskToCheck) {
+      return 0;
+   }
+
+   for (curRequest = group->requestList; curRequest;
+        curRequest = curRequest->nextInBwGroup) {
+      if (!(curRequest->pausedMask & pausedMaskToCheck)) {
+         totalWeight += curRequest->bwWeight;
+      }
+   }
+   ASSERT(totalWeight >= request->bwWeight);
+
+   return MAX(group->limits[direction] * request->bwWeight / totalWeight, 1);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpBandwidthGetDelay --
+ *
+ *       Check whether a transfer may proceed.  Each request has a token
+ *       bucket filled at its weighted share of the group's limit, and the
+ *       group has one filled at the full limit; every byte is charged to
+ *       both.  A request may go ahead while its own bucket has tokens, or
+ *       borrow while the group's does, which happens when other requests
+ *       are not using their share.
+ *
+ * Results:
+ *       0 if the transfer may proceed.  Otherwise the time in microseconds
+ *       until one of the buckets is out of debt.
+ *
+ * Side effects:
+ *       Buckets are refilled.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
 VmTimeType
 BasicHttpBandwidthGetDelay(BasicHttpBandwidthGroup *group,        // IN
                            BasicHttpRequest *request,             // IN
@@ -438,83 +629,81 @@ BasicHttpBandwidthGetDelay(BasicHttpBandwidthGroup *group,        // IN
    NOT_IMPLEMENTED();
    return 0;
 #else
-   BandwidthStatistics *stats;
-   VmTimeType delay = 0;
-   uint64 quota;
-   uint64 pool = 0;
-   BasicHttpRequest *curRequest;
-   uint32 requestCount = 0;
-   uint32 pausedMaskToCheck = 0;
+   BandwidthBucket *own;
+   BandwidthBucket *shared;
+   uint64 limit;
+   uint64 share;
+   VmTimeType now;
+   VmTimeType delay;
 
    ASSERT(group && request);
    ASSERT(request->bwGroup == group);
    ASSERT((BASICHTTP_UPLOAD == direction) || (BASICHTTP_DOWNLOAD == direction));
 
-   if (BASICHTTP_UPLOAD == direction) {
-      pausedMaskToCheck = CURLPAUSE_SEND;
-   } else if (BASICHTTP_DOWNLOAD == direction) {
-      pausedMaskToCheck = CURLPAUSE_RECV;
+   limit = group->limits[direction];
+   if (BASICHTTP_UNLIMITED_BANDWIDTH == limit) {
+      return 0;
    }
 
-   if (request->pausedMask & pausedMaskToCheck) {
+   share = BasicHttpBandwidthGetShare(group, request, direction);
+   if (0 == share) {
       Log("BasicHttpBandwidthGetDelay: This %s transfer is paused.\n",
           (BASICHTTP_UPLOAD == direction) ? "upload" : "download");
-      goto abort;
-   }
-
-   /*
-    * Go through the request list to count unpaused transfers.
-    */
-   curRequest = group->requestList;
-   for (; curRequest; curRequest = curRequest->nextInBwGroup) {
-      if (!(curRequest->pausedMask & pausedMaskToCheck)) {
-         ++requestCount;
-      }
-   }
-
-   if (requestCount <= 0) {
-      Log("BasicHttpBandwidthGetDelay: All %s transfers are paused.\n",
-          (BASICHTTP_UPLOAD == direction) ? "upload" : "download");
-      goto abort;
+      return 0;
    }
 
-   stats = &(request->statistics[direction]);
+   BasicHttpGetTimeOfDay(&now);
+   own = &request->bwBuckets[direction];
+   shared = &group->buckets[direction];
+   BasicHttpBandwidthRefill(own, now, share,
+                            BasicHttpBandwidthGetBurst(group, direction, share));
+   BasicHttpBandwidthRefill(shared, now, limit,
+                            BasicHttpBandwidthGetBurst(group, direction, limit));
 
-   quota = group->limits[direction] / requestCount;
-
-   if (stats->windowedRate <= quota) {
-      goto abort;
+   if (own->tokens > 0 || shared->tokens > 0) {
+      return 0;
    }
 
    /*
-    * Collect unused bandwidth from slow connections and allot to fast ones.
+    * Wake up exactly when the first bucket reaches one token.
     */
-   curRequest = group->requestList;
-   for (; curRequest; curRequest = curRequest->nextInBwGroup) {
-      if (!(curRequest->pausedMask & pausedMaskToCheck)
-            && (curRequest->statistics[direction].windowedRate < quota)) {
-         pool += quota - curRequest->statistics[direction].windowedRate;
-         --requestCount;
-      }
-   }
+   delay = MIN((1 - own->tokens) * TIMERATE_FACTOR / (int64) share,
+               (1 - shared->tokens) * TIMERATE_FACTOR / (int64) limit);
+   return MAX(delay, 1);
+#endif
+}
 
-   if (requestCount > 0) {
-      quota += pool / requestCount;
-   }
 
-   if (stats->windowedRate <= quota) {
-      goto abort;
-   }
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpBandwidthConsume --
+ *
+ *       Charge a transfer that has been allowed to proceed to its own
+ *       bucket and the group's.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       Buckets may go into debt.
+ *
+ *-----------------------------------------------------------------------------
+ */
 
-   /*
-    * Delay so that the next time, windowedRate is the same as quota.
-    *    winRate=winBytes/T --> quota=winBytes/(T+dT)
-    *    ==> dT = winBytes/quota - winBytes/winRate
-    */
-   delay = stats->windowedBytes * TIMERATE_FACTOR / quota -
-             stats->windowedBytes * TIMERATE_FACTOR / stats->windowedRate;
+void
+BasicHttpBandwidthConsume(BasicHttpBandwidthGroup *group,         // IN
+                          BasicHttpRequest *request,              // IN
+                          BandwidthDirection direction,           // IN
+                          uint64 bytes)                           // IN
+{
+   ASSERT(group && request);
+   ASSERT(request->bwGroup == group);
 
-abort:
-   return delay;
-#endif
+   if (BASICHTTP_UNLIMITED_BANDWIDTH == group->limits[direction]) {
+      return;
+   }
+
+   request->bwBuckets[direction].tokens -= (int64) bytes;
+   group->buckets[direction].tokens -= (int64) bytes;
 }
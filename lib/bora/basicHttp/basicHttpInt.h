@@ -53,16 +53,29 @@ struct BandwidthStatistics {
    VmTimeType  lastTime;
 };
 
+/*
+ * Token bucket: tokens are bytes that may be sent now, refilled at the
+ * bucket's rate up to its depth.  A negative count is debt from a
+ * transfer that was larger than the tokens available.
+ */
+typedef struct BandwidthBucket {
+   int64       tokens;
+   VmTimeType  lastRefill;
+} BandwidthBucket;
+
 struct BasicHttpBandwidthGroup {
    uint64            limits[2];
+   uint64            bursts[2];      // Bucket depth in bytes, 0 for default
+   BandwidthBucket   buckets[2];
    BasicHttpRequest  *requestList;
 };
 
 struct BasicHttpCookieJar {
-   CURLSH               *curlShare;     // Use CURLSH to maintain all the cookies.
+   CURLSH               *curlShare;     // Cookies, DNS and TLS session cache.
    char                 *initialCookie; // Initial cookie for the jar.
-   char                 *cookieFile;    // Filename to use instead of a CURLSH
+   char                 *cookieFile;    // File to use instead of sharing cookies
    Bool                  newSession;    // next cnxn gets a new cookie session
+   BasicHttpConnectionStats stats;      // Connection reuse through this jar
 };
 
 struct BasicHttpSource {
@@ -70,6 +83,11 @@ struct BasicHttpSource {
    void *privat;
 };
 
+struct BasicHttpSink {
+   const BasicHttpSinkOps *ops;
+   void *privat;
+};
+
 struct BasicHttpRequest {
    const char                *url;
    BasicHttpMethod           httpMethod;
@@ -84,6 +102,8 @@ struct BasicHttpRequest {
    Bool                      ownBody;
 
    DynBuf                    receiveBuf;
+   BasicHttpSink             *sink;         // Caller owned; replaces receiveBuf
+   Bool                      sinkHinted;
    BasicHttpOptions          options;
    BasicHttpOnSentProc       *onSentProc;
    BasicHttpProgressProc     *sendProgressProc;
@@ -92,6 +112,8 @@ struct BasicHttpRequest {
 
    BasicHttpBandwidthGroup   *bwGroup;
    BasicHttpRequest          *nextInBwGroup;
+   uint32                    bwWeight;      // Share of the group's limits
+   BandwidthBucket           bwBuckets[2];
    BandwidthStatistics       statistics[2];
 
    uint32                    pausedMask;
@@ -43,15 +43,20 @@
 #include <curl/easy.h>
 #include <curl/multi.h>
 
+#include <errno.h>
+#include <fcntl.h>
+
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <mswsock.h>
+#include <io.h>
 #else
 #include <sys/types.h>
 #include <sys/poll.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -60,6 +65,8 @@
 
 #define DEFAULT_MAX_OUTSTANDING_REQUESTS ((size_t)-1)
 #define BASIC_HTTP_TIMEOUT_DATA ((void *)1)
+#define BASIC_HTTP_SOCKET_TABLE_SIZE 256  /* Hash buckets, a power of 2 */
+#define BASIC_HTTP_FILE_SINK_BUFSIZE (256 * 1024)  /* Bytes per write(v) */
 
 /*
  * Return the lenght of the matching strings or 0 (zero) if not matching.
@@ -93,7 +100,7 @@ struct CurlSocketState;
 
 typedef struct CurlGlobalState {
    CURLM                   *curlMulti;
-   struct CurlSocketState  *socketList;
+   HashTable               *sockets;  /* curl_socket_t -> CurlSocketState */
    Bool                    useGlib;
    HashTable               *requests;
    Bool                    skipRemove;
@@ -103,8 +110,6 @@ typedef struct CurlGlobalState {
 } CurlGlobalState;
 
 typedef struct CurlSocketState {
-   struct CurlSocketState  *next;
-
    curl_socket_t           socket;
    CURL                    *curl;
    int                     action;
@@ -125,9 +130,11 @@ static void BasicHttpSetSocketState(CurlSocketState *socketState,
                                     CURL *curl,
                                     int action);
 
-static void BasicHttpPollAdd(CurlSocketState *socketState);
+static void BasicHttpPollAdd(CurlSocketState *socketState,
+                             int action);
 
-static void BasicHttpPollRemove(CurlSocketState *socketState);
+static void BasicHttpPollRemove(CurlSocketState *socketState,
+                                int action);
 
 static void BasicHttpSocketPollCallback(void *clientData);
 
@@ -143,6 +150,8 @@ static int BasicHttpTimerCurlCallback(CURLM *multi,
 
 static Bool BasicHttpStartRequest(BasicHttpRequest *request);
 
+static CURLSH *BasicHttpCreateShare(Bool shareCookies);
+
 static size_t BasicHttpHeaderCallback(void *buffer,
                                       size_t size,
                                       size_t nmemb,
@@ -172,6 +181,15 @@ static Bool BasicHttpSourceRewind(BasicHttpSource *source);
 
 static size_t BasicHttpSourceLength(BasicHttpSource *source);
 
+static ssize_t BasicHttpSinkWrite(BasicHttpSink *sink,
+                                  const void *buffer,
+                                  size_t size);
+
+static void BasicHttpSinkSizeHint(BasicHttpSink *sink,
+                                  int64 expectedLength);
+
+static Bool BasicHttpSinkFinish(BasicHttpSink *sink);
+
 #if !(LIBCURL_VERSION_MAJOR <=7 && LIBCURL_VERSION_MINOR < 18)
 static void BasicHttpResumePollCallback(void *clientData);
 
@@ -189,6 +207,11 @@ extern VmTimeType BasicHttpBandwidthGetDelay(BasicHttpBandwidthGroup *group,
                                              BasicHttpRequest *request,
                                              BandwidthDirection direction);
 
+extern void BasicHttpBandwidthConsume(BasicHttpBandwidthGroup *group,
+                                      BasicHttpRequest *request,
+                                      BandwidthDirection direction,
+                                      uint64 bytes);
+
 static CurlGlobalState *curlGlobalState = NULL;
 static BasicHttpCookieJar *defaultCookieJar = NULL;
 
@@ -287,6 +310,8 @@ BasicHttp_InitEx(PollCallbackProc *pollCbProc,              // IN
                      NULL);
 
    curlGlobalState->requests = HashTable_Alloc(16, HASH_INT_KEY, NULL);
+   curlGlobalState->sockets = HashTable_Alloc(BASIC_HTTP_SOCKET_TABLE_SIZE,
+                                              HASH_INT_KEY, NULL);
    curlGlobalState->skipRemove = FALSE;
    curlGlobalState->maxOutstandingRequests = maxOutstandingRequests;
    curlGlobalState->pending = RequestQueue_New();
@@ -392,6 +417,7 @@ BasicHttp_Shutdown(void)
    if (NULL != curlGlobalState) {
       curl_multi_cleanup(curlGlobalState->curlMulti);
       curl_global_cleanup();
+      HashTable_Free(curlGlobalState->sockets);
       free(curlGlobalState);
       curlGlobalState = NULL;
    }
@@ -420,9 +446,8 @@ BasicHttp_CreateCookieJar(void)
 
    ASSERT(NULL != curlGlobalState);
 
-   cookieJar = (BasicHttpCookieJar *) Util_SafeMalloc(sizeof *cookieJar);
-   cookieJar->curlShare = curl_share_init();
-   curl_share_setopt(cookieJar->curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
+   cookieJar = (BasicHttpCookieJar *) Util_SafeCalloc(1, sizeof *cookieJar);
+   cookieJar->curlShare = BasicHttpCreateShare(TRUE);
    cookieJar->initialCookie = NULL;
    cookieJar->cookieFile = NULL;
    cookieJar->newSession = FALSE;
@@ -431,6 +456,45 @@ BasicHttp_CreateCookieJar(void)
 } // BasicHttp_CreateCookieJar
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpCreateShare --
+ *
+ *      Create the CURLSH that pools state across the requests of a
+ *      cookie jar: DNS lookups, TLS session IDs/tickets, and the
+ *      cookies themselves unless they live in a file.
+ *
+ *      Live connections stay in the multi handle's cache, so
+ *      BasicHttp_Shutdown() still closes them; only the state needed to
+ *      open new ones quickly is kept here.
+ *
+ * Results:
+ *      CURLSH.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static CURLSH *
+BasicHttpCreateShare(Bool shareCookies) // IN
+{
+   CURLSH *curlShare = curl_share_init();
+
+   if (shareCookies) {
+      curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_COOKIE);
+   }
+   curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x071700
+   curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#endif
+
+   return curlShare;
+} // BasicHttpCreateShare
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -452,8 +516,8 @@ BasicHttp_CreateCookieFile(const char *cookieFile)
 {
    BasicHttpCookieJar *cookieJar;
 
-   cookieJar = (BasicHttpCookieJar *) Util_SafeMalloc(sizeof *cookieJar);
-   cookieJar->curlShare = NULL;
+   cookieJar = (BasicHttpCookieJar *) Util_SafeCalloc(1, sizeof *cookieJar);
+   cookieJar->curlShare = BasicHttpCreateShare(FALSE);
    cookieJar->initialCookie = NULL;
    cookieJar->cookieFile = Util_SafeStrdup(cookieFile);
    cookieJar->newSession = FALSE;
@@ -540,7 +604,9 @@ BasicHttp_FreeCookieJar(BasicHttpCookieJar *cookieJar)      // IN
    }
 
    if (cookieJar->curlShare) {
-      curl_share_setopt(cookieJar->curlShare, CURLSHOPT_UNSHARE, CURL_LOCK_DATA_COOKIE);
+      if (NULL == cookieJar->cookieFile) {
+         curl_share_setopt(cookieJar->curlShare, CURLSHOPT_UNSHARE, CURL_LOCK_DATA_COOKIE);
+      }
       curl_share_cleanup (cookieJar->curlShare);
    }
    free(cookieJar->initialCookie);
@@ -549,6 +615,98 @@ BasicHttp_FreeCookieJar(BasicHttpCookieJar *cookieJar)      // IN
 } // BasicHttp_FreeCookieJar
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_GetConnectionStats --
+ *
+ *      Report how well the requests using a cookie jar have been reusing
+ *      connections.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+BasicHttp_GetConnectionStats(BasicHttpCookieJar *cookieJar,     // IN
+                             BasicHttpConnectionStats *stats)   // OUT
+{
+   ASSERT(NULL != cookieJar);
+   ASSERT(NULL != stats);
+
+   *stats = cookieJar->stats;
+} // BasicHttp_GetConnectionStats
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_ForgetSslSessions --
+ *
+ *      Drop the TLS sessions cached by a cookie jar, so the next
+ *      connection does a full handshake.  This is needed when the
+ *      client certificate we are willing to present has changed, as a
+ *      resumed session would carry over the old one.
+ *
+ *      curl can only drop the session cache by discarding the CURLSH,
+ *      so the cookies of a memory jar are copied over to a fresh one.
+ *      No request may be using the jar.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      The jar's CURLSH is replaced.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+BasicHttp_ForgetSslSessions(BasicHttpCookieJar *cookieJar)      // IN
+{
+   Bool shareCookies;
+   CURLSH *newShare;
+   CURL *curl;
+
+   ASSERT(NULL != cookieJar);
+
+   shareCookies = NULL == cookieJar->cookieFile;
+   newShare = BasicHttpCreateShare(shareCookies);
+
+   curl = curl_easy_init();
+   if (NULL == curl) {
+      curl_share_cleanup(newShare);
+      return;
+   }
+
+   if (shareCookies) {
+      struct curl_slist *cookies = NULL;
+      struct curl_slist *cookie;
+
+      curl_easy_setopt(curl, CURLOPT_SHARE, cookieJar->curlShare);
+      curl_easy_getinfo(curl, CURLINFO_COOKIELIST, &cookies);
+      curl_easy_setopt(curl, CURLOPT_SHARE, newShare);
+      for (cookie = cookies; NULL != cookie; cookie = cookie->next) {
+         curl_easy_setopt(curl, CURLOPT_COOKIELIST, cookie->data);
+      }
+      curl_slist_free_all(cookies);
+   }
+   curl_easy_cleanup(curl);
+
+   if (shareCookies) {
+      curl_share_setopt(cookieJar->curlShare, CURLSHOPT_UNSHARE, CURL_LOCK_DATA_COOKIE);
+   }
+   curl_share_cleanup(cookieJar->curlShare);
+   cookieJar->curlShare = newShare;
+   cookieJar->stats.sslSessionFlushes++;
+} // BasicHttp_ForgetSslSessions
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -657,13 +815,9 @@ BasicHttpFindSocket(curl_socket_t sock)                  // IN
 
    ASSERT(NULL != curlGlobalState);
 
-   socketState = curlGlobalState->socketList;
-   while (NULL != socketState) {
-      if (sock == socketState->socket)
-         break;
-
-      socketState = socketState->next;
-   }
+   HashTable_Lookup(curlGlobalState->sockets,
+                    (const char *)(uintptr_t)sock,
+                    (void **)&socketState);
 
    return socketState;
 } // BasicHttpFindSocket
@@ -698,10 +852,11 @@ BasicHttpAddSocket(curl_socket_t sock,                   // IN
    socketState->curl = curl;
    socketState->action = action;
 
-   BasicHttpPollAdd(socketState);
+   BasicHttpPollAdd(socketState, action);
 
-   socketState->next = curlGlobalState->socketList;
-   curlGlobalState->socketList = socketState;
+   HashTable_Insert(curlGlobalState->sockets,
+                    (const char *)(uintptr_t)sock,
+                    socketState);
 
    return socketState;
 } // BasicHttpAddSocket
@@ -724,23 +879,15 @@ BasicHttpAddSocket(curl_socket_t sock,                   // IN
 void
 BasicHttpRemoveSocket(curl_socket_t sock)                   // IN
 {
-   CurlSocketState **socketState;
-   CurlSocketState *socketStateToRemove = NULL;
+   CurlSocketState *socketState = NULL;
 
    ASSERT(NULL != curlGlobalState);
 
-   socketState = &(curlGlobalState->socketList);
-   while (NULL != *socketState) {
-      if (sock != (*socketState)->socket) {
-         socketState = &((*socketState)->next);
-         continue;
-      }
-
-      socketStateToRemove = *socketState;
-      *socketState = (*socketState)->next;
-
-      BasicHttpPollRemove(socketStateToRemove);
-      free(socketStateToRemove);
+   if (HashTable_LookupAndDelete(curlGlobalState->sockets,
+                                 (const char *)(uintptr_t)sock,
+                                 (void **)&socketState)) {
+      BasicHttpPollRemove(socketState, socketState->action);
+      free(socketState);
    }
 } // BasicHttpRemoveSocket
 
@@ -750,6 +897,9 @@ BasicHttpRemoveSocket(curl_socket_t sock)                   // IN
  *
  * BasicHttpSetSocketState --
  *
+ *       Update a socket's state.  Only the poll callbacks for directions
+ *       that curl stopped or started waiting on are removed or added; the
+ *       others stay registered.
  *
  * Results:
  *       None.
@@ -765,17 +915,17 @@ BasicHttpSetSocketState(CurlSocketState *socketState,    // IN
                         CURL *curl,                      // IN
                         int action)                      // IN
 {
+   int oldAction;
+
    ASSERT(NULL != socketState);
+   ASSERT(socketState->socket == sock);
 
-   if ((socketState->socket != sock)
-         || (socketState->curl != curl)
-         || (socketState->action != action)) {
-      BasicHttpPollRemove(socketState);
-      socketState->socket = sock;
-      socketState->curl = curl;
-      socketState->action = action;
-      BasicHttpPollAdd(socketState);
-   }
+   oldAction = socketState->action;
+   socketState->curl = curl;
+   socketState->action = action;
+
+   BasicHttpPollRemove(socketState, oldAction & ~action);
+   BasicHttpPollAdd(socketState, action & ~oldAction);
 } // BasicHttpSetSocketState
 
 
@@ -784,6 +934,7 @@ BasicHttpSetSocketState(CurlSocketState *socketState,    // IN
  *
  * BasicHttpPollAdd --
  *
+ *       Register poll callbacks for the directions in action.
  *
  * Results:
  *       None.
@@ -794,13 +945,14 @@ BasicHttpSetSocketState(CurlSocketState *socketState,    // IN
  */
 
 void
-BasicHttpPollAdd(CurlSocketState *socketState)           // IN
+BasicHttpPollAdd(CurlSocketState *socketState,           // IN
+                 int action)                             // IN
 {
    VMwareStatus pollResult;
 
    ASSERT(NULL != socketState);
 
-   if (CURL_POLL_IN & socketState->action) {
+   if (CURL_POLL_IN & action) {
       pollResult = pollCallbackProc(POLL_CS_MAIN,
                                     POLL_FLAG_READ |
                                     POLL_FLAG_PERIODIC |
@@ -814,7 +966,7 @@ BasicHttpPollAdd(CurlSocketState *socketState)           // IN
          ASSERT(0);
       }
    }
-   if (CURL_POLL_OUT & socketState->action) {
+   if (CURL_POLL_OUT & action) {
       pollResult = pollCallbackProc(POLL_CS_MAIN,
                                     POLL_FLAG_WRITE |
                                     POLL_FLAG_PERIODIC |
@@ -836,6 +988,7 @@ BasicHttpPollAdd(CurlSocketState *socketState)           // IN
  *
  * BasicHttpPollRemove --
  *
+ *       Remove the poll callbacks for the directions in action.
  *
  * Results:
  *       None.
@@ -846,11 +999,12 @@ BasicHttpPollAdd(CurlSocketState *socketState)           // IN
  */
 
 void
-BasicHttpPollRemove(CurlSocketState *socketState)        // IN
+BasicHttpPollRemove(CurlSocketState *socketState,        // IN
+                    int action)                          // IN
 {
    ASSERT(NULL != socketState);
 
-   if (CURL_POLL_IN & socketState->action) {
+   if (CURL_POLL_IN & action) {
       pollCallbackRemoveProc(POLL_CS_MAIN,
                              POLL_FLAG_READ |
                              POLL_FLAG_PERIODIC |
@@ -859,7 +1013,7 @@ BasicHttpPollRemove(CurlSocketState *socketState)        // IN
                              socketState,
                              POLL_DEVICE);
    }
-   if (CURL_POLL_OUT & socketState->action) {
+   if (CURL_POLL_OUT & action) {
       pollCallbackRemoveProc(POLL_CS_MAIN,
                              POLL_FLAG_WRITE |
                              POLL_FLAG_PERIODIC |
@@ -893,6 +1047,9 @@ BasicHttpCompleteRequestCallback(void *clientData)          // IN
    BasicHttpErrorCode errorCode;
    size_t contentLength;
    char *effectiveURL;
+#if LIBCURL_VERSION_NUM >= 0x071300
+   char *primaryIP;
+#endif
 
    ASSERT(NULL != clientData);
 
@@ -905,6 +1062,19 @@ BasicHttpCompleteRequestCallback(void *clientData)          // IN
       response->effectiveURL = strdup(effectiveURL);
    }
 
+#if LIBCURL_VERSION_NUM >= 0x071300
+   /*
+    * The address curl resolved and connected to, so callers that need it
+    * (e.g. to find the local interface facing the server) do not have to
+    * resolve the host name again themselves.
+    */
+   if (CURLE_OK == curl_easy_getinfo(request->curl, CURLINFO_PRIMARY_IP,
+                                     &primaryIP) &&
+       NULL != primaryIP && '\0' != *primaryIP) {
+      response->primaryIP = strdup(primaryIP);
+   }
+#endif
+
    /* Map error codes. */
    switch (request->result) {
    /* 1:1 mappings. */
@@ -959,8 +1129,24 @@ BasicHttpCompleteRequestCallback(void *clientData)          // IN
       errorCode = BASICHTTP_ERROR_GENERIC;
       break;
    }
+   if (BASICHTTP_ERROR_NONE == errorCode && NULL != request->sink &&
+       !BasicHttpSinkFinish(request->sink)) {
+      errorCode = BASICHTTP_ERROR_TRANSFER;
+   }
    response->errorCode = errorCode;
 
+   if (NULL != request->cookieJar && CURLE_OK == request->result) {
+      long numConnects = 0;
+
+      request->cookieJar->stats.requests++;
+      curl_easy_getinfo(request->curl, CURLINFO_NUM_CONNECTS, &numConnects);
+      if (numConnects > 0) {
+         request->cookieJar->stats.connections += numConnects;
+      } else {
+         request->cookieJar->stats.reusedConnections++;
+      }
+   }
+
    contentLength = DynBuf_GetSize(&request->receiveBuf);
    response->content = (char *) Util_SafeMalloc(contentLength + 1);
    if (contentLength > 0) {
@@ -1535,6 +1721,35 @@ BasicHttp_SetConnectTimeout(BasicHttpRequest *request,      // IN:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_SetSink --
+ *
+ *       Stream the response body of a request to a sink, rather than
+ *       collecting it into response->content.  The caller keeps ownership
+ *       of the sink, which must outlive the request.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+BasicHttp_SetSink(BasicHttpRequest *request,    // IN
+                  BasicHttpSink *sink)          // IN
+{
+   ASSERT(NULL != request);
+
+   request->sink = sink;
+   request->sinkHinted = FALSE;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1655,14 +1870,13 @@ BasicHttpStartRequest(BasicHttpRequest *request)            // IN
          curl_easy_setopt(request->curl, CURLOPT_COOKIESESSION, (long)1);
          request->cookieJar->newSession = FALSE;
       }
-      if (NULL != request->cookieJar->curlShare) {
-         curl_easy_setopt(request->curl, CURLOPT_SHARE, request->cookieJar->curlShare);
-         curl_easy_setopt(request->curl, CURLOPT_COOKIEFILE, "");
-      } else if (NULL != request->cookieJar->cookieFile) {
+      ASSERT(NULL != request->cookieJar->curlShare);
+      curl_easy_setopt(request->curl, CURLOPT_SHARE, request->cookieJar->curlShare);
+      if (NULL != request->cookieJar->cookieFile) {
          curl_easy_setopt(request->curl, CURLOPT_COOKIEFILE, request->cookieJar->cookieFile);
          curl_easy_setopt(request->curl, CURLOPT_COOKIEJAR, request->cookieJar->cookieFile);
       } else {
-         NOT_REACHED();
+         curl_easy_setopt(request->curl, CURLOPT_COOKIEFILE, "");
       }
 
       /*
@@ -1758,6 +1972,36 @@ BasicHttpStartRequest(BasicHttpRequest *request)            // IN
 } // BasicHttpStartRequest
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_HasProgressCallbacks --
+ *
+ *       Whether this build calls the progress procs passed to
+ *       BasicHttp_SendRequestEx.  They need libcurl 7.18 or later; with
+ *       older versions they are never called, so a caller that relies on
+ *       them must not also pass BASICHTTP_NO_RESPONSE_CONTENT.
+ *
+ * Results:
+ *       TRUE if progress procs are called.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+BasicHttp_HasProgressCallbacks(void)
+{
+#if LIBCURL_VERSION_MAJOR <= 7 && LIBCURL_VERSION_MINOR < 18
+   return FALSE;
+#else
+   return TRUE;
+#endif
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -2382,6 +2626,13 @@ BasicHttpReadCallback(void *buffer,                      // IN, OUT
       goto exit;
    }
 
+#if !(LIBCURL_VERSION_MAJOR <=7 && LIBCURL_VERSION_MINOR < 18)
+   if (request->bwGroup) {
+      BasicHttpBandwidthConsume(request->bwGroup, request,
+                                BASICHTTP_UPLOAD, ret);
+   }
+#endif
+
 exit:
    return ret;
 }
@@ -2452,6 +2703,9 @@ BasicHttpWriteCallback(void *buffer,                     // IN
          ret = CURL_WRITEFUNC_PAUSE;
          goto exit;
       }
+
+      BasicHttpBandwidthConsume(request->bwGroup, request,
+                                BASICHTTP_DOWNLOAD, bufferSize);
    }
 
    BasicHttpBandwidthSlideWindow(&(request->statistics[BASICHTTP_DOWNLOAD]));
@@ -2478,11 +2732,25 @@ BasicHttpWriteCallback(void *buffer,                     // IN
 #endif
 
    /*
-    * If the caller set BASICHTTP_NO_RESPONSE_CONTENT, it means the caller
+    * A sink takes the body instead of response->content.  Otherwise, if
+    * the caller set BASICHTTP_NO_RESPONSE_CONTENT, it means the caller
     * doesn't want to receive the response content from response->content.
     * Otherwise, append the partial result here into request->receiveBuf.
     */
-   if (!(BASICHTTP_NO_RESPONSE_CONTENT & request->options)) {
+   if (NULL != request->sink) {
+      if (!request->sinkHinted) {
+         request->sinkHinted = TRUE;
+         if (BASICHTTP_UNKNOWN_SIZE != request->recvContentInfo.expectedLength) {
+            BasicHttpSinkSizeHint(request->sink,
+                                  request->recvContentInfo.expectedLength);
+         }
+      }
+      if (BasicHttpSinkWrite(request->sink, buffer, bufferSize) !=
+          (ssize_t) bufferSize) {
+         Log("BasicHTTP: Sink failed to accept received data.\n");
+         goto exit;
+      }
+   } else if (!(BASICHTTP_NO_RESPONSE_CONTENT & request->options)) {
       if (!DynBuf_Append(&request->receiveBuf, buffer, bufferSize)) {
          /*
           * If Append() fails, return 0 to stop the transfer.
@@ -2983,6 +3251,646 @@ BasicHttpMemorySourceLength(void *privat)                  // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_AllocSink --
+ *       Create a sink from a set of operations.
+ *
+ * Results:
+ *       A pointer to a sink. Caller must call BasicHttp_FreeSink.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+BasicHttpSink *
+BasicHttp_AllocSink(const BasicHttpSinkOps *ops,        // IN
+                    void *privat)                       // IN
+{
+   BasicHttpSink *ret = Util_SafeCalloc(1, sizeof(*ret));
+
+   ASSERT(ops && ops->writeProc);
+   ret->ops = ops;
+   ret->privat = privat;
+
+   return ret;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_FreeSink --
+ *       Free a sink.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+BasicHttp_FreeSink(BasicHttpSink *sink)                 // IN
+{
+   if (sink) {
+      if (sink->ops && sink->ops->destructProc) {
+         sink->ops->destructProc(sink->privat);
+      }
+      free(sink);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpSinkWrite --
+ *      Safely write to a sink.
+ *
+ * Results:
+ *      Length in bytes consumed, -1 on failure.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+ssize_t
+BasicHttpSinkWrite(BasicHttpSink *sink,         // IN
+                   const void *buffer,          // IN
+                   size_t size)                 // IN
+{
+   ssize_t ret;
+
+   ASSERT(sink);
+
+   ASSERT(sink->ops && sink->ops->writeProc);
+   ret = sink->ops->writeProc(sink->privat, buffer, size);
+
+   /* Valid return values of a write method. */
+   ASSERT(-1 <= ret);
+   return ret;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpSinkSizeHint --
+ *      Tell a sink how much data to expect, if it cares.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+BasicHttpSinkSizeHint(BasicHttpSink *sink,      // IN
+                      int64 expectedLength)     // IN
+{
+   ASSERT(sink && sink->ops);
+
+   if (sink->ops->sizeHintProc) {
+      sink->ops->sizeHintProc(sink->privat, expectedLength);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpSinkFinish --
+ *      Let a sink complete any buffered work once the body is done.
+ *
+ * Results:
+ *      TRUE on success.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+BasicHttpSinkFinish(BasicHttpSink *sink)        // IN
+{
+   ASSERT(sink && sink->ops);
+
+   return sink->ops->finishProc ? sink->ops->finishProc(sink->privat) : TRUE;
+}
+
+
+/* BasicHttpMemorySink implementation. */
+typedef struct BasicHttpMemorySink {
+   DynBuf buf;
+   size_t maxSize;      // 0 for no limit
+} BasicHttpMemorySink;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpMemorySinkWrite --
+ *       Append data to a memory sink, unless that exceeds its limit.
+ *
+ * Results:
+ *       size on success, -1 on failure.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ssize_t
+BasicHttpMemorySinkWrite(void *privat,                  // IN
+                         const void *buffer,            // IN
+                         size_t size)                   // IN
+{
+   BasicHttpMemorySink *sink = (BasicHttpMemorySink *) privat;
+
+   if (sink->maxSize && DynBuf_GetSize(&sink->buf) + size > sink->maxSize) {
+      Log("BasicHTTP: Response exceeds memory sink limit of %"FMTSZ"u "
+          "bytes.\n", sink->maxSize);
+      return -1;
+   }
+   if (!DynBuf_Append(&sink->buf, buffer, size)) {
+      return -1;
+   }
+   return size;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpMemorySinkSizeHint --
+ *       Grow a memory sink up front for a known Content-Length.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BasicHttpMemorySinkSizeHint(void *privat,               // IN
+                            int64 expectedLength)       // IN
+{
+   BasicHttpMemorySink *sink = (BasicHttpMemorySink *) privat;
+
+   if (expectedLength > 0 &&
+       (!sink->maxSize || (uint64) expectedLength <= sink->maxSize)) {
+      DynBuf_Enlarge(&sink->buf, (size_t) expectedLength);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpMemorySinkDestruct --
+ *       Free a BasicHttpMemorySink.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BasicHttpMemorySinkDestruct(void *privat)               // IN
+{
+   BasicHttpMemorySink *sink = (BasicHttpMemorySink *) privat;
+
+   DynBuf_Destroy(&sink->buf);
+   free(sink);
+}
+
+
+static const BasicHttpSinkOps BasicHttpMemorySinkOps = {
+   BasicHttpMemorySinkWrite,
+   BasicHttpMemorySinkSizeHint,
+   NULL,
+   BasicHttpMemorySinkDestruct
+};
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_AllocMemorySink --
+ *       Create a sink that collects the response in memory, failing the
+ *       transfer if it grows beyond maxSize bytes (0 for no limit).
+ *
+ * Results:
+ *       A pointer to a memory sink. Caller must call BasicHttp_FreeSink.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+BasicHttpSink *
+BasicHttp_AllocMemorySink(size_t maxSize)               // IN
+{
+   BasicHttpMemorySink *sink = Util_SafeCalloc(1, sizeof(*sink));
+
+   DynBuf_Init(&sink->buf);
+   sink->maxSize = maxSize;
+
+   return BasicHttp_AllocSink(&BasicHttpMemorySinkOps, sink);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_GetMemorySinkData --
+ *       Get the data collected by a memory sink.
+ *
+ * Results:
+ *       Pointer to the data, owned by the sink, and its size.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+const void *
+BasicHttp_GetMemorySinkData(BasicHttpSink *sink,        // IN
+                            size_t *size)               // OUT
+{
+   BasicHttpMemorySink *memSink;
+
+   ASSERT(sink && sink->ops == &BasicHttpMemorySinkOps);
+   memSink = (BasicHttpMemorySink *) sink->privat;
+
+   *size = DynBuf_GetSize(&memSink->buf);
+   return DynBuf_Get(&memSink->buf);
+}
+
+
+/* BasicHttpFileSink implementation. */
+typedef struct BasicHttpFileSink {
+   int fd;
+   Bool closeFd;
+   Bool failed;
+   uint8 *buf;          // Staging for the small writes curl hands us
+   size_t bufUsed;
+   int64 written;       // Bytes written to fd
+   int64 start;         // Offset of the first byte, -1 if not seekable
+   int64 reserved;      // Bytes preallocated from start
+} BasicHttpFileSink;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpFileSinkFlush --
+ *       Write out the staging buffer followed by extra, which is not
+ *       copied: curl hands us at most CURL_MAX_WRITE_SIZE bytes at a
+ *       time, so they are batched up and written in one call.
+ *
+ * Results:
+ *       TRUE on success.
+ *
+ * Side effects:
+ *       Staging buffer is empty.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+BasicHttpFileSinkFlush(BasicHttpFileSink *sink,         // IN
+                       const void *extra,               // IN/OPT
+                       size_t extraLen)                 // IN
+{
+#ifdef _WIN32
+   const uint8 *data[2];
+   size_t len[2];
+   int i;
+
+   data[0] = sink->buf;
+   len[0] = sink->bufUsed;
+   data[1] = extra;
+   len[1] = extraLen;
+
+   for (i = 0; i < 2; i++) {
+      while (len[i] > 0) {
+         int n = _write(sink->fd, data[i], (unsigned int) len[i]);
+         if (n < 0) {
+            if (EINTR == errno) {
+               continue;
+            }
+            Log("BasicHTTP: Failed to write to file sink: %d.\n", errno);
+            return FALSE;
+         }
+         data[i] += n;
+         len[i] -= n;
+         sink->written += n;
+      }
+   }
+#else
+   struct iovec iov[2];
+   int iovcnt = 0;
+   int first = 0;
+
+   if (sink->bufUsed > 0) {
+      iov[iovcnt].iov_base = sink->buf;
+      iov[iovcnt].iov_len = sink->bufUsed;
+      iovcnt++;
+   }
+   if (extraLen > 0) {
+      iov[iovcnt].iov_base = (void *) extra;
+      iov[iovcnt].iov_len = extraLen;
+      iovcnt++;
+   }
+
+   while (first < iovcnt) {
+      ssize_t n = writev(sink->fd, iov + first, iovcnt - first);
+
+      if (n < 0) {
+         if (EINTR == errno) {
+            continue;
+         }
+         Log("BasicHTTP: Failed to write to file sink: %d.\n", errno);
+         return FALSE;
+      }
+      sink->written += n;
+      while (first < iovcnt && (size_t) n >= iov[first].iov_len) {
+         n -= iov[first].iov_len;
+         first++;
+      }
+      if (first < iovcnt) {
+         iov[first].iov_base = (uint8 *) iov[first].iov_base + n;
+         iov[first].iov_len -= n;
+      }
+   }
+#endif
+
+   sink->bufUsed = 0;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpFileSinkWrite --
+ *       Stage data for a file sink, writing it out once the staging
+ *       buffer would overflow.
+ *
+ * Results:
+ *       size on success, -1 on failure.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ssize_t
+BasicHttpFileSinkWrite(void *privat,                    // IN
+                       const void *buffer,              // IN
+                       size_t size)                     // IN
+{
+   BasicHttpFileSink *sink = (BasicHttpFileSink *) privat;
+
+   if (sink->failed) {
+      return -1;
+   }
+
+   if (sink->bufUsed + size <= BASIC_HTTP_FILE_SINK_BUFSIZE) {
+      memcpy(sink->buf + sink->bufUsed, buffer, size);
+      sink->bufUsed += size;
+   } else if (!BasicHttpFileSinkFlush(sink, buffer, size)) {
+      sink->failed = TRUE;
+      return -1;
+   }
+
+   return size;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpFileSinkSizeHint --
+ *       Reserve disk space for a known Content-Length, so the file is
+ *       laid out contiguously and running out of space fails early.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       File may grow to its expected size.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BasicHttpFileSinkSizeHint(void *privat,                 // IN
+                          int64 expectedLength)         // IN
+{
+#ifdef __linux__
+   BasicHttpFileSink *sink = (BasicHttpFileSink *) privat;
+   int err;
+
+   if (sink->start < 0 || expectedLength <= 0) {
+      return;
+   }
+
+   err = posix_fallocate(sink->fd, (off_t) sink->start, (off_t) expectedLength);
+   if (0 == err) {
+      sink->reserved = expectedLength;
+   } else if (ENOSPC == err) {
+      Log("BasicHTTP: Not enough space for %"FMT64"d byte response.\n",
+          expectedLength);
+      sink->failed = TRUE;
+   }
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpFileSinkFinish --
+ *       Write out any staged data.
+ *
+ * Results:
+ *       TRUE if everything received made it to the file.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+BasicHttpFileSinkFinish(void *privat)                   // IN
+{
+   BasicHttpFileSink *sink = (BasicHttpFileSink *) privat;
+
+   if (!sink->failed && !BasicHttpFileSinkFlush(sink, NULL, 0)) {
+      sink->failed = TRUE;
+   }
+   return !sink->failed;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpFileSinkDestruct --
+ *       Free a BasicHttpFileSink, dropping any preallocated space that
+ *       was not written to.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       fd may be truncated and closed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BasicHttpFileSinkDestruct(void *privat)                 // IN
+{
+   BasicHttpFileSink *sink = (BasicHttpFileSink *) privat;
+
+#ifndef _WIN32
+   if (sink->reserved > sink->written &&
+       ftruncate(sink->fd, (off_t) (sink->start + sink->written)) != 0) {
+      Log("BasicHTTP: Failed to truncate file sink: %d.\n", errno);
+   }
+#endif
+   if (sink->closeFd) {
+      close(sink->fd);
+   }
+   free(sink->buf);
+   free(sink);
+}
+
+
+static const BasicHttpSinkOps BasicHttpFileSinkOps = {
+   BasicHttpFileSinkWrite,
+   BasicHttpFileSinkSizeHint,
+   BasicHttpFileSinkFinish,
+   BasicHttpFileSinkDestruct
+};
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_AllocFileSink --
+ *       Create a sink that writes the response to fd, starting at its
+ *       current position.  If closeFd is set, the sink closes fd when
+ *       freed.
+ *
+ * Results:
+ *       A pointer to a file sink. Caller must call BasicHttp_FreeSink.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+BasicHttpSink *
+BasicHttp_AllocFileSink(int fd,                         // IN
+                        Bool closeFd)                   // IN
+{
+   BasicHttpFileSink *sink = Util_SafeCalloc(1, sizeof(*sink));
+
+   ASSERT(fd >= 0);
+   sink->fd = fd;
+   sink->closeFd = closeFd;
+   sink->buf = Util_SafeMalloc(BASIC_HTTP_FILE_SINK_BUFSIZE);
+   sink->start = (int64) lseek(fd, 0, SEEK_CUR);
+
+   return BasicHttp_AllocSink(&BasicHttpFileSinkOps, sink);
+}
+
+
+/* BasicHttpCallbackSink implementation. */
+typedef struct BasicHttpCallbackSink {
+   BasicHttpSinkDataProc *dataProc;
+   void *clientData;
+} BasicHttpCallbackSink;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttpCallbackSinkWrite --
+ *       Hand data to the callback sink's owner.
+ *
+ * Results:
+ *       size on success, -1 on failure.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ssize_t
+BasicHttpCallbackSinkWrite(void *privat,                // IN
+                           const void *buffer,          // IN
+                           size_t size)                 // IN
+{
+   BasicHttpCallbackSink *sink = (BasicHttpCallbackSink *) privat;
+
+   return sink->dataProc(sink->clientData, buffer, size) ? (ssize_t) size : -1;
+}
+
+
+static const BasicHttpSinkOps BasicHttpCallbackSinkOps = {
+   BasicHttpCallbackSinkWrite,
+   NULL,
+   NULL,
+   free
+};
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BasicHttp_AllocCallbackSink --
+ *       Create a sink that passes each piece of the response to dataProc.
+ *       Returning FALSE from dataProc aborts the transfer.
+ *
+ * Results:
+ *       A pointer to a callback sink. Caller must call BasicHttp_FreeSink.
+ *
+ * Side effects:
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+BasicHttpSink *
+BasicHttp_AllocCallbackSink(BasicHttpSinkDataProc *dataProc,    // IN
+                            void *clientData)                   // IN
+{
+   BasicHttpCallbackSink *sink = Util_SafeCalloc(1, sizeof(*sink));
+
+   ASSERT(dataProc);
+   sink->dataProc = dataProc;
+   sink->clientData = clientData;
+
+   return BasicHttp_AllocSink(&BasicHttpCallbackSinkOps, sink);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -3078,6 +3986,7 @@ BasicHttp_FreeResponse(BasicHttpResponse *response)         // IN
 
    free(response->content);
    free(response->effectiveURL);
+   free(response->primaryIP);
    free(response);
 } // BasicHttp_FreeResponse
 
@@ -149,6 +149,7 @@ struct BasicHttpResponse {
    BasicHttpResponseCode   responseCode;
    char                    *content;
    char                    *effectiveURL;
+   char                    *primaryIP;     // Numeric address of the server
 };
 
 typedef VMwareStatus PollCallbackProc(PollClassSet classSet, int flags,
@@ -182,6 +183,23 @@ void BasicHttp_NewCookieSession(BasicHttpCookieJar *cookieJar);
 
 void BasicHttp_FreeCookieJar(BasicHttpCookieJar *cookieJar);
 
+/*
+ * A cookie jar is also the connection pool for the requests that use it:
+ * DNS lookups and TLS sessions are shared between them, and survive
+ * BasicHttp_Shutdown()/BasicHttp_Init().
+ */
+typedef struct BasicHttpConnectionStats {
+   uint64      requests;            // Completed requests
+   uint64      connections;         // New connections they had to open
+   uint64      reusedConnections;   // Requests sent on a kept-alive connection
+   uint64      sslSessionFlushes;   // Calls to BasicHttp_ForgetSslSessions
+} BasicHttpConnectionStats;
+
+void BasicHttp_GetConnectionStats(BasicHttpCookieJar *cookieJar,
+                                  BasicHttpConnectionStats *stats);
+
+void BasicHttp_ForgetSslSessions(BasicHttpCookieJar *cookieJar);
+
 typedef void BasicHttpFreeProc(void *buf);
 
 /* Returns -1 for error, which signals an abort. */
@@ -219,6 +237,55 @@ BasicHttpSource *BasicHttp_AllocMemorySource(uint8 *data,
 
 BasicHttpSource *BasicHttp_AllocStringSource(const char *data);
 
+/*
+ * A sink is the receiving mirror of a source: when one is set on a
+ * request, the response body is handed to it as it arrives, instead of
+ * being accumulated in response->content.
+ */
+
+/* Returns the number of bytes consumed; anything short aborts. */
+typedef ssize_t BasicHttpWriteProc(void *privat,
+                                   const void *buffer,
+                                   size_t size);
+
+/* Called once, before the first write, if Content-Length is known. */
+typedef void BasicHttpSizeHintProc(void *privat,
+                                   int64 expectedLength);
+
+/* Called when the transfer completes successfully; FALSE fails it. */
+typedef Bool BasicHttpFinishProc(void *privat);
+
+typedef struct BasicHttpSinkOps BasicHttpSinkOps;
+typedef struct BasicHttpSink BasicHttpSink;
+
+struct BasicHttpSinkOps {
+   BasicHttpWriteProc *writeProc;
+   BasicHttpSizeHintProc *sizeHintProc;   // OPT
+   BasicHttpFinishProc *finishProc;       // OPT
+
+   BasicHttpDestructProc *destructProc;   // OPT
+};
+
+typedef Bool BasicHttpSinkDataProc(void *clientData,
+                                   const void *buffer,
+                                   size_t size);
+
+BasicHttpSink *BasicHttp_AllocSink(const BasicHttpSinkOps *ops,
+                                   void *privat);
+
+void BasicHttp_FreeSink(BasicHttpSink *sink);
+
+BasicHttpSink *BasicHttp_AllocMemorySink(size_t maxSize);
+
+const void *BasicHttp_GetMemorySinkData(BasicHttpSink *sink,
+                                        size_t *size);
+
+BasicHttpSink *BasicHttp_AllocFileSink(int fd,
+                                       Bool closeFd);
+
+BasicHttpSink *BasicHttp_AllocCallbackSink(BasicHttpSinkDataProc *dataProc,
+                                           void *clientData);
+
 BasicHttpRequest *BasicHttp_CreateRequest(const char *url,
                                           BasicHttpMethod httpMethod,
                                           BasicHttpCookieJar *cookieJar,
@@ -264,6 +331,9 @@ void BasicHttp_SetProxy(BasicHttpRequest *request,
 void BasicHttp_SetConnectTimeout(BasicHttpRequest *request,
                                  unsigned long seconds);
 
+void BasicHttp_SetSink(BasicHttpRequest *request,
+                       BasicHttpSink *sink);
+
 Bool BasicHttp_SendRequest(BasicHttpRequest *request,
                            BasicHttpOnSentProc *onSentProc,
                            void *clientData);
@@ -293,6 +363,8 @@ Bool BasicHttp_SendRequestEx(BasicHttpRequest *request,
                              BasicHttpOnSentProc *onSentProc,
                              void *clientData);
 
+Bool BasicHttp_HasProgressCallbacks(void);
+
 Bool BasicHttp_PauseRecvRequest(BasicHttpRequest *request,
                                 Bool pause);
 
@@ -332,6 +404,13 @@ void BasicHttp_ChangeBandwidthGroup(BasicHttpBandwidthGroup *group,
                                     uint64 uploadLimit,
                                     uint64 downloadLimit);
 
+void BasicHttp_SetBandwidthGroupBurst(BasicHttpBandwidthGroup *group,
+                                      uint64 uploadBurst,
+                                      uint64 downloadBurst);  // Bytes
+
+void BasicHttp_SetRequestBandwidthWeight(BasicHttpRequest *request,
+                                         uint32 weight);
+
 void BasicHttp_DeleteBandwidthGroup(BasicHttpBandwidthGroup *group);
 
 
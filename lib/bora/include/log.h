@@ -56,6 +56,7 @@ EXTERN Bool Log_Enabled(void);
 EXTERN const char *Log_GetFileName(void);
 
 EXTERN void Log_Flush(void);
+EXTERN uint32 Log_GetFlushInterval(void);
 EXTERN void Log_SetAlwaysKeep(Bool alwaysKeep);
 EXTERN Bool Log_RemoveFile(Bool alwaysRemove);
 EXTERN void Log_DisableThrottling(void);
@@ -107,6 +108,17 @@ EXTERN void GuestLog_Log(const char *fmt, ...) PRINTF_DECL(1, 2);
 
 #define LOG_DEFAULT_THROTTLE_THRESHOLD 1000000
 
+/*
+ * Log lines are batched in memory.  They are written out by the next line
+ * logged after this many milliseconds ("log.flushInterval"), by Log_Flush
+ * (which the application should also call every Log_GetFlushInterval()
+ * milliseconds so that nothing sits in memory while it is idle), and on
+ * Warning, Panic, fatal signals and exit.  0 writes every line straight
+ * through.
+ */
+
+#define LOG_DEFAULT_FLUSH_INTERVAL     1000
+
 
 /*
  * Debugging
@@ -108,6 +108,23 @@ typedef struct LogState {
    uint64 logSize;
    uint64 rotateSize;
    Bool rotating;
+
+   /*
+    * Lines not yet written to fd; see LogBufferAppend.
+    * flushInterval is in milliseconds, 0 to write through.
+    */
+
+   char *buf;
+   size_t bufLen;
+   uint32 flushInterval;
+   VmTimeType lastFlush;
+
+   /*
+    * Running average length of the messages written, charged for each
+    * message that LogWillDrop discards without formatting.
+    */
+
+   uint32 avgMsgLen;
 } LogState;
 
 extern LogState logState;
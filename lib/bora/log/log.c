@@ -89,6 +89,8 @@
 #define LOG_THROTTLE_PERIOD     (5 * 1000 * 1000)
 #define LOG_UNTHROTTLE_PERIOD   (60 * 1000 * 1000)
 
+#define LOG_BUFFER_SIZE         (16 * 1024)
+
 
 /*
  * Module state
@@ -121,6 +123,8 @@ static int LogOpenNoSymlinkAttack(const char *fileName);
 static void LogBackupOldLogs(const char *fileName, int n, Bool noRename);
 static void LogWriteTagString(LogState *log);
 static Bool LogRotateFile(LogState *log);
+static void LogFlushBuffer(LogState *log);
+static void LogAtExit(void);
 
 /*
  * Compatibility
@@ -330,6 +334,20 @@ LogInitEx(LogState    *log,                 // IN: ptr to log state
 
    log->lockMutexInited = TRUE;
 
+   /*
+    * Make sure batched lines reach the file however the process exits
+    * normally; Log_Exit is not always called.
+    */
+
+   {
+      static Bool atExitRegistered = FALSE;
+
+      if (!atExitRegistered) {
+         atexit(LogAtExit);
+         atExitRegistered = TRUE;
+      }
+   }
+
    /*
     * Open log file
     *
@@ -379,6 +397,18 @@ Log_Exit(void)
 void
 LogExit(LogState *log)
 {
+   /*
+    * Anything logged from here on is written straight through, since
+    * nothing is left to flush it.
+    */
+
+   LogLock(log, TRUE);
+   LogFlushBuffer(log);
+   log->flushInterval = 0;
+   free(log->buf);
+   log->buf = NULL;
+   LogLock(log, FALSE);
+
    log->initialized = FALSE;
 
    /*
@@ -469,6 +499,11 @@ LogUpdateState(LogState *log,          // IN
    log->timeStamp = Config_GetBool(TRUE, "log.timeStamp");
    log->millisec = Config_GetBool(TRUE, "log.millisec");
    log->threadName = Config_GetBool(TRUE, "log.threadName");
+   log->flushInterval = Config_GetLong(LOG_DEFAULT_FLUSH_INTERVAL,
+                                       "log.flushInterval");
+   if (log->flushInterval == 0) {
+      LogFlushBuffer(log);
+   }
    log->rotateSize = rotateSize;
    log->fastRotation = fastRotation;
 
@@ -718,6 +753,9 @@ LogRotateFile(LogState *log)
    if (log->rotating) {
       return TRUE;
    }
+
+   /* What is batched belongs at the end of the current file */
+   LogFlushBuffer(log);
    log->rotating = TRUE;
 
    /* you cant rotate out if you dont have a current log */
@@ -863,6 +901,8 @@ LogSwitchFile(LogState *log,        // IN: log state
 
    LOGWARN(("LOG %s using %s\n", VThread_CurName(), fileName));
 
+   LogFlushBuffer(log);
+
    /*
     * Keep backup copies of the log as required.
     */
@@ -1436,7 +1476,7 @@ LogCopyFile(LogState *log, int destFd, int srcFd, const char *fileName)
 
    LOGWARN(("LOG copying %s -> %s\n", log->fileName, fileName));
 
-   Log_Flush();
+   LogFlushBuffer(log);
 
    /*
     * Truncate the destination file.
@@ -1571,6 +1611,91 @@ LogIsThrottled(LogThrottleInfo *info, const char **msg)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * LogThrottleHeld --
+ *
+ *      Is logging throttled, with no chance of that changing before
+ *      the next sample?  While this holds, LogIsThrottled would drop
+ *      any message without looking at more than its length.
+ *
+ * Results:
+ *      TRUE if messages are being dropped.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static INLINE Bool
+LogThrottleHeld(const LogThrottleInfo *info, // IN
+                VmTimeType curTime)          // IN
+{
+   return info->throttleBPS != 0 && info->throttled &&
+          curTime >= info->lastSampleTime &&
+          curTime - info->lastSampleTime <= LOG_UNTHROTTLE_PERIOD;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LogWillDrop --
+ *
+ *      Decide, before formatting a message, whether LogWriteLogFile
+ *      would throw it away, so that the formatting can be skipped.
+ *
+ *      A message dropped by throttling is charged to the byte counts
+ *      at the average length of the messages logged before, since its
+ *      real length is not known without formatting it.  The flood that
+ *      caused the throttling keeps it in place that way, as it would if
+ *      every message were formatted.
+ *
+ * Results:
+ *      TRUE if the message would not be written.
+ *
+ * Side effects:
+ *      Throttling byte counts may be updated.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+LogWillDrop(LogState *log,      // IN
+            Bool isGuestLog)    // IN
+{
+   Bool drop = FALSE;
+
+   LogLock(log, TRUE);
+
+   if (!log->enable || log->fd < 0) {
+      drop = TRUE;
+   } else if (log->throttleInfo.throttled ||
+              (isGuestLog && guestLogThrottleInfo.throttled)) {
+      VmTimeType curTime;
+
+      Hostinfo_GetTimeOfDay(&curTime);
+      if ((isGuestLog && LogThrottleHeld(&guestLogThrottleInfo, curTime)) ||
+          LogThrottleHeld(&log->throttleInfo, curTime)) {
+         size_t len = log->avgMsgLen;
+
+         if (isGuestLog && guestLogThrottleInfo.throttleBPS != 0) {
+            guestLogThrottleInfo.bytesLogged += len;
+         }
+         if (log->throttleInfo.throttleBPS != 0) {
+            log->throttleInfo.bytesLogged += len;
+         }
+         drop = TRUE;
+      }
+   }
+
+   LogLock(log, FALSE);
+   return drop;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1616,6 +1741,94 @@ Log_SetQuietWarning(Bool quiet)
    logState.quietWarning = quiet;
 }
 
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * LogFlushBuffer --
+ *
+ *      Write out the batched log lines, if any.  Assumes locking is done
+ *      by caller.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Log file written.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+LogFlushBuffer(LogState *log) // IN
+{
+   size_t done = 0;
+
+   if (log->bufLen == 0) {
+      return;
+   }
+
+   while (log->fd >= 0 && done < log->bufLen) {
+      ssize_t n = write(log->fd, log->buf + done, log->bufLen - done);
+
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         break;
+      }
+      done += n;
+   }
+   log->bufLen = 0;
+   log->lastFlush = Hostinfo_SystemTimerUS();
+
+   FLUSH_LOGFD(log->fd);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * LogBufferAppend --
+ *
+ *      Add to the log file.  The data is batched in memory unless
+ *      batching is off; see LOG_DEFAULT_FLUSH_INTERVAL.  Assumes locking
+ *      is done by caller.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Log file may be written.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+LogBufferAppend(LogState *log,    // IN
+                const char *data, // IN
+                size_t len)       // IN
+{
+   if (log->flushInterval == 0 || len >= LOG_BUFFER_SIZE) {
+      LogFlushBuffer(log);
+      write(log->fd, data, len);
+      return;
+   }
+
+   if (log->bufLen + len > LOG_BUFFER_SIZE) {
+      LogFlushBuffer(log);
+   }
+   if (log->buf == NULL) {
+      log->buf = Util_SafeMalloc(LOG_BUFFER_SIZE);
+   }
+   if (log->bufLen == 0) {
+      log->lastFlush = Hostinfo_SystemTimerUS();
+   }
+   memcpy(log->buf + log->bufLen, data, len);
+   log->bufLen += len;
+}
+
+
 static void
 LogWriteLogFile(LogState *log, const char *msg, Bool isGuestLog)
 {
@@ -1631,6 +1844,20 @@ LogWriteLogFile(LogState *log, const char *msg, Bool isGuestLog)
       goto out;
    }
 
+   /*
+    * Keep the running average LogWillDrop charges dropped messages at.
+    */
+
+   {
+      uint32 len = strlen(msg);
+
+      if (log->avgMsgLen == 0) {
+         log->avgMsgLen = len;
+      } else {
+         log->avgMsgLen = (log->avgMsgLen * 7 + len) / 8;
+      }
+   }
+
    /*
     * Call both throttling functions if it's a guest log message, since we
     * want both states to be updated.
@@ -1674,35 +1901,23 @@ LogWriteLogFile(LogState *log, const char *msg, Bool isGuestLog)
 	 break;
       }
 
-#if defined(_WIN32)
       if (!log->notBOL && tagLen > 0) {
-	 write(log->fd, tag, tagLen);
+	 LogBufferAppend(log, tag, tagLen);
          log->logSize += tagLen;
       }
-      write(log->fd, msg, len);
+      LogBufferAppend(log, msg, len);
       log->logSize += len;
 
-#else
-      if (log->notBOL || tagLen <= 0) {
-	 write(log->fd, msg, len);
-         log->logSize += len;
-      } else {
-	 struct iovec iov[2];
-	 iov[0].iov_base = tag;
-	 iov[0].iov_len = tagLen;
-	 iov[1].iov_base = (void *) msg;
-	 iov[1].iov_len = len;
-	 writev(log->fd, iov, 2);
-         log->logSize += tagLen + len;
-      }
-#endif
-
-      FLUSH_LOGFD(log->fd);
-
       log->notBOL = msg[len - 1] != '\n';
       msg += len;
    }
 
+   if (log->bufLen > 0 &&
+       Hostinfo_SystemTimerUS() - log->lastFlush >=
+       (VmTimeType) log->flushInterval * 1000) {
+      LogFlushBuffer(log);
+   }
+
    if (log->rotateSize && log->logSize > log->rotateSize) {
       LogRotateFile(log);
    }
@@ -1803,9 +2018,57 @@ LogMakeTimeString(Bool millisec, char *buf, size_t max)
 void
 Log_Flush(void)
 {
-   /*
-    * Nothing, intended for logging through stdio.
-    */
+   LogState *log = &logState;
+
+   LogLock(log, TRUE);
+   LogFlushBuffer(log);
+   LogLock(log, FALSE);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Log_GetFlushInterval --
+ *
+ *      Get how often batched log lines should be written out.
+ *
+ * Results:
+ *      The interval in milliseconds, or 0 if lines are not batched.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+uint32
+Log_GetFlushInterval(void)
+{
+   return logState.flushInterval;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LogAtExit --
+ *
+ *      atexit handler: write out what is still batched.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Flush.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+LogAtExit(void)
+{
+   Log_Flush();
 }
 
 
@@ -1875,6 +2138,7 @@ Log_RemoveFile(Bool alwaysRemove)
 
    ASSERT(log->fileName != NULL);
    Log("LOG removing %s.\n", log->fileName);
+   LogFlushBuffer(log);
    if (log->fd >= 0) {
       close(log->fd);
       log->fd = -1;
@@ -1950,14 +2214,17 @@ LogWork(LogState *log, Bool isGuestLog, const char *fmt, va_list args)
       return;
    }
 
-   if (!log->enable) {
+   /*
+    * Don't pay for formatting a message that will only be thrown away.
+    */
+
+   if (!log->enable || LogWillDrop(log, isGuestLog)) {
       return;
    }
 
    Str_Vsnprintf(buf, sizeof (buf), fmt, args);
 
    LogWriteLogFile(log, buf, isGuestLog);
-   Log_Flush();
 }
 
 
@@ -102,6 +102,8 @@ typedef struct PollEntry {
    PollerFunction f;
    void *clientData;
    VmTimeType time;		// valid for POLL_REALTIME
+   int timerIndex;		// slot in poll->timers, valid for POLL_REALTIME
+   struct PollEntry *timerHashNext; // chain in poll->timerHash
 
    union {
       uint32 delay;	 // The interval length between periodic callbacks
@@ -174,6 +176,22 @@ typedef struct Poll {
    PollEntry *queue[POLL_NUM_QUEUES];
    PollEntry *free;
 
+   /*
+    * POLL_REALTIME entries are not kept on queue[POLL_REALTIME] but in
+    * a binary min-heap ordered by time, so that adding and removing a
+    * timer is O(log n) however many are pending.
+    */
+   PollEntry **timers;
+   int numTimers;
+   int timersSize;
+
+   /*
+    * Pending timers are also hashed on (f, clientData, classSet, flags)
+    * so that removing one by key finds its heap slot without a scan.
+    * There are always timersSize buckets, a power of two.
+    */
+   PollEntry **timerHash;
+
    struct ClassEvents {
       int numEvents;
       ClassEventInfo info[MAX_QUEUE_LENGTH];  
@@ -187,6 +205,7 @@ static void PollDefaultReset(void);
 static Bool PollExecuteQueue(PollEventType typeQueue, PollClass class);
 static void PollEntryFree(PollEntry *e, Poll *poll);
 static void PollEntryDequeue(PollEventType type, PollEntry **ep);
+static void PollTimerRemove(Poll *poll, PollEntry *e);
 static Bool PollFireQueue(PollEventType type, PollEntry **queue, int n);
 static Bool PollFireAndDequeue(Poll *poll, PollEventType type,
                                PollEntry *e, PollEntry **ep);
@@ -393,6 +412,17 @@ PollDefaultReset(void)
       poll->queue[i] = NULL;
    }
 
+   for (i = 0; i < poll->numTimers; i++) {
+      ASSERT(poll->timers[i]->count > 0);
+      free(poll->timers[i]);
+   }
+   free(poll->timers);
+   poll->timers = NULL;
+   free(poll->timerHash);
+   poll->timerHash = NULL;
+   poll->numTimers = 0;
+   poll->timersSize = 0;
+
    for (pe = poll->free; pe != NULL; pe = next) {
       next = pe->next;
       ASSERT(pe->count == 0);
@@ -482,36 +512,242 @@ PollDefaultLoopTimeout(Bool loop,          // IN: loop forever if TRUE, else do
 #undef CHECK_EXIT
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollTimerSet --
+ *
+ *      Put a timer in a slot of the heap.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static INLINE void
+PollTimerSet(Poll *poll,    // IN
+             int i,         // IN
+             PollEntry *e)  // IN
+{
+   poll->timers[i] = e;
+   e->timerIndex = i;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollTimerSiftUp --
+ *
+ *      Move the timer in slot i towards the root until its parent is
+ *      not later than it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollTimerSiftUp(Poll *poll, // IN
+                int i)      // IN
+{
+   PollEntry *e = poll->timers[i];
+
+   while (i > 0) {
+      int parent = (i - 1) / 2;
+
+      if (poll->timers[parent]->time <= e->time) {
+         break;
+      }
+      PollTimerSet(poll, i, poll->timers[parent]);
+      i = parent;
+   }
+   PollTimerSet(poll, i, e);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollTimerSiftDown --
+ *
+ *      Move the timer in slot i away from the root until neither child
+ *      is earlier than it.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollTimerSiftDown(Poll *poll, // IN
+                  int i)      // IN
+{
+   PollEntry *e = poll->timers[i];
+
+   for (;;) {
+      int child = 2 * i + 1;
+
+      if (child >= poll->numTimers) {
+         break;
+      }
+      if (child + 1 < poll->numTimers &&
+          poll->timers[child + 1]->time < poll->timers[child]->time) {
+         child++;
+      }
+      if (e->time <= poll->timers[child]->time) {
+         break;
+      }
+      PollTimerSet(poll, i, poll->timers[child]);
+      i = child;
+   }
+   PollTimerSet(poll, i, e);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollTimerBucket --
+ *
+ *      Find the timerHash bucket for a callback key.
+ *
+ * Results:
+ *      Pointer to the head of the bucket's chain.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static INLINE PollEntry **
+PollTimerBucket(Poll *poll,             // IN
+                PollClassSet classSet,  // IN
+                int flags,              // IN
+                PollerFunction f,       // IN
+                void *clientData)       // IN
+{
+   uintptr_t hash;
+
+   ASSERT(poll->timersSize > 0);
+
+   hash = (uintptr_t)f;
+   hash = hash * 31 + (uintptr_t)clientData;
+   hash = hash * 31 + classSet;
+   hash = hash * 31 + flags;
+   hash ^= hash >> 16;
+   return &poll->timerHash[hash & (poll->timersSize - 1)];
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollTimerHashAdd --
+ *
+ *      Put a timer on its timerHash chain.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static INLINE void
+PollTimerHashAdd(Poll *poll,    // IN
+                 PollEntry *e)  // IN
+{
+   PollEntry **bucket = PollTimerBucket(poll, e->classSet, e->flags,
+                                        e->f, e->clientData);
+
+   e->timerHashNext = *bucket;
+   *bucket = e;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollTimerGrow --
+ *
+ *      Double the room in the timer heap and rehash every pending
+ *      timer into the larger bucket array.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollTimerGrow(Poll *poll)       // IN
+{
+   int i;
+
+   poll->timersSize = MAX(2 * poll->timersSize, 64);
+   poll->timers = Util_SafeRealloc(poll->timers,
+                                   poll->timersSize * sizeof *poll->timers);
+   free(poll->timerHash);
+   poll->timerHash = Util_SafeCalloc(poll->timersSize,
+                                     sizeof *poll->timerHash);
+   for (i = 0; i < poll->numTimers; i++) {
+      PollTimerHashAdd(poll, poll->timers[i]);
+   }
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
  * PollInsert --
  *
- *      inserted into ordered queue of events.
+ *      Add an entry to the timer heap, ordered by e->time.
  *
  *----------------------------------------------------------------------
  */
 
 static void
-PollInsert(PollEntry **queue,   // IN-OUT
-           PollEntry *e)        // IN
+PollInsert(Poll *poll,      // IN
+           PollEntry *e)    // IN
 {
    ASSERT(e->count > 0);
    ASSERT(!e->onQueue);
    e->onQueue = TRUE;
 
-   if (*queue && (*queue)->time < e->time) {
-      PollEntry *tmp = *queue;
-      while (tmp->next && tmp->next->time < e->time) {
-         tmp = tmp->next;
+   if (poll->numTimers == poll->timersSize) {
+      PollTimerGrow(poll);
+   }
+   PollTimerHashAdd(poll, e);
+   PollTimerSet(poll, poll->numTimers++, e);
+   PollTimerSiftUp(poll, e->timerIndex);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollTimerRemove --
+ *
+ *      Take an entry off the timer heap.  The caller owns the
+ *      reference the heap held.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollTimerRemove(Poll *poll,     // IN
+                PollEntry *e)   // IN
+{
+   int i = e->timerIndex;
+   PollEntry *last;
+   PollEntry **ep;
+
+   ASSERT(e->onQueue);
+   ASSERT(i >= 0 && i < poll->numTimers && poll->timers[i] == e);
+   e->onQueue = FALSE;
+
+   ep = PollTimerBucket(poll, e->classSet, e->flags, e->f, e->clientData);
+   while (*ep != e) {
+      ASSERT(*ep != NULL);
+      ep = &(*ep)->timerHashNext;
+   }
+   *ep = e->timerHashNext;
+   e->timerHashNext = NULL;
+
+   last = poll->timers[--poll->numTimers];
+   if (last != e) {
+      PollTimerSet(poll, i, last);
+      if (i > 0 && poll->timers[(i - 1) / 2]->time > last->time) {
+         PollTimerSiftUp(poll, i);
+      } else {
+         PollTimerSiftDown(poll, i);
       }
-      ASSERT(e != tmp->next);
-      e->next = tmp->next;
-      tmp->next = e;
-   } else {
-      ASSERT(e != *queue);
-      e->next = *queue;
-      *queue = e;
    }
 }
 
@@ -564,6 +800,29 @@ PollGetNextTime(PollEventType type,	// IN: Head of which queue
    PollClassSet classSet = 1 << class;
 
    ASSERT(type == POLL_REALTIME || type == POLL_VTIME);
+
+   if (type == POLL_REALTIME) {
+      VmTimeType next = 0;
+      int i;
+
+      if (poll->numTimers > 0 && (poll->timers[0]->classSet & classSet)) {
+         return poll->timers[0]->time;
+      }
+
+      /*
+       * Timers are only allowed in POLL_CS_MAIN today, so for any other
+       * class this finds nothing.
+       */
+      for (i = 0; i < poll->numTimers; i++) {
+         PollEntry *e = poll->timers[i];
+
+         if ((e->classSet & classSet) && (next == 0 || e->time < next)) {
+            next = e->time;
+         }
+      }
+      return next;
+   }
+
    queue = poll->queue[type];
 
    while (queue) {
@@ -614,6 +873,20 @@ PollDefaultCallbackRemove(PollClassSet classSet,
       if ((flags & (POLL_FLAG_READ|POLL_FLAG_WRITE)) == 0) {
 	 flags |= POLL_FLAG_READ;
       }
+   } else if (type == POLL_REALTIME) {
+      if (poll->numTimers == 0) {
+         return FALSE;
+      }
+      for (e = *PollTimerBucket(poll, classSet, flags, f, clientData);
+           e != NULL; e = e->timerHashNext) {
+         if (e->f == f && e->clientData == clientData &&
+             e->classSet == classSet && e->flags == flags) {
+            PollTimerRemove(poll, e);
+            PollEntryDecrement(poll, &e);
+            return TRUE;
+         }
+      }
+      return FALSE;
    }
 
    for (ep = &poll->queue[type]; (e = *ep) != NULL; ep = &e->next) {
@@ -1090,8 +1363,8 @@ PollDefaultCallback(PollClassSet classSet,
    }
 
    if (typeQueue == POLL_REALTIME) {
-      /* The queue is ordered, insert in the right place */
-      PollInsert(&poll->queue[typeQueue], e);
+      /* Timers go on the heap */
+      PollInsert(poll, e);
    } else {
       /* The other queues are unordered, so just insert in front */
       e->next = poll->queue[typeQueue];
@@ -1160,8 +1433,8 @@ PollExecuteQueue(PollEventType typeQueue,
  *
  * PollFireRealtimeCallback --
  *
- *	Dequeue and fire a specified entry on the real time queue.
- *      A periodic entry is re-inserted into the queue.
+ *	Dequeue and fire a specified entry on the timer heap.
+ *      A periodic entry is re-inserted into the heap.
  *
  * Result:
  *      TRUE if a callback was fired, else FALSE.
@@ -1176,7 +1449,6 @@ PollExecuteQueue(PollEventType typeQueue,
 static INLINE Bool
 PollFireRealtimeCallback(Poll *poll,            // IN: Poll struct
                          PollEntry *e,          // IN: entry to fire
-               	         PollEntry *previous,   // IN: previous entry in queue
 			 VmTimeType realTime)   // IN: current real time
 {
    Bool fired = FALSE;
@@ -1185,20 +1457,14 @@ PollFireRealtimeCallback(Poll *poll,            // IN: Poll struct
    ASSERT(e->onQueue);
 
    /* First, dequeue the entry */
-   e->onQueue = FALSE;
-   if (previous) {
-      previous->next = e->next;
-   } else {
-      ASSERT(e == poll->queue[POLL_REALTIME]);
-      poll->queue[POLL_REALTIME] = e->next;
-   }
+   PollTimerRemove(poll, e);
 
    if ((e->flags & POLL_FLAG_PERIODIC) != 0) {
        fired = TRUE;
        ASSERT(e->info.delay > 0);
        e->time = realTime + e->info.delay;
 
-       PollInsert(&poll->queue[POLL_REALTIME], e);
+       PollInsert(poll, e);
        e->count++;
        PollFire(e);
        if (--e->count <= 0) {
@@ -1219,6 +1485,52 @@ PollFireRealtimeCallback(Poll *poll,            // IN: Poll struct
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollTimerFindDue --
+ *
+ *	Find the earliest timer in the subheap rooted at slot i that may
+ *	fire now: one that is due, or a periodic one due within
+ *	POLL_TIME_SLOP.  Subheaps whose root is past the slop window, or
+ *	not earlier than the best match so far, are skipped, so this only
+ *	visits timers inside the window.
+ *
+ * Result:
+ *      The earliest eligible timer, or best if there is none earlier.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static PollEntry *
+PollTimerFindDue(Poll *poll,                // IN
+                 int i,                     // IN: subheap root
+                 VmTimeRealClock realTime,  // IN
+                 PollClassSet classSet,     // IN
+                 PollEntry *best)           // IN: best match so far or NULL
+{
+   PollEntry *e;
+
+   if (i >= poll->numTimers) {
+      return best;
+   }
+   e = poll->timers[i];
+   if (e->time > realTime + POLL_TIME_SLOP ||
+       (best != NULL && e->time >= best->time)) {
+      return best;
+   }
+   if ((e->time <= realTime || (e->flags & POLL_FLAG_PERIODIC) != 0) &&
+       (e->classSet & classSet)) {
+      return e; // nothing below is earlier
+   }
+   best = PollTimerFindDue(poll, 2 * i + 1, realTime, classSet, best);
+   return PollTimerFindDue(poll, 2 * i + 2, realTime, classSet, best);
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1261,30 +1573,18 @@ PollExecuteTimeQueues(VmTimeRealClock realTime,
     * This code is tricky in that it can be recursively invoked by the callback,
     * i.e., the queue can change as a side effect of firing.
     *
-    * To handle this, two nested loops are used. The inner searches the time
-    * queue for the first eligible callback. If found, the callback is fired,
-    * we break out of the inner loop, and let the outer loop initiate a new
-    * search beginning from the head.
-    * If none is found, the outer loop terminates.
+    * To handle this, each pass searches the timer heap afresh for the
+    * earliest eligible callback and fires it.  Timers sharing the slop
+    * window are thus coalesced into one wakeup, in time order.
+    * If none is found, the loop terminates.
     */
 
    do {
-      PollEntry *e        = poll->queue[POLL_REALTIME]; 
-      PollEntry *previous = NULL;
-      found               = FALSE;
-
-      while (e != NULL && e->time <= realTime + POLL_TIME_SLOP) {
-         if ((e->time <= realTime || (e->flags & POLL_FLAG_PERIODIC) != 0) &&
-	     (e->classSet & classSet)) {
-            found = TRUE;
-            if (PollFireRealtimeCallback(poll, e, previous, realTime)) {
-               fired = TRUE;
-            }
-            break;
-         } else {
-	    previous = e;
-            e = e->next;
-         }
+      PollEntry *e = PollTimerFindDue(poll, 0, realTime, classSet, NULL);
+
+      found = e != NULL;
+      if (found && PollFireRealtimeCallback(poll, e, realTime)) {
+         fired = TRUE;
       }
    } while (found);
 
@@ -64,15 +64,19 @@ typedef struct PollGtkEntry {
 
    /* Handle of the registered GTK callback  */
    guint gtkInputId;
-#ifdef __MINGW32__
+
    /*
-    * Poll clients wanting to read from a monitored device must do
-    * so via the associated channel, as with files monitored via
-    * g_io_channel_win32_new_fd; so we cache the channel here
-    * incase it is needed.
+    * The channel a POLL_DEVICE callback is watching, kept so that a
+    * change of flags only has to replace the watch.
+    *
+    * On MinGW, poll clients wanting to read from a monitored device
+    * must do so via the associated channel, as with files monitored via
+    * g_io_channel_win32_new_fd, so it is also passed to them.
     */
    GIOChannel *channel;
-#endif
+
+   /* Next entry with the same key in callbackTable */
+   struct PollGtkEntry *next;
 } PollGtkEntry;
 
 
@@ -82,8 +86,13 @@ typedef struct PollGtkEntry {
 typedef struct Poll {
    GStaticRecMutex lock;
 
-   GHashTable *deviceTable;
-   GHashTable *timerTable;
+   /*
+    * Every registered callback, keyed by (classSet, f, clientData, type)
+    * so that finding one to remove or modify does not mean scanning
+    * them all.  The key and value are the first entry registered with
+    * that key; any others are chained from it.
+    */
+   GHashTable *callbackTable;
 } Poll;
 
 static Poll *pollState;
@@ -108,6 +117,207 @@ static gboolean PollGtkEventCallback(GIOChannel *source,
 static void PollGtkRemoveOneCallback(PollGtkEntry *eventEntry);
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollGtkEntryHash --
+ *
+ *      Hash function for callbackTable.
+ *
+ * Results:
+ *      A hash of the entry's key fields.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static guint
+PollGtkEntryHash(gconstpointer key) // IN
+{
+   const PollGtkEntry *entry = (const PollGtkEntry *)key;
+   guint hash;
+
+   hash = g_direct_hash((gconstpointer)entry->f);
+   hash = hash * 31 + g_direct_hash(entry->clientData);
+   hash = hash * 31 + entry->classSet;
+   hash = hash * 31 + entry->type;
+   return hash;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollGtkEntryEqual --
+ *
+ *      Key comparison for callbackTable.  Flags are not part of the
+ *      key, just as Poll_CallbackRemove does not need them to match.
+ *
+ * Results:
+ *      TRUE if both entries have the same key, FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static gboolean
+PollGtkEntryEqual(gconstpointer a, // IN
+                  gconstpointer b) // IN
+{
+   const PollGtkEntry *current = (const PollGtkEntry *)a;
+   const PollGtkEntry *search = (const PollGtkEntry *)b;
+
+   return current->classSet == search->classSet &&
+          current->f == search->f &&
+          current->clientData == search->clientData &&
+          current->type == search->type;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollGtkLookup --
+ *
+ *      Find a registered callback.  Called with the poll lock held.
+ *
+ * Results:
+ *      The first entry registered with this key, or NULL.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static PollGtkEntry *
+PollGtkLookup(Poll *poll,              // IN
+              PollClassSet classSet,   // IN
+              PollerFunction f,        // IN
+              void *clientData,        // IN
+              PollEventType type)      // IN
+{
+   PollGtkEntry searchEntry;
+
+   searchEntry.classSet = classSet;
+   searchEntry.f = f;
+   searchEntry.clientData = clientData;
+   searchEntry.type = type;
+
+   return g_hash_table_lookup(poll->callbackTable, &searchEntry);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollGtkLink --
+ *
+ *      Add an entry to callbackTable.  Called with the poll lock held.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollGtkLink(Poll *poll,             // IN
+            PollGtkEntry *entry)    // IN
+{
+   PollGtkEntry *head = g_hash_table_lookup(poll->callbackTable, entry);
+
+   if (head) {
+      entry->next = head->next;
+      head->next = entry;
+   } else {
+      entry->next = NULL;
+      g_hash_table_insert(poll->callbackTable, entry, entry);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollGtkUnlink --
+ *
+ *      Take an entry out of callbackTable.  Called with the poll lock
+ *      held.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollGtkUnlink(Poll *poll,             // IN
+              PollGtkEntry *entry)    // IN
+{
+   PollGtkEntry *head = g_hash_table_lookup(poll->callbackTable, entry);
+
+   ASSERT(head);
+   if (head == entry) {
+      if (entry->next) {
+         g_hash_table_replace(poll->callbackTable, entry->next, entry->next);
+      } else {
+         g_hash_table_remove(poll->callbackTable, entry);
+      }
+   } else {
+      while (head->next != entry) {
+         head = head->next;
+         ASSERT(head);
+      }
+      head->next = entry->next;
+   }
+   entry->next = NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollGtkFreeChain --
+ *
+ *      GHashTable iterator that removes every callback in a chain.
+ *
+ * Results:
+ *      TRUE, to drop the chain from the table.
+ *
+ * Side effects:
+ *      Callbacks removed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static gboolean
+PollGtkFreeChain(gpointer key,   // IN
+                 gpointer value, // IN
+                 gpointer data)  // IN
+{
+   PollGtkEntry *entry = (PollGtkEntry *)value;
+
+   while (entry) {
+      PollGtkEntry *next = entry->next;
+
+      PollGtkRemoveOneCallback(entry);
+      entry = next;
+   }
+   return TRUE;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -132,17 +342,9 @@ PollGtkInit(void)
 
    g_static_rec_mutex_init(&pollState->lock);
 
-   pollState->deviceTable = g_hash_table_new_full(g_direct_hash,
-                                                  g_direct_equal,
-                                                  NULL,
-                                                  (GDestroyNotify)PollGtkRemoveOneCallback);
-   ASSERT(pollState->deviceTable);
-
-   pollState->timerTable = g_hash_table_new_full(g_direct_hash,
-                                                 g_direct_equal,
-                                                 NULL,
-                                                 (GDestroyNotify)PollGtkRemoveOneCallback);
-   ASSERT(pollState->timerTable);
+   pollState->callbackTable = g_hash_table_new(PollGtkEntryHash,
+                                               PollGtkEntryEqual);
+   ASSERT(pollState->callbackTable);
 }
 
 
@@ -170,8 +372,8 @@ PollGtkExit(void)
    ASSERT(poll != NULL);
 
    g_static_rec_mutex_lock(&poll->lock);
-   g_hash_table_destroy(poll->deviceTable);
-   g_hash_table_destroy(poll->timerTable);
+   g_hash_table_foreach_remove(poll->callbackTable, PollGtkFreeChain, NULL);
+   g_hash_table_destroy(poll->callbackTable);
    g_static_rec_mutex_unlock(&poll->lock);
 
    g_static_rec_mutex_free(&poll->lock);
@@ -212,32 +414,71 @@ PollGtkLoopTimeout(Bool loop,          // IN: loop forever if TRUE, else do one
 /*
  *----------------------------------------------------------------------
  *
- * PollGtkFindPredicate --
+ * PollGtkAddWatch --
  *
- *      Predicate usable by GHashTable iteration functions to find
- *      or remove specific elements.
+ *      Start watching the device of a POLL_DEVICE entry for the
+ *      conditions its flags ask for.  The entry's channel is created
+ *      the first time and reused after that.
  *
  * Results:
- *      TRUE if the value matches our search criteria, FALSE otherwise.
+ *      None
  *
  * Side effects:
- *      None.
+ *      Sets eventEntry->gtkInputId.
  *
  *----------------------------------------------------------------------
  */
 
-static gboolean
-PollGtkFindPredicate(gpointer key,   // IN
-                     gpointer value, // IN
-                     gpointer data)  // IN
+static void
+PollGtkAddWatch(PollGtkEntry *eventEntry) // IN
 {
-   PollGtkEntry *current = (PollGtkEntry *)value;
-   PollGtkEntry *search = (PollGtkEntry *)data;
+   int flags = eventEntry->flags;
+   int conditionFlags = 0;
 
-   ASSERT(current->type == search->type);
-   return current->classSet == search->classSet &&
-          current->f == search->f &&
-          current->clientData == search->clientData;
+   ASSERT(eventEntry->type == POLL_DEVICE);
+
+   if (POLL_FLAG_READ & flags) {
+      conditionFlags |= G_IO_IN | G_IO_PRI;
+   }
+   if (POLL_FLAG_WRITE & flags) {
+      conditionFlags |= G_IO_OUT;
+   }
+   conditionFlags |= G_IO_ERR | G_IO_HUP | G_IO_NVAL;
+
+   /*
+    * When neither flag is passed, default to READ.
+    */
+   if ((flags & (POLL_FLAG_READ | POLL_FLAG_WRITE)) == 0) {
+      conditionFlags |= G_IO_IN | G_IO_PRI;
+   }
+
+   if (!eventEntry->channel) {
+      PollDevHandle info = eventEntry->event;
+
+#ifdef _WIN32
+      if (flags & POLL_FLAG_SOCKET) {
+         eventEntry->channel = g_io_channel_win32_new_socket(info);
+#ifdef __MINGW32__
+      } else if (flags & POLL_FLAG_FD) {
+         eventEntry->channel = g_io_channel_win32_new_fd(info);
+#endif
+      } else {
+         eventEntry->channel = g_io_channel_win32_new_messages(info);
+      }
+#else
+      eventEntry->channel = g_io_channel_unix_new(info);
+#endif
+   }
+
+   /*
+    * XXX Looking at the GTK/GLIB source code, it seems that a returned value
+    *     of 0 indicates failure (and I should check for it), but that is not
+    *     clear 
+    */
+   eventEntry->gtkInputId = g_io_add_watch(eventEntry->channel,
+                                           conditionFlags,
+                                           PollGtkEventCallback,
+                                           eventEntry);
 }
 
 
@@ -265,29 +506,18 @@ PollGtkCallbackRemove(PollClassSet classSet,   // IN
                       PollEventType type)      // IN
 {
    Poll *poll = pollState;
-   GHashTable *searchTable;
-   PollGtkEntry searchEntry;
    PollGtkEntry *foundEntry;
    gboolean modify = FALSE;
    int finalFlags = 0;
-   gint key;
 
    ASSERT(poll);
    ASSERT(type >= 0 && type < POLL_NUM_QUEUES);
 
-   searchEntry.classSet = classSet;
-   searchEntry.flags = flags;
-   searchEntry.f = f;
-   searchEntry.clientData = clientData;
-   searchEntry.type = type;
-
    switch (type) {
    case POLL_REALTIME:
    case POLL_MAIN_LOOP:
-      searchTable = poll->timerTable;
       break;
    case POLL_DEVICE:
-      searchTable = poll->deviceTable;
       /*
        * When neither flag is passed, default to READ.
        */
@@ -303,43 +533,33 @@ PollGtkCallbackRemove(PollClassSet classSet,   // IN
 
    g_static_rec_mutex_lock(&poll->lock);
 
-   foundEntry = g_hash_table_find(searchTable,
-                                  PollGtkFindPredicate,
-                                  &searchEntry);
+   foundEntry = PollGtkLookup(poll, classSet, f, clientData, type);
    if (foundEntry) {
-      if (type == POLL_DEVICE) {
-         key = foundEntry->event;
-         if (foundEntry->flags != flags) {
-            finalFlags = foundEntry->flags;
-            if (flags & POLL_FLAG_READ) {
-               finalFlags &= ~POLL_FLAG_READ;
-            }
-            if (flags & POLL_FLAG_WRITE) {
-               finalFlags &= ~POLL_FLAG_WRITE;
-            }
-            modify = TRUE;
+      if (type == POLL_DEVICE && foundEntry->flags != flags) {
+         finalFlags = foundEntry->flags;
+         if (flags & POLL_FLAG_READ) {
+            finalFlags &= ~POLL_FLAG_READ;
          }
-      } else {
-         key = foundEntry->gtkInputId;
+         if (flags & POLL_FLAG_WRITE) {
+            finalFlags &= ~POLL_FLAG_WRITE;
+         }
+         modify = (finalFlags & (POLL_FLAG_READ | POLL_FLAG_WRITE)) != 0;
       }
 #ifdef __MINGW32__
-      if (foundEntry->channel) {
-         g_io_channel_unref(foundEntry->channel);
-         /*
-          * Since the poll client can't close the fd of the channel, we
-          * need to shutdown the channel to close it for them.
-          */
-         GError *err = NULL;
-         g_io_channel_shutdown(foundEntry->channel, FALSE, &err);
-         g_free(err);
-         foundEntry->channel = NULL;
-      }
       modify = FALSE;
 #endif
-      g_hash_table_remove(searchTable, (gpointer)(intptr_t)key);
 
       if (modify) {
-         PollGtkCallback(classSet, finalFlags, f, clientData, type, key, NULL);
+         /*
+          * Only some of the flags are going away: keep the entry and its
+          * channel, and just watch for the remaining conditions.
+          */
+         g_source_remove(foundEntry->gtkInputId);
+         foundEntry->flags = finalFlags;
+         PollGtkAddWatch(foundEntry);
+      } else {
+         PollGtkUnlink(poll, foundEntry);
+         PollGtkRemoveOneCallback(foundEntry);
       }
    }
 
@@ -353,8 +573,11 @@ PollGtkCallbackRemove(PollClassSet classSet,   // IN
  *
  * PollGtkRemoveOneCallback --
  *
+ *      Unregister an entry's GTK source and free it.  The entry must
+ *      already be out of callbackTable.
+ *
  * Results:
- *      TRUE if entry found and removed, FALSE otherwise
+ *      None
  *
  * Side effects:
  *      queues modified
@@ -370,19 +593,21 @@ PollGtkRemoveOneCallback(PollGtkEntry *eventEntry) // IN
    case POLL_MAIN_LOOP:
    case POLL_DEVICE:
       g_source_remove(eventEntry->gtkInputId);
-#ifdef __MINGW32__
       if (eventEntry->channel) {
+#ifdef __MINGW32__
+         if (eventEntry->flags & POLL_FLAG_FD) {
+            /*
+             * Since the poll client can't close the fd of the channel, we
+             * need to shutdown the channel to close it for them.
+             */
+            GError *err = NULL;
+            g_io_channel_shutdown(eventEntry->channel, FALSE, &err);
+            g_free(err);
+         }
+#endif
          g_io_channel_unref(eventEntry->channel);
-         /*
-          * Since the poll client can't close the fd of the channel, we
-          * need to shutdown the channel to close it for them.
-          */
-         GError *err = NULL;
-         g_io_channel_shutdown(eventEntry->channel, FALSE, &err);
-         g_free(err);
          eventEntry->channel = NULL;
       }
-#endif
       break;
    case POLL_VIRTUALREALTIME:
    case POLL_VTIME:
@@ -423,36 +648,7 @@ PollGtkCallback(PollClassSet classSet,   // IN
 {
    VMwareStatus result;
    Poll *poll = pollState;
-   GHashTable *insertTable;
    PollGtkEntry *newEntry;
-   GIOChannel *channel;
-   int conditionFlags;
-   gint key;
-
-   g_static_rec_mutex_lock(&poll->lock);
-
-   if (type == POLL_DEVICE) {
-      PollGtkEntry searchEntry;
-      PollGtkEntry *foundEntry;
-
-      searchEntry.classSet = classSet;
-      searchEntry.flags = flags;
-      searchEntry.f = f;
-      searchEntry.clientData = clientData;
-      searchEntry.type = type;
-
-      foundEntry = g_hash_table_find(poll->deviceTable,
-                                     PollGtkFindPredicate,
-                                     &searchEntry);
-      if (foundEntry) {
-         /*
-          * final flags are the union of old and new flags.
-          */
-         flags |= foundEntry->flags;
-         g_hash_table_remove(poll->deviceTable, (gpointer)(intptr_t)info);
-         return PollGtkCallback(classSet, flags, f, clientData, type, info, lock);
-      }
-   }
 
    ASSERT(f);
    ASSERT(lock == NULL);
@@ -469,6 +665,29 @@ PollGtkCallback(PollClassSet classSet,   // IN
     */
    ASSERT((classSet & 1 << POLL_CLASS_MAIN) != 0);
 
+   g_static_rec_mutex_lock(&poll->lock);
+
+   if (type == POLL_DEVICE) {
+      PollGtkEntry *foundEntry;
+
+      foundEntry = PollGtkLookup(poll, classSet, f, clientData, type);
+      if (foundEntry && foundEntry->event == info) {
+         /*
+          * final flags are the union of old and new flags.  If they
+          * are unchanged the existing watch already does the job;
+          * otherwise replace the watch but keep the channel.
+          */
+         flags |= foundEntry->flags;
+         if (flags != foundEntry->flags) {
+            g_source_remove(foundEntry->gtkInputId);
+            foundEntry->flags = flags;
+            PollGtkAddWatch(foundEntry);
+         }
+         result = VMWARE_STATUS_SUCCESS;
+         goto out;
+      }
+   }
+
    newEntry = g_new0(PollGtkEntry, 1);
 
    newEntry->f = f;
@@ -495,67 +714,14 @@ PollGtkCallback(PollClassSet classSet,   // IN
       newEntry->gtkInputId = g_timeout_add(info / 1000,
                                            PollGtkBasicCallback,
                                            newEntry);
-      insertTable = poll->timerTable;
-      key = newEntry->gtkInputId;
       break;
 
    case POLL_DEVICE:
-      conditionFlags = 0;
-
-      if (POLL_FLAG_READ & flags) {
-         conditionFlags |= G_IO_IN | G_IO_PRI;
-      }
-      if (POLL_FLAG_WRITE & flags) {
-         conditionFlags |= G_IO_OUT;
-      }
-      conditionFlags |= G_IO_ERR | G_IO_HUP | G_IO_NVAL;
-
-      /*
-       * When neither flag is passed, default to READ.
-       */
-      if ((flags & (POLL_FLAG_READ | POLL_FLAG_WRITE)) == 0) {
-         conditionFlags |= G_IO_IN | G_IO_PRI;
-      }
-
       /*
        * info is a file descriptor/socket/handle
        */
       newEntry->event = info;
-
-      /*
-       * XXX Looking at the GTK/GLIB source code, it seems that a returned value
-       *     of 0 indicates failure (and I should check for it), but that is not
-       *     clear 
-       */
-#ifdef _WIN32
-      if (flags & POLL_FLAG_SOCKET) {
-         channel = g_io_channel_win32_new_socket(info);
-#ifdef __MINGW32__
-      } else if (flags & POLL_FLAG_FD) {
-         channel = g_io_channel_win32_new_fd(info);
-         newEntry->channel = channel;
-#endif
-      } else {
-         channel = g_io_channel_win32_new_messages(info);
-      }
-#else
-      channel = g_io_channel_unix_new(info);
-#endif
-      newEntry->gtkInputId = g_io_add_watch(channel,
-                                            conditionFlags,
-                                            PollGtkEventCallback,
-                                            newEntry);
-#ifdef __MINGW32__
-      if (!newEntry->channel) {
-         // if the channel is not cached then we can unreference it.
-         g_io_channel_unref(channel);
-      }
-#else
-      g_io_channel_unref(channel);
-#endif
-      key = info;
-      insertTable = poll->deviceTable;
-
+      PollGtkAddWatch(newEntry);
       break;
       
    case POLL_VIRTUALREALTIME:
@@ -564,10 +730,11 @@ PollGtkCallback(PollClassSet classSet,   // IN
       NOT_IMPLEMENTED();
    }
 
-   g_hash_table_insert(insertTable, (gpointer)(intptr_t)key, newEntry);
+   PollGtkLink(poll, newEntry);
 
    result = VMWARE_STATUS_SUCCESS;
 
+out:
    g_static_rec_mutex_unlock(&poll->lock);
    return result;
 } // Poll_Callback
@@ -622,7 +789,8 @@ PollGtkBasicCallback(gpointer data) // IN: The eventEntry
 
    if (!ret) {
       g_static_rec_mutex_lock(&pollState->lock);
-      g_hash_table_remove(pollState->timerTable, (gpointer)(intptr_t)eventEntry->gtkInputId);
+      PollGtkUnlink(pollState, eventEntry);
+      PollGtkRemoveOneCallback(eventEntry);
       g_static_rec_mutex_unlock(&pollState->lock);
    }
 
@@ -1143,6 +1143,12 @@ SigNoHandler(int s,           // IN
       Util_Backtrace(0);
    }
 
+   /*
+    * Get batched log lines to the file while we still can.
+    */
+
+   Log_Flush();
+
    /*
     * Some signals we just send to ourselves again
     * The return is there because the signal isn't necessarily fatal.
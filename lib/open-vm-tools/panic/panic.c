@@ -540,6 +540,7 @@ Panic_Panic(const char *format,
    Log("%s", buf);
    Util_Backtrace(0);
    Log_SetAlwaysKeep(TRUE);
+   Log_Flush();
 
    /*
     * Do the debugging steps early before we have a chance
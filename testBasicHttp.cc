@@ -0,0 +1,411 @@
+/*********************************************************
+ * Copyright (C) 2010 VMware, Inc. All rights reserved.
+ *
+ * This file is part of VMware View Open Client.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * testBasicHttp.cc --
+ *
+ *      Test the BasicHttp response sinks by fetching a local file:// URL.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+
+extern "C" {
+#include "vm_basic_types.h"
+#include "basicHttp.h"
+#include "poll.h"
+}
+
+
+/* Larger than the file sink's staging buffer, and not a multiple of it. */
+#define TEST_FILE_SIZE (1024 * 1024 + 123)
+
+
+typedef struct {
+   Bool done;
+   BasicHttpErrorCode errorCode;
+} TestFetchState;
+
+
+typedef struct {
+   const char *expected;
+   size_t offset;
+   Bool matched;
+} TestCallbackState;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestOnSent --
+ *
+ *      Request completion callback: record the result.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Frees the request and response.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestOnSent(BasicHttpRequest *request,   /* IN */
+           BasicHttpResponse *response, /* IN */
+           void *clientData)            /* IN */
+{
+   TestFetchState *state = (TestFetchState *)clientData;
+
+   state->errorCode = response->errorCode;
+   state->done = TRUE;
+   BasicHttp_FreeResponse(response);
+   BasicHttp_FreeRequest(request);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFetch --
+ *
+ *      Fetch a URL into a sink, running the poll loop until it completes.
+ *
+ * Results:
+ *      The request's error code.
+ *
+ * Side effects:
+ *      The sink is written to.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static BasicHttpErrorCode
+TestFetch(const char *url,     /* IN */
+          BasicHttpSink *sink) /* IN */
+{
+   TestFetchState state = { FALSE, BASICHTTP_ERROR_NONE };
+   BasicHttpRequest *request =
+      BasicHttp_CreateRequest(url, BASICHTTP_METHOD_GET, NULL, NULL, NULL);
+
+   BasicHttp_SetSink(request, sink);
+   if (!BasicHttp_SendRequest(request, TestOnSent, &state)) {
+      BasicHttp_FreeRequest(request);
+      return BASICHTTP_ERROR_GENERIC;
+   }
+   while (!state.done) {
+      Poll_Loop(FALSE, NULL, POLL_CLASS_MAIN);
+   }
+   return state.errorCode;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestCompare --
+ *
+ *      Test whether fetched data matches the source file.
+ *
+ * Results:
+ *      TRUE if the data is equal.
+ *
+ * Side effects:
+ *      Prints error if not.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestCompare(const char *name,     /* IN */
+            const char *data,     /* IN */
+            size_t size,          /* IN */
+            const char *expected) /* IN */
+{
+   if (size != TEST_FILE_SIZE) {
+      g_printerr("Expected %s size %d, was: %lu\n", name, TEST_FILE_SIZE,
+                 (unsigned long)size);
+      return FALSE;
+   }
+   if (memcmp(data, expected, size)) {
+      g_printerr("Expected %s to match the source file\n", name);
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestMemorySink --
+ *
+ *      Test collecting a response in memory, with and without room for it.
+ *
+ * Results:
+ *      TRUE if the sink behaved as expected.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestMemorySink(const char *url,      /* IN */
+               const char *expected) /* IN */
+{
+   gboolean success = TRUE;
+   BasicHttpSink *sink = BasicHttp_AllocMemorySink(0);
+   BasicHttpErrorCode err = TestFetch(url, sink);
+   const void *data;
+   size_t size;
+
+   data = BasicHttp_GetMemorySinkData(sink, &size);
+   if (err != BASICHTTP_ERROR_NONE) {
+      g_printerr("Memory sink fetch failed: %d\n", err);
+      success = FALSE;
+   } else {
+      success = TestCompare("memory sink", (const char *)data, size,
+                            expected);
+   }
+   BasicHttp_FreeSink(sink);
+
+   sink = BasicHttp_AllocMemorySink(TEST_FILE_SIZE / 2);
+   err = TestFetch(url, sink);
+   if (err != BASICHTTP_ERROR_TRANSFER) {
+      g_printerr("Expected over-limit memory sink error %d, was: %d\n",
+                 BASICHTTP_ERROR_TRANSFER, err);
+      success = FALSE;
+   }
+   BasicHttp_FreeSink(sink);
+
+   return success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFileSink --
+ *
+ *      Test streaming a response to a file.
+ *
+ * Results:
+ *      TRUE if the file holds exactly the response.
+ *
+ * Side effects:
+ *      Creates and removes a temporary file.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestFileSink(const char *url,      /* IN */
+             const char *expected) /* IN */
+{
+   gboolean success = FALSE;
+   char *path = NULL;
+   char *data = NULL;
+   gsize size = 0;
+   int fd = g_file_open_tmp("testBasicHttpSink-XXXXXX", &path, NULL);
+   BasicHttpSink *sink;
+   BasicHttpErrorCode err;
+
+   if (fd < 0) {
+      g_printerr("Could not create a temporary file\n");
+      return FALSE;
+   }
+
+   sink = BasicHttp_AllocFileSink(fd, TRUE);
+   err = TestFetch(url, sink);
+   /* Flushes the staging buffer and trims any preallocated space. */
+   BasicHttp_FreeSink(sink);
+
+   if (err != BASICHTTP_ERROR_NONE) {
+      g_printerr("File sink fetch failed: %d\n", err);
+   } else if (!g_file_get_contents(path, &data, &size, NULL)) {
+      g_printerr("Could not read back %s\n", path);
+   } else {
+      success = TestCompare("file sink", data, size, expected);
+   }
+
+   g_free(data);
+   unlink(path);
+   g_free(path);
+   return success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestCallbackSinkData --
+ *
+ *      Callback sink data proc: check each piece against the source file.
+ *
+ * Results:
+ *      TRUE to continue the transfer.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestCallbackSinkData(void *clientData,   /* IN */
+                     const void *buffer, /* IN */
+                     size_t size)        /* IN */
+{
+   TestCallbackState *state = (TestCallbackState *)clientData;
+
+   if (state->offset + size > TEST_FILE_SIZE ||
+       memcmp(state->expected + state->offset, buffer, size)) {
+      state->matched = FALSE;
+   }
+   state->offset += size;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestCallbackSink --
+ *
+ *      Test handing a response to a callback piece by piece.
+ *
+ * Results:
+ *      TRUE if the callback saw exactly the response.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestCallbackSink(const char *url,      /* IN */
+                 const char *expected) /* IN */
+{
+   TestCallbackState state = { expected, 0, TRUE };
+   BasicHttpSink *sink = BasicHttp_AllocCallbackSink(TestCallbackSinkData,
+                                                     &state);
+   BasicHttpErrorCode err = TestFetch(url, sink);
+
+   BasicHttp_FreeSink(sink);
+   if (err != BASICHTTP_ERROR_NONE) {
+      g_printerr("Callback sink fetch failed: %d\n", err);
+      return FALSE;
+   }
+   if (!state.matched || state.offset != TEST_FILE_SIZE) {
+      g_printerr("Expected callback sink to see %d matching bytes, saw: "
+                 "%lu%s\n", TEST_FILE_SIZE, (unsigned long)state.offset,
+                 state.matched ? "" : " (mismatched)");
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Main function.  Serves a temporary file over file:// to each sink.
+ *
+ * Results:
+ *      Number of failed tests.
+ *
+ * Side effects:
+ *      Creates and removes temporary files.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,     /* IN/UNUSED */
+     char *argv[]) /* IN/UNUSED */
+{
+#define TEST(name, expr)                         \
+   if (expr) {                                   \
+      g_print(   "    PASSED: %s\n", name);      \
+      passed++;                                  \
+   } else {                                      \
+      g_printerr("!!! FAILED: %s\n", name);      \
+      failed++;                                  \
+   }
+
+   int passed = 0;
+   int failed = 0;
+   char *path = NULL;
+   char *url;
+   char *expected = (char *)g_malloc(TEST_FILE_SIZE);
+   int fd;
+   int i;
+
+   for (i = 0; i < TEST_FILE_SIZE; i++) {
+      expected[i] = (char)(i * 7 + i / 4096);
+   }
+
+   fd = g_file_open_tmp("testBasicHttp-XXXXXX", &path, NULL);
+   if (fd < 0) {
+      g_printerr("Could not create a temporary file\n");
+      return 1;
+   }
+   for (i = 0; i < TEST_FILE_SIZE; ) {
+      ssize_t n = write(fd, expected + i, TEST_FILE_SIZE - i);
+      if (n < 0 && errno != EINTR) {
+         g_printerr("Could not write %s: %s\n", path, strerror(errno));
+         close(fd);
+         unlink(path);
+         return 1;
+      }
+      i += n > 0 ? n : 0;
+   }
+   close(fd);
+   url = g_filename_to_uri(path, NULL, NULL);
+
+   Poll_InitDefault();
+   BasicHttp_Init(Poll_Callback, Poll_CallbackRemove);
+
+   TEST("memory sink", TestMemorySink(url, expected));
+   TEST("file sink", TestFileSink(url, expected));
+   TEST("callback sink", TestCallbackSink(url, expected));
+
+   BasicHttp_Shutdown();
+
+   unlink(path);
+   g_free(path);
+   g_free(url);
+   g_free(expected);
+
+   g_print("Passed %d of %d tests.\n", passed, passed + failed);
+
+   return failed;
+
+#undef TEST
+}
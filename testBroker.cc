@@ -0,0 +1,440 @@
+/*********************************************************
+ * Copyright (C) 2010 VMware, Inc. All rights reserved.
+ *
+ * This file is part of VMware View Open Client.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * testBroker.cc --
+ *
+ *      Test how Broker applies new and refreshed desktop lists, without
+ *      talking to a broker.
+ */
+
+#include <glib.h>
+
+
+#include "broker.hh"
+#include "desktop.hh"
+
+
+extern "C" {
+#include "basicHttp.h"
+#include "poll.h"
+}
+
+
+using namespace cdk;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestIds --
+ *
+ *      Get the IDs of some desktops.
+ *
+ * Results:
+ *      The concatenated IDs.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Util::string
+TestIds(const std::vector<Desktop *> &desktops) // IN
+{
+   Util::string ids;
+
+   for (std::vector<Desktop *>::const_iterator i = desktops.begin();
+        i != desktops.end(); i++) {
+      ids += (*i)->GetID();
+   }
+   return ids;
+}
+
+
+/*
+ * A BrokerXml that never sends anything.
+ */
+class TestXml
+   : public BrokerXml
+{
+public:
+   TestXml(const Util::string &hostname) : BrokerXml(hostname, 443, true) { }
+
+protected:
+   virtual bool SendHttpRequest(RequestState *req, const Util::string &body)
+      { return false; }
+};
+
+
+/*
+ * A Broker whose desktop list handlers can be called directly.
+ */
+class TestBroker
+   : public Broker
+{
+public:
+   using Broker::OnGetDesktopsSet;
+   using Broker::OnGetDesktopsRefresh;
+
+protected:
+   virtual BrokerXml *CreateNewXmlConnection(const Util::string &hostname,
+                                             int port, bool secure)
+      { return new TestXml(hostname); }
+   virtual void InitTunnel() { }
+};
+
+
+/*
+ * Records what the broker reports.  Removed desktops are deleted once
+ * DesktopsChanged returns, so only their IDs are kept.
+ */
+class TestDelegate
+   : public Broker::Delegate
+{
+public:
+   TestDelegate() : requestDesktopCalls(0), changedCalls(0), reordered(false)
+      { }
+
+   virtual void RequestDesktop() { requestDesktopCalls++; }
+   virtual void DesktopsChanged(const Broker::DesktopDiff &diff);
+
+   int requestDesktopCalls;
+   int changedCalls;
+   Util::string added;
+   Util::string removed;
+   Util::string changed;
+   bool reordered;
+};
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestDelegate::DesktopsChanged --
+ *
+ *      Remember the IDs in a desktop list diff.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+TestDelegate::DesktopsChanged(const Broker::DesktopDiff &diff) // IN
+{
+   changedCalls++;
+   added = TestIds(diff.added);
+   removed = TestIds(diff.removed);
+   changed = TestIds(diff.changed);
+   reordered = diff.reordered;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestEntitlements --
+ *
+ *      Build an entitlement list.
+ *
+ * Results:
+ *      One desktop per character of ids, each named after its ID plus
+ *      suffix.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static BrokerXml::EntitledDesktops
+TestEntitlements(const char *ids,                      // IN
+                 const Util::string &suffix = "")      // IN/OPT
+{
+   BrokerXml::EntitledDesktops desktops;
+
+   for (const char *id = ids; *id; id++) {
+      BrokerXml::Desktop desktop;
+      desktop.id = Util::string(1, *id);
+      desktop.name = desktop.id + suffix;
+      desktop.protocols.push_back("RDP");
+      desktops.desktops.push_back(desktop);
+   }
+   return desktops;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestOrder --
+ *
+ *      Get the IDs of the broker's desktops, in list order.
+ *
+ * Results:
+ *      The concatenated IDs.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Util::string
+TestOrder(const Broker &broker) // IN
+{
+   return TestIds(broker.mDesktops);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestRefreshDiff --
+ *
+ *      Check that a refresh reports exactly the desktops that were added,
+ *      removed or changed, and whether the others were reordered.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestRefreshDiff(void)
+{
+   TestBroker broker;
+   TestDelegate delegate;
+   BrokerXml::EntitledDesktops desktops;
+
+   broker.SetDelegate(&delegate);
+   broker.Initialize("broker.example.com", 443, true, "", "");
+
+   desktops = TestEntitlements("ABC");
+   broker.OnGetDesktopsSet(desktops);
+   Desktop *a = broker.mDesktops[0];
+
+   // B is renamed, C goes away, D is new.
+   desktops = TestEntitlements("ABD");
+   desktops.desktops[1].name = "renamed";
+   broker.OnGetDesktopsRefresh(desktops);
+
+   if (delegate.changedCalls != 1 || delegate.added != "D" ||
+       delegate.removed != "C" || delegate.changed != "B" ||
+       delegate.reordered) {
+      g_printerr("Wrong diff: +%s -%s ~%s%s\n", delegate.added.c_str(),
+                 delegate.removed.c_str(), delegate.changed.c_str(),
+                 delegate.reordered ? " reordered" : "");
+      return FALSE;
+   }
+   if (TestOrder(broker) != "ABD" || broker.mDesktops[0] != a ||
+       broker.GetDesktopName("B") != "renamed" ||
+       broker.GetDesktopName("C") != "") {
+      g_printerr("Desktop list is %s after the refresh\n",
+                 TestOrder(broker).c_str());
+      return FALSE;
+   }
+
+   // Nothing changed: the delegate is not bothered.
+   broker.OnGetDesktopsRefresh(desktops);
+   if (delegate.changedCalls != 1) {
+      g_printerr("An unchanged refresh was reported\n");
+      return FALSE;
+   }
+
+   // Same desktops, new order.
+   desktops = TestEntitlements("DAB");
+   desktops.desktops[2].name = "renamed";
+   broker.OnGetDesktopsRefresh(desktops);
+   if (delegate.changedCalls != 2 || !delegate.reordered ||
+       !delegate.added.empty() || !delegate.removed.empty() ||
+       !delegate.changed.empty() || TestOrder(broker) != "DAB") {
+      g_printerr("A reordering was not reported as one\n");
+      return FALSE;
+   }
+
+   // New desktops in between do not count as reordering.
+   desktops = TestEntitlements("EDFAB");
+   desktops.desktops[4].name = "renamed";
+   broker.OnGetDesktopsRefresh(desktops);
+   if (delegate.changedCalls != 3 || delegate.reordered ||
+       delegate.added != "EF") {
+      g_printerr("Insertions were reported as a reordering\n");
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestRefreshRemovesSelected --
+ *
+ *      Check that a refresh that drops the selected desktop also drops
+ *      the broker's pointer to it.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestRefreshRemovesSelected(void)
+{
+   TestBroker broker;
+   TestDelegate delegate;
+   BrokerXml::EntitledDesktops desktops;
+
+   broker.SetDelegate(&delegate);
+   broker.Initialize("broker.example.com", 443, true, "", "");
+
+   desktops = TestEntitlements("AB");
+   broker.OnGetDesktopsSet(desktops);
+   broker.ConnectDesktop(broker.mDesktops[1]);
+   if (broker.GetDesktop() != broker.mDesktops[1]) {
+      g_printerr("Desktop B was not selected\n");
+      return FALSE;
+   }
+
+   desktops = TestEntitlements("A");
+   broker.OnGetDesktopsRefresh(desktops);
+   if (broker.GetDesktop()) {
+      g_printerr("The removed desktop is still selected\n");
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSetReplaces --
+ *
+ *      Check that setting a new desktop list replaces the old one, its
+ *      ID index and the selection.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestSetReplaces(void)
+{
+   TestBroker broker;
+   TestDelegate delegate;
+   BrokerXml::EntitledDesktops desktops;
+
+   broker.SetDelegate(&delegate);
+   broker.Initialize("broker.example.com", 443, true, "", "");
+
+   desktops = TestEntitlements("AB");
+   broker.OnGetDesktopsSet(desktops);
+   broker.ConnectDesktop(broker.mDesktops[0]);
+
+   desktops = TestEntitlements("BC", " again");
+   broker.OnGetDesktopsSet(desktops);
+
+   if (delegate.requestDesktopCalls != 2 || TestOrder(broker) != "BC") {
+      g_printerr("Desktop list is %s after the second set\n",
+                 TestOrder(broker).c_str());
+      return FALSE;
+   }
+   if (broker.GetDesktopName("A") != "" ||
+       broker.GetDesktopName("B") != "B again" ||
+       broker.GetDesktopName("C") != "C again") {
+      g_printerr("The ID index still refers to the old list\n");
+      return FALSE;
+   }
+   if (broker.GetDesktop()) {
+      g_printerr("A desktop from the old list is still selected\n");
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Main function.
+ *
+ * Results:
+ *      Number of failed tests.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,     /* IN/UNUSED */
+     char *argv[]) /* IN/UNUSED */
+{
+#define TEST(name, expr)                         \
+   if (expr) {                                   \
+      g_print(   "    PASSED: %s\n", name);      \
+      passed++;                                  \
+   } else {                                      \
+      g_printerr("!!! FAILED: %s\n", name);      \
+      failed++;                                  \
+   }
+
+   int passed = 0;
+   int failed = 0;
+
+   Poll_InitDefault();
+   BasicHttp_Init(Poll_Callback, Poll_CallbackRemove);
+
+   TEST("refresh reports what changed", TestRefreshDiff());
+   TEST("refresh drops a removed selection", TestRefreshRemovesSelected());
+   TEST("set replaces the list and its index", TestSetReplaces());
+
+   BasicHttp_Shutdown();
+
+   g_print("Passed %d of %d tests.\n", passed, passed + failed);
+
+   return failed;
+
+#undef TEST
+}
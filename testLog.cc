@@ -0,0 +1,360 @@
+/*********************************************************
+ * Copyright (C) 2010 VMware, Inc. All rights reserved.
+ *
+ * This file is part of VMware View Open Client.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * testLog.cc --
+ *
+ *      Test batching and throttling of log file writes.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+extern "C" {
+#include "vm_basic_types.h"
+#include "log.h"
+#include "logInt.h"
+}
+
+
+/* Enough lines to fill the log buffer more than once. */
+#define TEST_NUM_LINES 1000
+
+
+static char *fileName;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFileLength --
+ *
+ *      Get what is in the log file so far.
+ *
+ * Results:
+ *      Length of the file, or 0 if it could not be read.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gsize
+TestFileLength(void)
+{
+   char *contents = NULL;
+   gsize len = 0;
+
+   if (!g_file_get_contents(fileName, &contents, &len, NULL)) {
+      return 0;
+   }
+   g_free(contents);
+   return len;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFileEndsWith --
+ *
+ *      Check the end of the log file.
+ *
+ * Results:
+ *      TRUE if the log file ends with str.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestFileEndsWith(const char *str) // IN
+{
+   char *contents = NULL;
+   Bool ret;
+
+   if (!g_file_get_contents(fileName, &contents, NULL, NULL)) {
+      return FALSE;
+   }
+   ret = g_str_has_suffix(contents, str);
+   g_free(contents);
+   return ret;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestBatch --
+ *
+ *      Check that a few lines stay in memory until Log_Flush, and then
+ *      reach the file in order.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      Writes the log file.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestBatch(void)
+{
+   gsize len;
+   int i;
+
+   if (Log_GetFlushInterval() != LOG_DEFAULT_FLUSH_INTERVAL) {
+      g_printerr("Flush interval is %u, expected %u\n",
+                 Log_GetFlushInterval(), LOG_DEFAULT_FLUSH_INTERVAL);
+      return FALSE;
+   }
+
+   Log_Flush();
+   len = TestFileLength();
+
+   for (i = 0; i < 10; i++) {
+      Log("batched line %d\n", i);
+   }
+   if (TestFileLength() != len) {
+      g_printerr("Lines were written before Log_Flush\n");
+      return FALSE;
+   }
+
+   Log_Flush();
+   if (TestFileLength() <= len || !TestFileEndsWith("batched line 9\n")) {
+      g_printerr("Log_Flush did not write out the batched lines\n");
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestBufferFull --
+ *
+ *      Check that the batched lines are written out once they fill the
+ *      buffer, without waiting for Log_Flush.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      Writes the log file.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestBufferFull(void)
+{
+   gsize len;
+   int i;
+
+   Log_Flush();
+   len = TestFileLength();
+
+   for (i = 0; i < TEST_NUM_LINES; i++) {
+      Log("line %d of a burst that is longer than the log buffer\n", i);
+   }
+   if (TestFileLength() <= len) {
+      g_printerr("A full buffer was not written out\n");
+      return FALSE;
+   }
+
+   Log_Flush();
+   if (!TestFileEndsWith("line 999 of a burst that is longer than the log "
+                         "buffer\n")) {
+      g_printerr("Lines of the burst are missing\n");
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestThrottled --
+ *
+ *      Check that messages logged while throttling holds are dropped and
+ *      charged at the average message length, so the throttling stays in
+ *      place.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      Throttles the log for a moment.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestThrottled(void)
+{
+   LogThrottleInfo *info = &logState.throttleInfo;
+   GTimeVal now;
+   uint64 bytesLogged;
+   uint32 avgMsgLen = logState.avgMsgLen;
+   gsize len;
+   Bool ret = TRUE;
+   int i;
+
+   if (avgMsgLen == 0) {
+      g_printerr("No average message length was kept\n");
+      return FALSE;
+   }
+
+   Log_Flush();
+   len = TestFileLength();
+
+   /* As LogIsThrottled leaves it after a sample over the limit. */
+   info->throttleBPS = 1;
+   info->throttled = TRUE;
+   g_get_current_time(&now);
+   info->lastSampleTime = (VmTimeType)now.tv_sec * 1000000 + now.tv_usec;
+   bytesLogged = info->bytesLogged;
+
+   for (i = 0; i < 10; i++) {
+      Log("dropped line %d\n", i);
+   }
+   Log_Flush();
+
+   if (TestFileLength() != len) {
+      g_printerr("Throttled lines were written\n");
+      ret = FALSE;
+   }
+   if (info->bytesLogged != bytesLogged + 10 * avgMsgLen) {
+      g_printerr("Dropped lines were charged %u bytes, expected %u\n",
+                 (unsigned)(info->bytesLogged - bytesLogged),
+                 10 * avgMsgLen);
+      ret = FALSE;
+   }
+
+   info->throttleBPS = 0;
+   info->throttled = FALSE;
+
+   Log("unthrottled line\n");
+   Log_Flush();
+   if (!TestFileEndsWith("unthrottled line\n")) {
+      g_printerr("Logging did not resume after throttling\n");
+      ret = FALSE;
+   }
+   return ret;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestExit --
+ *
+ *      Check that Log_Exit writes out what is still batched.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      Shuts logging down.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestExit(void)
+{
+   Log_Flush();
+   Log("last line\n");
+   Log_Exit();
+
+   if (!TestFileEndsWith("last line\n")) {
+      g_printerr("Log_Exit did not write out the batched lines\n");
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Main function.
+ *
+ * Results:
+ *      Number of failed tests.
+ *
+ * Side effects:
+ *      Creates and removes a log file in the temporary directory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,     /* IN/UNUSED */
+     char *argv[]) /* IN/UNUSED */
+{
+#define TEST(name, expr)                         \
+   if (expr) {                                   \
+      g_print(   "    PASSED: %s\n", name);      \
+      passed++;                                  \
+   } else {                                      \
+      g_printerr("!!! FAILED: %s\n", name);      \
+      failed++;                                  \
+   }
+
+   int passed = 0;
+   int failed = 0;
+   char *baseName = g_strdup_printf("testLog-%d.log", (int)getpid());
+
+   fileName = g_build_filename(g_get_tmp_dir(), baseName, NULL);
+   g_free(baseName);
+
+   /* No throttling until TestThrottled turns it on. */
+   if (!Log_InitEx(fileName, NULL, NULL, "testLog", "1.0", TRUE, FALSE, 0,
+                   0, 0, FALSE, 0)) {
+      g_printerr("Could not initialize logging to %s\n", fileName);
+      return 1;
+   }
+
+   TEST("lines are batched until flushed", TestBatch());
+   TEST("a full buffer is written out", TestBufferFull());
+   TEST("throttled lines are dropped and charged", TestThrottled());
+   TEST("exit writes out batched lines", TestExit());
+
+   unlink(fileName);
+   g_free(fileName);
+
+   g_print("Passed %d of %d tests.\n", passed, passed + failed);
+
+   return failed;
+
+#undef TEST
+}
@@ -0,0 +1,340 @@
+/*********************************************************
+ * Copyright (C) 2010 VMware, Inc. All rights reserved.
+ *
+ * This file is part of VMware View Open Client.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * testPoll.cc --
+ *
+ *      Test adding, removing and firing timers in the default poll
+ *      implementation.
+ */
+
+#include <glib.h>
+
+
+extern "C" {
+#include "vm_basic_types.h"
+#include "poll.h"
+}
+
+
+/* Enough timers that the timer heap has to grow a few times. */
+#define TEST_NUM_TIMERS 1000
+
+/* Spacing between the timers' delays, in microseconds. */
+#define TEST_TIMER_STEP 10
+
+
+static int timersFired[TEST_NUM_TIMERS];
+static int numTimersFired;
+static int periodicFired;
+static Bool loopDone;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestTimerCb --
+ *
+ *      One-shot timer callback.  Records which timer fired.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Appends to timersFired.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestTimerCb(void *clientData) // IN
+{
+   if (numTimersFired < TEST_NUM_TIMERS) {
+      timersFired[numTimersFired] = (int)(intptr_t)clientData;
+   }
+   numTimersFired++;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestDoneCb --
+ *
+ *      Timer callback that ends the poll loop.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Sets loopDone.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestDoneCb(void *clientData) // IN/UNUSED
+{
+   loopDone = TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestRunUntil --
+ *
+ *      Run the poll loop until a timer scheduled after delay fires.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Fires callbacks.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestRunUntil(uint32 delay) // IN: microseconds
+{
+   loopDone = FALSE;
+   Poll_CB_RTime(TestDoneCb, NULL, delay, FALSE, NULL);
+   Poll_Loop(TRUE, &loopDone, POLL_CLASS_MAIN);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestRemoveByKey --
+ *
+ *      Add many timers, remove every other one by key, and check that
+ *      exactly the rest fire, in time order.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      Runs the poll loop.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestRemoveByKey(void)
+{
+   int i;
+
+   numTimersFired = 0;
+   for (i = 0; i < TEST_NUM_TIMERS; i++) {
+      Poll_CB_RTime(TestTimerCb, (void *)(intptr_t)i,
+                    (i + 1) * TEST_TIMER_STEP, FALSE, NULL);
+   }
+   for (i = 1; i < TEST_NUM_TIMERS; i += 2) {
+      if (!Poll_CB_RTimeRemove(TestTimerCb, (void *)(intptr_t)i, FALSE)) {
+         g_printerr("Timer %d was not found\n", i);
+         return FALSE;
+      }
+   }
+   if (Poll_CB_RTimeRemove(TestTimerCb, (void *)(intptr_t)1, FALSE)) {
+      g_printerr("Timer 1 was removed twice\n");
+      return FALSE;
+   }
+
+   TestRunUntil((TEST_NUM_TIMERS + 1) * TEST_TIMER_STEP);
+
+   if (numTimersFired != TEST_NUM_TIMERS / 2) {
+      g_printerr("%d timers fired, expected %d\n", numTimersFired,
+                 TEST_NUM_TIMERS / 2);
+      return FALSE;
+   }
+   for (i = 0; i < numTimersFired; i++) {
+      /*
+       * Both the time of registration and the delay grow with i, so
+       * the timers are due in order of i.
+       */
+      int expected = 2 * i;
+
+      if (timersFired[i] != expected) {
+         g_printerr("Timer %d fired in slot %d, expected %d\n",
+                    timersFired[i], i, expected);
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestRemoveMatchesKey --
+ *
+ *      Check that removal honours every field of the key and removes
+ *      one of several identical timers at a time.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      Adds and removes timers.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestRemoveMatchesKey(void)
+{
+   void *cd = (void *)&numTimersFired;
+   int i;
+
+   for (i = 0; i < 3; i++) {
+      Poll_CB_RTime(TestTimerCb, cd, 1000000, FALSE, NULL);
+   }
+
+   if (Poll_CB_RTimeRemove(TestTimerCb, cd, TRUE) ||
+       Poll_CB_RTimeRemove(TestDoneCb, cd, FALSE) ||
+       Poll_CB_RTimeRemove(TestTimerCb, NULL, FALSE) ||
+       Poll_CallbackRemove(POLL_CS_IPC, 0, TestTimerCb, cd, POLL_REALTIME)) {
+      g_printerr("A timer was removed with the wrong key\n");
+      return FALSE;
+   }
+   for (i = 0; i < 3; i++) {
+      if (!Poll_CB_RTimeRemove(TestTimerCb, cd, FALSE)) {
+         g_printerr("Copy %d of the timer was not found\n", i);
+         return FALSE;
+      }
+   }
+   if (Poll_CB_RTimeRemove(TestTimerCb, cd, FALSE)) {
+      g_printerr("More timers removed than were added\n");
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestPeriodicCb --
+ *
+ *      Periodic timer callback that removes itself on its third call.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Bumps periodicFired.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestPeriodicCb(void *clientData) // IN
+{
+   if (++periodicFired == 3 &&
+       !Poll_CB_RTimeRemove(TestPeriodicCb, clientData, TRUE)) {
+      g_printerr("Periodic timer could not remove itself\n");
+      periodicFired = -1000;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestRemovePeriodic --
+ *
+ *      Check that a periodic timer can remove itself from its callback
+ *      and then stops firing.
+ *
+ * Results:
+ *      TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *      Runs the poll loop.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+TestRemovePeriodic(void)
+{
+   periodicFired = 0;
+   Poll_CB_RTime(TestPeriodicCb, NULL, 5000, TRUE, NULL);
+
+   TestRunUntil(50000);
+
+   if (periodicFired != 3) {
+      g_printerr("Periodic timer fired %d times, expected 3\n",
+                 periodicFired);
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *      Main function.
+ *
+ * Results:
+ *      Number of failed tests.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,     /* IN/UNUSED */
+     char *argv[]) /* IN/UNUSED */
+{
+#define TEST(name, expr)                         \
+   if (expr) {                                   \
+      g_print(   "    PASSED: %s\n", name);      \
+      passed++;                                  \
+   } else {                                      \
+      g_printerr("!!! FAILED: %s\n", name);      \
+      failed++;                                  \
+   }
+
+   int passed = 0;
+   int failed = 0;
+
+   Poll_InitDefault();
+
+   TEST("remove timers by key", TestRemoveByKey());
+   TEST("removal matches the whole key", TestRemoveMatchesKey());
+   TEST("periodic timer removes itself", TestRemovePeriodic());
+
+   Poll_Exit();
+
+   g_print("Passed %d of %d tests.\n", passed, passed + failed);
+
+   return failed;
+
+#undef TEST
+}
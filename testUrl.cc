@@ -27,6 +27,8 @@
 #include <string.h>
 
 
+#include "cdkProxy.h"
+#include "cdkTimeZone.h"
 #include "cdkUrl.h"
 
 
@@ -159,6 +161,116 @@ TestUrl(const char *url,      /* IN */
 }
 
 
+#if !defined(_WIN32) && !defined(VIEW_COCOA)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestProxyKey --
+ *
+ *      Test building the proxy cache key of a URL.
+ *
+ * Results:
+ *      TRUE if the key and its host part are as expected.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestProxyKey(const char *url,     /* IN */
+             const char *expKey,  /* IN */
+             const char *expHost) /* IN */
+{
+    const char *host;
+    char *key = CdkProxy_GetCacheKey(url, &host);
+    gboolean success = TestStr("key", key, expKey);
+
+    success = TestStr("host", host, expHost) && success;
+    if (success) {
+        g_print(   "    PASSED: %s -> proxy key %s\n", url, key);
+    } else {
+        g_printerr("!!! FAILED: %s => proxy key %s\n", url, key);
+    }
+    g_free(key);
+    return success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestNoProxy --
+ *
+ *      Test matching a host against a no_proxy list.
+ *
+ * Results:
+ *      TRUE if host was excluded from proxying exactly when expected.
+ *
+ * Side effects:
+ *      Sets no_proxy and unsets NO_PROXY in the environment.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestNoProxy(const char *noProxy,  /* IN */
+            const char *host,     /* IN */
+            gboolean expExcluded) /* IN */
+{
+    gboolean excluded;
+
+    g_unsetenv("NO_PROXY");
+    g_setenv("no_proxy", noProxy, TRUE);
+    excluded = CdkProxy_IsExcluded(host);
+    if (!excluded == !expExcluded) {
+        g_print(   "    PASSED: %s in \"%s\" -> %s\n", host, noProxy,
+                excluded ? "excluded" : "proxied");
+        return TRUE;
+    }
+    g_printerr("!!! FAILED: %s in \"%s\" => %s\n", host, noProxy,
+               excluded ? "excluded" : "proxied");
+    return FALSE;
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSysconfigClock --
+ *
+ *      Test finding the time zone in /etc/sysconfig/clock contents.
+ *
+ * Results:
+ *      TRUE if the expected time zone was found.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestSysconfigClock(const char *contents, /* IN */
+                   const char *expTzid)  /* IN */
+{
+    char *tzid = CdkTimeZone_ParseSysconfigClock(contents);
+    gboolean success = TestStr("tzid", tzid, expTzid);
+    char *escaped = g_strescape(contents, NULL);
+
+    if (success) {
+        g_print(   "    PASSED: %s -> %s\n", escaped, tzid);
+    } else {
+        g_printerr("!!! FAILED: %s => %s\n", escaped, tzid);
+    }
+    g_free(escaped);
+    g_free(tzid);
+    return success;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -188,6 +300,13 @@ main(int argc,     /* IN/UNUSED */
 
 #define TEST_URL_FAIL(url) TEST_URL(url, NULL, NULL, 0, NULL, 0)
 
+#define TEST(expr)   \
+    if (expr) {      \
+        passed++;    \
+    } else {         \
+        failed++;    \
+    }
+
    int passed = 0;
    int failed = 0;
 
@@ -197,6 +316,40 @@ main(int argc,     /* IN/UNUSED */
    TEST_URL("03-Broker-VDM.vdm.int", "http", "03-Broker-VDM.vdm.int", 80, "/", FALSE);
    TEST_URL("cha-address-.ViewPro.com", "http", "cha-address-.ViewPro.com", 80, "/", FALSE);
 
+#if !defined(_WIN32) && !defined(VIEW_COCOA)
+   TEST(TestProxyKey("https://Broker.Example.COM:443/foo", "https://broker.example.com", "broker.example.com"));
+   TEST(TestProxyKey("https://user:pw@broker:8443/", "https://broker", "broker"));
+   TEST(TestProxyKey("http://user@[FE80::1]:80/x?y", "http://[fe80::1]", "[fe80::1]"));
+   TEST(TestProxyKey("https://[::1]", "https://[::1]", "[::1]"));
+   TEST(TestProxyKey("broker/path", "://broker", "broker"));
+
+   TEST(TestNoProxy("", "example.com", FALSE));
+   TEST(TestNoProxy("*", "broker.example.com", TRUE));
+   TEST(TestNoProxy("example.com", "example.com", TRUE));
+   TEST(TestNoProxy("example.com", "broker.example.com", TRUE));
+   TEST(TestNoProxy(".example.com", "example.com", TRUE));
+   TEST(TestNoProxy(".example.com", "broker.example.com", TRUE));
+   TEST(TestNoProxy("example.com", "badexample.com", FALSE));
+   TEST(TestNoProxy("localhost, example.com:443", "broker.example.com", TRUE));
+   TEST(TestNoProxy("localhost,other.com", "broker.example.com", FALSE));
+   TEST(TestNoProxy("::1", "[::1]", TRUE));
+   TEST(TestNoProxy("[::1]:8443", "[::1]", TRUE));
+   TEST(TestNoProxy("::1", "[::2]", FALSE));
+   TEST(TestNoProxy("fe80::1", "[fe80::1]", TRUE));
+#endif
+
+   TEST(TestSysconfigClock("", ""));
+   TEST(TestSysconfigClock("ZONE=\"America/New_York\"\nUTC=true\n", "America/New_York"));
+   TEST(TestSysconfigClock("TIMEZONE='Europe/Berlin'\n", "Europe/Berlin"));
+   TEST(TestSysconfigClock("  export ZONE=Asia/Tokyo # local\n", "Asia/Tokyo"));
+   TEST(TestSysconfigClock("ZONE=Asia/Tokyo;\n", "Asia/Tokyo"));
+   TEST(TestSysconfigClock("# ZONE=\"Europe/Paris\"\nZONE=\"Europe/Rome\"\n", "Europe/Rome"));
+   TEST(TestSysconfigClock("ZONE=\"Europe/Paris\"\nZONE=\"Europe/Rome\"\n", "Europe/Rome"));
+   TEST(TestSysconfigClock("ZONE=\"Europe/Rome\"\nTIMEZONE=\"Europe/Berlin\"\n", "Europe/Berlin"));
+   TEST(TestSysconfigClock("TIMEZONE=\"Europe/Berlin\"\nZONE=\"Europe/Rome\"\n", "Europe/Berlin"));
+   TEST(TestSysconfigClock("TIMEZONE=\"\"\nZONE=\"Europe/Rome\"\n", "Europe/Rome"));
+   TEST(TestSysconfigClock("DEFAULT_TIMEZONE=\"US/Eastern\"\n", ""));
+
    g_print("Passed %d%% of %d tests.\n",
            100 * (int)((float)passed / (passed + failed)), passed + failed);
 
@@ -204,6 +357,7 @@ main(int argc,     /* IN/UNUSED */
 
 #undef TEST_URL
 #undef TEST_URL_FAIL
+#undef TEST
 }
 
 
@@ -0,0 +1,475 @@
+/*********************************************************
+ * Copyright (C) 2010 VMware, Inc. All rights reserved.
+ *
+ * This file is part of VMware View Open Client.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * testTunnelProxy.c --
+ *
+ *      Test the TunnelProxy message handler table and the order in which
+ *      outgoing chunks are sent.  tunnelProxy.c is included directly so
+ *      its static functions can be driven without a tunnel server.
+ */
+
+#include "tunnelProxy.c"
+
+
+#define TEST_MSG "test-msg"
+
+#define TEST_BULK_CHANNEL 1
+#define TEST_INTERACTIVE_CHANNEL 2
+#define TEST_OTHER_BULK_CHANNEL 3
+
+
+typedef struct TestHandler {
+   const char *name;
+   gboolean handled;                 // value to return
+   struct TestHandler *removeOnCall; // handler to remove when called
+} TestHandler;
+
+
+static GString *testCalls;
+
+
+void
+Panic(const char *fmt, ...)
+{
+   va_list args;
+   va_start(args, fmt);
+   g_logv(NULL, G_LOG_LEVEL_ERROR, fmt, args);
+   va_end(args);
+   abort();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestMsgCb --
+ *
+ *       TunnelProxyMsgHandlerCb that records its call, and optionally
+ *       removes a handler (possibly itself) first.
+ *
+ * Results:
+ *       The TestHandler's handled field.
+ *
+ * Side effects:
+ *       Appends the handler's name to testCalls.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestMsgCb(TunnelProxy *tp,   // IN
+          const char *msgId, // IN/UNUSED
+          const char *body,  // IN/UNUSED
+          int len,           // IN/UNUSED
+          void *userData)    // IN: TestHandler
+{
+   TestHandler *handler = userData;
+
+   g_string_append(testCalls, handler->name);
+   if (handler->removeOnCall) {
+      TunnelProxy_RemoveMsgHandler(tp, TEST_MSG, TestMsgCb,
+                                   handler->removeOnCall);
+      handler->removeOnCall = NULL;
+   }
+   return handler->handled;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestDispatch --
+ *
+ *       Feed a TunnelProxy an incoming message chunk.
+ *
+ * Results:
+ *       The names of the handlers called, in order.  Valid until the next
+ *       call.
+ *
+ * Side effects:
+ *       Runs message handlers.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static const char *
+TestDispatch(TunnelProxy *tp,   // IN
+             const char *msgId) // IN
+{
+   TPChunk chunk;
+
+   memset(&chunk, 0, sizeof chunk);
+   chunk.type = TP_CHUNK_TYPE_MESSAGE;
+   strncpy(chunk.msgId, msgId, TP_MSGID_MAXLEN);
+   chunk.body = "";
+
+   g_string_truncate(testCalls, 0);
+   TunnelProxyHandleInChunk(tp, &chunk);
+   return testCalls->str;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestMsgHandlers --
+ *
+ *       Check adding, removing and dispatching to message handlers,
+ *       including handlers that remove themselves or a later handler
+ *       while the message is being dispatched.
+ *
+ * Results:
+ *       TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestMsgHandlers(void)
+{
+#define CHECK(_msgId, _expected)                                          \
+   if (strcmp(TestDispatch(tp, _msgId), _expected) != 0) {               \
+      g_printerr("Line %d: handlers called \"%s\", expected \"%s\"\n",   \
+                 __LINE__, testCalls->str, _expected);                   \
+      success = FALSE;                                                   \
+   }
+
+   TunnelProxy *tp = TunnelProxy_Create("test", NULL, NULL, NULL, NULL,
+                                        NULL, NULL);
+   TestHandler a = { "a", FALSE, NULL };
+   TestHandler b = { "b", FALSE, NULL };
+   TestHandler c = { "c", FALSE, NULL };
+   gboolean success = TRUE;
+
+   CHECK(TEST_MSG, "");
+
+   /* Handlers run in the order added, and msgIds ignore case. */
+   TunnelProxy_AddMsgHandler(tp, TEST_MSG, TestMsgCb, &a);
+   TunnelProxy_AddMsgHandler(tp, "Test-Msg", TestMsgCb, &b);
+   TunnelProxy_AddMsgHandler(tp, TEST_MSG, TestMsgCb, &c);
+   CHECK("TEST-MSG", "abc");
+   CHECK("other-msg", "");
+
+   /* A handler that handles the message stops the dispatch. */
+   b.handled = TRUE;
+   CHECK(TEST_MSG, "ab");
+   b.handled = FALSE;
+
+   TunnelProxy_RemoveMsgHandler(tp, "TEST-MSG", TestMsgCb, &b);
+   CHECK(TEST_MSG, "ac");
+
+   /* Removing an unknown handler changes nothing. */
+   TunnelProxy_RemoveMsgHandler(tp, TEST_MSG, TestMsgCb, &b);
+   TunnelProxy_RemoveMsgHandler(tp, "other-msg", TestMsgCb, &a);
+   CHECK(TEST_MSG, "ac");
+
+   /* A handler removing itself does not stop the later ones. */
+   TunnelProxy_AddMsgHandler(tp, TEST_MSG, TestMsgCb, &b);
+   a.removeOnCall = &a;
+   CHECK(TEST_MSG, "acb");
+   CHECK(TEST_MSG, "cb");
+
+   /* A handler removed by an earlier one is not called. */
+   c.removeOnCall = &b;
+   CHECK(TEST_MSG, "c");
+   CHECK(TEST_MSG, "c");
+
+   /* The last handler removing itself empties the table entry. */
+   c.removeOnCall = &c;
+   CHECK(TEST_MSG, "c");
+   CHECK(TEST_MSG, "");
+   if (g_hash_table_lookup(tp->msgHandlers, TEST_MSG)) {
+      g_printerr("Handler list left behind for %s\n", TEST_MSG);
+      success = FALSE;
+   }
+
+   TunnelProxy_Free(tp);
+   return success;
+
+#undef CHECK
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestAddChannel --
+ *
+ *       Add a channel with the given DRR quantum, without a socket.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestAddChannel(TunnelProxy *tp,        // IN
+               unsigned int channelId, // IN
+               int quantum)            // IN
+{
+   TPChannel *channel = g_new0(TPChannel, 1);
+
+   channel->tp = tp;
+   channel->channelId = channelId;
+   channel->fd = -1;
+   channel->quantum = quantum;
+   g_hash_table_insert(tp->channels, GUINT_TO_POINTER(channelId), channel);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestQueueData --
+ *
+ *       Queue count full-size data chunks on a channel.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestQueueData(TunnelProxy *tp,        // IN
+              unsigned int channelId, // IN
+              int count)              // IN
+{
+   while (count-- > 0) {
+      TPChunk *chunk = TunnelProxyNewChunk(tp, TP_CHUNK_TYPE_DATA, channelId);
+
+      chunk->body = TunnelProxyNewBody(tp);
+      chunk->size = tp->maxChunkLen;
+      chunk->len = tp->maxChunkLen;
+      memset(chunk->body, 'x', chunk->len);
+      TunnelProxyQueueChunk(tp, chunk);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestSend --
+ *
+ *       Write up to count chunks to the tunnel, as TunnelProxy_HTTPSend
+ *       would, and describe what was sent.
+ *
+ * Results:
+ *       One character per chunk sent: 'M' for a message, 'A' for an ACK,
+ *       or the channel id for data.  Valid until the next call.
+ *
+ * Side effects:
+ *       Moves sent chunks to the needs-ACK queue.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static const char *
+TestSend(TunnelProxy *tp, // IN
+         int count)       // IN
+{
+   g_string_truncate(testCalls, 0);
+   while (count-- > 0 && TunnelProxyWriteNextOutChunk(tp, FALSE)) {
+      TPChunk *chunk = g_queue_peek_tail(tp->queueOutNeedAck);
+
+      g_string_append_c(testCalls, chunk->type == TP_CHUNK_TYPE_DATA ?
+                                   '0' + chunk->channelId : chunk->type);
+   }
+   TunnelProxyBufReset(&tp->writeBuf);
+   return testCalls->str;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestFree --
+ *
+ *       Free a TunnelProxy along with the channels added by TestAddChannel.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TestFree(TunnelProxy *tp) // IN
+{
+   TPChannel *channel;
+
+   while ((channel = g_hash_table_find(tp->channels, TunnelProxyFirstEntry,
+                                       NULL))) {
+      g_hash_table_remove(tp->channels,
+                          GUINT_TO_POINTER(channel->channelId));
+      g_free(channel);
+   }
+   TunnelProxy_Free(tp);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TestChunkOrder --
+ *
+ *       Check that channels share the tunnel by their DRR quantum, that
+ *       newly active interactive channels go ahead of bulk ones, and that
+ *       messages and ACKs go ahead of all channel data.
+ *
+ * Results:
+ *       TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TestChunkOrder(void)
+{
+#define CHECK(_count, _expected)                                          \
+   if (strcmp(TestSend(tp, _count), _expected) != 0) {                   \
+      g_printerr("Line %d: sent \"%s\", expected \"%s\"\n",              \
+                 __LINE__, testCalls->str, _expected);                   \
+      success = FALSE;                                                   \
+   }
+
+   TunnelProxy *tp = TunnelProxy_Create("test", NULL, NULL, NULL, NULL,
+                                        NULL, NULL);
+   int rdpQuantum = TunnelProxyPortQuantum(3389);
+   gboolean success = TRUE;
+
+   if (rdpQuantum != 4 || TunnelProxyPortQuantum(32111) != 2 ||
+       TunnelProxyPortQuantum(9427) != TP_QUANTUM_DEFAULT) {
+      g_printerr("Unexpected port quanta\n");
+      success = FALSE;
+   }
+
+   TestAddChannel(tp, TEST_BULK_CHANNEL, TP_QUANTUM_DEFAULT);
+   TestAddChannel(tp, TEST_INTERACTIVE_CHANNEL, rdpQuantum);
+   TestAddChannel(tp, TEST_OTHER_BULK_CHANNEL, TP_QUANTUM_DEFAULT);
+
+   /*
+    * The interactive channel is queued last but goes first, and then
+    * sends four chunks for each one of the bulk channel.
+    */
+   TestQueueData(tp, TEST_BULK_CHANNEL, 6);
+   TestQueueData(tp, TEST_INTERACTIVE_CHANNEL, 12);
+   CHECK(15, "222212222122221");
+
+   /* Once the interactive channel is drained, the bulk one gets the rest. */
+   CHECK(10, "111");
+   CHECK(1, "");
+
+   /*
+    * A newly active bulk channel waits behind those already queued, but
+    * an interactive one goes ahead of them.
+    */
+   TestQueueData(tp, TEST_BULK_CHANNEL, 2);
+   TestQueueData(tp, TEST_OTHER_BULK_CHANNEL, 2);
+   TestQueueData(tp, TEST_INTERACTIVE_CHANNEL, 1);
+   CHECK(10, "21313");
+
+   /* Messages and ACKs go ahead of queued data. */
+   TestQueueData(tp, TEST_BULK_CHANNEL, 2);
+   TestQueueData(tp, TEST_INTERACTIVE_CHANNEL, 3);
+   CHECK(1, "2");
+   TunnelProxy_SendMsg(tp, TEST_MSG, "body", 4);
+   CHECK(2, "M2");
+   tp->lastChunkIdSeen = tp->lastChunkAckSent + 1;
+   TunnelProxySendChunk(tp, TP_CHUNK_TYPE_ACK, 0, NULL, NULL, 0);
+   CHECK(2, "A2");
+
+   /* Under flow control only messages and ACKs are sent. */
+   tp->flowStopped = TRUE;
+   TunnelProxy_SendMsg(tp, TEST_MSG, "body", 4);
+   CHECK(10, "M");
+   tp->flowStopped = FALSE;
+   CHECK(10, "11");
+
+   TestFree(tp);
+   return success;
+
+#undef CHECK
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *       Main function.
+ *
+ * Results:
+ *       Number of failed tests.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,     /* IN/UNUSED */
+     char *argv[]) /* IN/UNUSED */
+{
+#define TEST(name, expr)                         \
+   if (expr) {                                   \
+      g_print(   "    PASSED: %s\n", name);      \
+      passed++;                                  \
+   } else {                                      \
+      g_printerr("!!! FAILED: %s\n", name);      \
+      failed++;                                  \
+   }
+
+   int passed = 0;
+   int failed = 0;
+
+   testCalls = g_string_new("");
+
+   TEST("message handlers", TestMsgHandlers());
+   TEST("outgoing chunk order", TestChunkOrder());
+
+   g_string_free(testCalls, TRUE);
+
+   g_print("Passed %d of %d tests.\n", passed, passed + failed);
+
+   return failed;
+
+#undef TEST
+}
@@ -66,7 +66,11 @@
 
 #define APPNAME "vmware-view-tunnel"
 #define TMPBUFSIZE 1024 * 16 /* arbitrary */
+#define SENDBATCHSIZE 4 * TMPBUFSIZE /* Output gathered per socket write */
 #define BLOCKING_TIMEOUT_MS 1000 * 3 /* 3 seconds, arbitrary */
+#define RESOLVE_CACHE_TTL_SEC 60 /* getaddrinfo does not report the TTL */
+#define CONNECT_ATTEMPT_DELAY_US 250 * 1000 /* RFC 6555 suggests 150-250ms */
+#define CONNECT_ATTEMPT_POLL_FLAGS (POLL_FLAG_WRITE | POLL_FLAG_SOCKET)
 
 static char *gServerArg = NULL;
 static char *gConnectionIdArg = NULL;
@@ -75,17 +79,78 @@ static TunnelProxy *gTunnelProxy = NULL;
 static int gFd = -1;
 static gboolean gRecvHeaderDone = FALSE;
 static GByteArray *gRecvBuf = NULL;
+static GByteArray *gSendBuf = NULL; /* Output the socket has not taken yet */
+static guint gSendOffset = 0;       /* Bytes of gSendBuf already written */
+
+/* The socket IO callback currently registered for gFd, see TunnelSocketWatch */
+static PollerFunction gSocketCb = NULL;
+static gboolean gSocketWriteWatched = FALSE;
+
+#define SOCKET_READ_POLL_FLAGS (POLL_FLAG_READ | POLL_FLAG_SOCKET)
+#define SOCKET_WRITE_POLL_FLAGS (POLL_FLAG_WRITE | POLL_FLAG_SOCKET)
+
+/* Resolver results, reused by reconnects within RESOLVE_CACHE_TTL_SEC */
+static struct {
+   char *host;
+   int port;
+   struct addrinfo *addrs;
+   GTimeVal resolved;
+} gResolveCache;
+
+/* A non-blocking connect in progress, see TunnelConnectStart */
+typedef struct TunnelConnectAttempt {
+   int fd;
+} TunnelConnectAttempt;
+
+static struct {
+   struct addrinfo **addrs; /* In the order to try, owned by gResolveCache */
+   guint numAddrs;
+   guint nextAddr;
+   int port;
+   gboolean viaProxy;
+   GSList *attempts;
+   gboolean timerSet;
+} gConnect;
+
+/* A getaddrinfo call running on a resolver thread, see TunnelResolveStart */
+typedef struct TunnelResolveRequest {
+   char *host;
+   int port;
+   struct addrinfo *addrs; /* Set by the thread */
+   int err;                /* Set by the thread */
+   gboolean done;          /* The thread has finished, under gResolveLock */
+   gboolean abandoned;     /* Nobody wants the result, under gResolveLock */
+   int wakeFds[2];         /* The thread writes a byte to wakeFds[1] */
+} TunnelResolveRequest;
+
+static TunnelResolveRequest *gResolving = NULL;
+static GStaticMutex gResolveLock = G_STATIC_MUTEX_INIT;
 
 static SSL_CTX *gSslCtx = NULL;
 static SSL *gSsl = NULL;
+/*
+ * Memory BIOs between gSsl and the socket.  If the
+ * VMWARE_VIEW_TUNNEL_DIRECT_SSL environment variable is set, gSsl runs
+ * directly on the socket instead and these stay NULL.
+ */
 static BIO *gInBio = NULL;
 static BIO *gOutBio = NULL;
+static gboolean gSslWantWrite = FALSE; /* gSsl needs the socket writable */
+/* A direct SSL_write of gSendBuf needs the socket readable to go on */
+static gboolean gSslWriteWantRead = FALSE;
 
 static void TunnelConnect(void);
+static void TunnelSocketReadableCb(void *userData);
+static void TunnelSocketWritableCb(void *userData);
+static void TunnelConnectAttemptCb(void *clientData);
+static void TunnelConnectTimerCb(void *clientData);
+static void TunnelResolveFlush(void);
+static void TunnelResolveDoneCb(void *clientData);
 static void TunnelSocketConnectCb(int fd, void *userData);
 static void TunnelSocketProxyRecvCb(void *);
 static void TunnelSocketRecvCb(void *);
 static void TunnelSocketSslHandshakeRecvCb(void *);
+static void TunnelSendNeededCb(TunnelProxy *tp, void *userData);
 
 LogLevelState logLevelState;
 const int8 *logLevelPtr = logLevelState.initialLevels;
@@ -130,6 +195,205 @@ Panic(const char *fmt, ...)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelSocketSendPending --
+ *
+ *      Check whether there is output the socket has not accepted yet.
+ *
+ * Results:
+ *      TRUE if TunnelSocketFlush has bytes left to write.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TunnelSocketSendPending(void)
+{
+   return gSendBuf && gSendOffset < gSendBuf->len;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelSocketUnwatchWrite --
+ *
+ *      Stop waiting for the tunnel socket to become writable.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelSocketUnwatchWrite(void)
+{
+   if (gSocketWriteWatched) {
+      Poll_CallbackRemove(POLL_CS_MAIN, SOCKET_WRITE_POLL_FLAGS,
+                          TunnelSocketWritableCb, GINT_TO_POINTER(gFd),
+                          POLL_DEVICE);
+      gSocketWriteWatched = FALSE;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelSocketUnwatch --
+ *
+ *      Remove the IO callbacks registered on the tunnel socket by
+ *      TunnelSocketWatch, if any.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelSocketUnwatch(void)
+{
+   if (gSocketCb) {
+      Poll_CallbackRemove(POLL_CS_MAIN, SOCKET_READ_POLL_FLAGS,
+                          TunnelSocketReadableCb, GINT_TO_POINTER(gFd),
+                          POLL_DEVICE);
+      gSocketCb = NULL;
+   }
+   TunnelSocketUnwatchWrite();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelSocketWatchWrite --
+ *
+ *      Also call the tunnel socket's IO callback when the socket becomes
+ *      writable.  This is a separate, write-only Poll callback: Poll does
+ *      not allow READ and WRITE on one callback.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelSocketWatchWrite(int fd) // IN
+{
+   if (!gSocketWriteWatched) {
+      Poll_Callback(POLL_CS_MAIN, SOCKET_WRITE_POLL_FLAGS,
+                    TunnelSocketWritableCb, GINT_TO_POINTER(fd), POLL_DEVICE,
+                    fd, NULL);
+      gSocketWriteWatched = TRUE;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelSocketWatch --
+ *
+ *      Set the IO callback for the tunnel socket, replacing any previous
+ *      one.  The callback fires once, when the socket is readable, or
+ *      also when it is writable if output is pending, so every callback
+ *      passed here must start by calling TunnelSocketFlush.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelSocketWatch(PollerFunction cb, // IN
+                  int fd)            // IN
+{
+   gboolean wantWrite = (TunnelSocketSendPending() && !gSslWriteWantRead) ||
+                        gSslWantWrite;
+
+   gSslWantWrite = FALSE;
+
+   TunnelSocketUnwatch();
+   Poll_Callback(POLL_CS_MAIN, SOCKET_READ_POLL_FLAGS, TunnelSocketReadableCb,
+                 GINT_TO_POINTER(fd), POLL_DEVICE, fd, NULL);
+   gSocketCb = cb;
+   if (wantWrite) {
+      TunnelSocketWatchWrite(fd);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelSocketReadableCb --
+ * TunnelSocketWritableCb --
+ *
+ *      Poll callbacks for the tunnel socket.  Either one firing uses up
+ *      the TunnelSocketWatch registration: the other is removed, and the
+ *      IO callback is called, which watches again if it wants more.
+ *
+ *      These are separate functions so that poll implementations that
+ *      key callbacks on function and data do not merge them.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelSocketReadableCb(void *userData) // IN
+{
+   PollerFunction cb = gSocketCb;
+
+   /* The READ callback was one-shot; only the WRITE one is left. */
+   gSocketCb = NULL;
+   TunnelSocketUnwatch();
+   if (cb) {
+      cb(userData);
+   }
+}
+
+
+static void
+TunnelSocketWritableCb(void *userData) // IN
+{
+   PollerFunction cb = gSocketCb;
+
+   /* The WRITE callback was one-shot; only the READ one is left. */
+   gSocketWriteWatched = FALSE;
+   TunnelSocketUnwatch();
+   if (cb) {
+      cb(userData);
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -153,13 +417,44 @@ TunnelDisconnectCb(TunnelProxy *tp,             // IN
                    const char *reason,          // IN
                    void *userData)              // IN: not used
 {
-   TunnelProxy_RemovePoll(TunnelSocketProxyRecvCb, GINT_TO_POINTER(gFd));
-   TunnelProxy_RemovePoll(TunnelSocketRecvCb, GINT_TO_POINTER(gFd));
-   TunnelProxy_RemovePoll(TunnelSocketSslHandshakeRecvCb,
-                          GINT_TO_POINTER(gFd));
+   TunnelProxyStats stats;
+
+   TunnelProxy_GetStats(tp, &stats);
+   g_debug("Tunnel flow control: window %u chunks, %u unacknowledged, "
+           "%u stops, RTT %d/%d ms, %d KB/s.", stats.flowWindow,
+           stats.unackedChunks, stats.flowStops, (int)(stats.srtt / 1000),
+           (int)(stats.minRtt / 1000), (int)(stats.deliveryRate / 1024));
+   if (stats.channelBytesRead > 0) {
+      g_debug("Tunnel channel reads: %" G_GUINT64_FORMAT " KB in %"
+              G_GUINT64_FORMAT " wakeups, %" G_GUINT64_FORMAT " wakeups/MB.",
+              stats.channelBytesRead / 1024, stats.channelWakeups,
+              stats.channelWakeups * 1024 * 1024 / stats.channelBytesRead);
+   }
+   g_debug("Tunnel chunks: %u live, %u peak, %" G_GUINT64_FORMAT
+           " allocated, %" G_GUINT64_FORMAT " reused.", stats.liveChunks,
+           stats.liveChunksMax, stats.poolAllocs, stats.poolReuses);
+
+   TunnelSocketUnwatch();
+
+   if (gFd >= 0) {
+      close(gFd);
+      gFd = -1;
+   }
+
+   if (gSsl) {
+      /* Frees the BIOs too.  A new SSL session is set up on reconnect. */
+      SSL_free(gSsl);
+      gSsl = NULL;
+      gInBio = NULL;
+      gOutBio = NULL;
+      gSslWantWrite = FALSE;
+      gSslWriteWantRead = FALSE;
+   }
 
-   close(gFd);
-   gFd = -1;
+   if (gSendBuf) {
+      g_byte_array_set_size(gSendBuf, 0);
+      gSendOffset = 0;
+   }
 
    gRecvHeaderDone = FALSE;
    if (reconnectSecret) {
@@ -175,6 +470,77 @@ TunnelDisconnectCb(TunnelProxy *tp,             // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelSocketSslRead --
+ *
+ *      Read all available plaintext from the SSL object, decrypting it
+ *      directly onto the end of dynBuf.
+ *
+ * Results:
+ *      Byte count appended to dynBuf, or -1 if the read failed.
+ *
+ * Side effects:
+ *      Calls TunnelDisconnectCb on read error.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+TunnelSocketSslRead(SSL *ssl,           // IN
+                    GByteArray *dynBuf) // IN
+{
+   int origBufSize = dynBuf->len;
+   char *reason = NULL;
+
+   while (TRUE) {
+      guint oldLen = dynBuf->len;
+      int readLen;
+      int sslErr;
+
+      g_byte_array_set_size(dynBuf, oldLen + TMPBUFSIZE);
+      readLen = SSL_read(ssl, dynBuf->data + oldLen, TMPBUFSIZE);
+      DEBUG_IO(("Read %d bytes from SSL", readLen));
+      g_byte_array_set_size(dynBuf, oldLen + MAX(readLen, 0));
+      if (readLen > 0) {
+         continue;
+      }
+
+      sslErr = SSL_get_error(ssl, readLen);
+      switch (sslErr) {
+      case SSL_ERROR_WANT_WRITE:
+         gSslWantWrite = TRUE;
+         return dynBuf->len - origBufSize;
+      case SSL_ERROR_WANT_READ:
+         /*
+          * Whatever a stalled SSL_write in TunnelSocketFlush was waiting
+          * for has been read now, so let it retry once the socket is
+          * writable.
+          */
+         gSslWriteWantRead = FALSE;
+         return dynBuf->len - origBufSize;
+      case SSL_ERROR_ZERO_RETURN:
+         reason = g_strdup(_("SSL connection was shut down while reading"));
+         break;
+      case SSL_ERROR_SYSCALL:
+         reason = g_strdup_printf(
+            _("Error reading from tunnel HTTP socket: %s"),
+            readLen == 0 ? _("Connection closed") : strerror(errno));
+         break;
+      default:
+         ERR_print_errors_fp(stderr);
+         reason = g_strdup_printf(_("SSL error while reading: %d"), sslErr);
+         break;
+      }
+
+      TunnelDisconnectCb(gTunnelProxy, NULL, reason, NULL);
+      g_free(reason);
+      return -1;
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -205,6 +571,11 @@ TunnelSocketRead(int fd,              // IN
    ssize_t recvLen;
    char *reason = NULL;
 
+   if (ssl && !bio) {
+      /* The SSL object reads the socket itself. */
+      return TunnelSocketSslRead(ssl, dynBuf);
+   }
+
    do {
 #ifdef __MINGW32__
       recvLen = recv(fd, tmpBuf, sizeof(tmpBuf), 0);
@@ -258,27 +629,8 @@ TunnelSocketRead(int fd,              // IN
       BIO_flush(bio);
    }
 
-   if (ssl) {
-      while (TRUE) {
-         int readLen = SSL_read(ssl, tmpBuf, sizeof(tmpBuf));
-         DEBUG_IO(("Read %d bytes from SSL", readLen));
-         if (readLen > 0) {
-            g_byte_array_append(dynBuf, tmpBuf, readLen);
-         } else if (readLen == 0) {
-            TunnelDisconnectCb(gTunnelProxy, NULL,
-                               _("SSL connection was shut down while reading"), NULL);
-            return -1;
-         } else {
-             readLen = SSL_get_error(ssl, readLen);
-             if (readLen == SSL_ERROR_WANT_READ) {
-                 break;
-             }
-             // XXX: Handle errors.
-             ERR_print_errors_fp(stderr);
-             g_printerr("SSL error while reading: %d\n", readLen);
-             g_assert_not_reached();
-         }
-      }
+   if (ssl && TunnelSocketSslRead(ssl, dynBuf) < 0) {
+      return -1;
    }
 
    return dynBuf ? dynBuf->len - origBufSize : 0;
@@ -288,43 +640,36 @@ TunnelSocketRead(int fd,              // IN
 /*
  *-----------------------------------------------------------------------------
  *
- * TunnelSocketWrite --
- *
- *      Write bytes to our IO channel.
- *
- *      If ssl is not NULL, they will be written to the SSL object.
- *
- *      If bio is not NULL, bytes will be read from it and written to
- *      the IO channel.
+ * TunnelSocketQueue --
  *
- *      If len is < 0, a NIL-terminated string is assumed.
+ *      Append bytes to the socket output buffer without writing them.
  *
- *      Note that this does a blocking/buffered write.
+ *      If ssl and bio are not NULL, they will be written to the SSL object,
+ *      and all bytes pending in bio are moved to the output buffer.  If
+ *      only bio is given, its pending bytes are moved.  Otherwise bytes
+ *      are appended as they are, to be encrypted by TunnelSocketFlush if
+ *      gSsl runs directly on the socket.
  *
  * Results:
- *      Number of bytes written.
+ *      FALSE if the SSL connection has been shut down.
  *
  * Side effects:
- *      None
+ *      Calls TunnelDisconnectCb on SSL shutdown.
  *
  *-----------------------------------------------------------------------------
  */
 
-static int
-TunnelSocketWrite(int fd,              // IN
-                  SSL *ssl,            // IN/OPT
+static gboolean
+TunnelSocketQueue(SSL *ssl,            // IN/OPT
                   BIO *bio,            // IN/OPT
                   const char *bytes,   // IN/OPT
                   gssize len)          // IN/OPT
 {
-   GByteArray *buf = NULL;
-   char *reason = NULL;
-
-   if (len < 0) {
-      len = bytes ? strlen(bytes) : 0;
+   if (!gSendBuf) {
+      gSendBuf = g_byte_array_sized_new(SENDBATCHSIZE + TMPBUFSIZE);
    }
 
-   if (ssl && bytes) {
+   if (ssl && bio && bytes) {
       int sslWritten = 0;
       DEBUG_IO(("Writing %d bytes to ssl...", (int)len));
       sslWritten = SSL_write(ssl, bytes, len);
@@ -334,7 +679,7 @@ TunnelSocketWrite(int fd,              // IN
          TunnelDisconnectCb(gTunnelProxy, NULL,
                             _("SSL connect was shut down while writing"),
                             NULL);
-         return -1;
+         return FALSE;
       } else {
          // XXX: handle errors.
          ERR_print_errors_fp(stderr);
@@ -343,88 +688,149 @@ TunnelSocketWrite(int fd,              // IN
    }
 
    if (bio) {
-      char tmpBuf[TMPBUFSIZE];
-      int bytesRead = 0;
-      buf = g_byte_array_new();
-      while (TRUE) {
-         bytesRead = BIO_read(bio, tmpBuf, sizeof(tmpBuf));
+      /* Read the ciphertext straight into the output buffer. */
+      int pending = BIO_ctrl_pending(bio);
+      if (pending > 0) {
+         guint oldLen = gSendBuf->len;
+         int bytesRead;
+
+         g_byte_array_set_size(gSendBuf, oldLen + pending);
+         bytesRead = BIO_read(bio, gSendBuf->data + oldLen, pending);
          DEBUG_IO(("Read %d bytes from BIO.", bytesRead));
-         if (bytesRead == 0) {
-            break;
-         } else if (bytesRead < 0) {
-            if (BIO_should_retry(bio)) {
+         g_assert(bytesRead == pending);
+      }
+   } else if (bytes) {
+      g_byte_array_append(gSendBuf, (const guint8 *)bytes, len);
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelSocketFlush --
+ *
+ *      Write as much of the socket output buffer as the socket takes
+ *      without blocking.  If output is left over, the socket callback is
+ *      registered again to also fire when the socket becomes writable.
+ *
+ *      When gSsl runs on the socket, SSL_write may instead need to read
+ *      (e.g. during renegotiation).  Then only the read callback stays
+ *      registered, and the write is retried from there, since every
+ *      socket callback starts by flushing.
+ *
+ * Results:
+ *      FALSE if writing failed and the tunnel was disconnected.
+ *
+ * Side effects:
+ *      Calls TunnelDisconnectCb on write error.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TunnelSocketFlush(int fd) // IN
+{
+   char *reason = NULL;
+
+   gSslWriteWantRead = FALSE;
+
+   while (TunnelSocketSendPending()) {
+      ssize_t bytesWritten;
+      const char *bytes = (const char *)gSendBuf->data + gSendOffset;
+      size_t toWrite = gSendBuf->len - gSendOffset;
+
+      if (gSsl && !gOutBio) {
+         /* The send buffer holds plaintext for gSsl to encrypt and send. */
+         bytesWritten = SSL_write(gSsl, bytes, toWrite);
+         if (bytesWritten <= 0) {
+            int sslErr = SSL_get_error(gSsl, bytesWritten);
+            if (sslErr == SSL_ERROR_WANT_READ) {
+               DEBUG_IO(("SSL write waiting for the socket to be readable."));
+               gSslWriteWantRead = TRUE;
+               break;
+            } else if (sslErr == SSL_ERROR_WANT_WRITE) {
                break;
             }
-            // XXX: handle error.
             ERR_print_errors_fp(stderr);
-            g_assert_not_reached();
+            reason = g_strdup_printf(_("SSL error while writing: %d\n"),
+                                     sslErr);
+            TunnelDisconnectCb(gTunnelProxy, NULL, reason, NULL);
+            g_free(reason);
+            return FALSE;
          }
-         g_byte_array_append(buf, tmpBuf, bytesRead);
+         gSendOffset += bytesWritten;
+         continue;
       }
-      bytes = buf->data;
-      len = buf->len;
-   }
 
-   if (bytes) {
-      ssize_t bytesWritten;
-      size_t toWrite = len;
-      while (toWrite > 0) {
 #ifdef __MINGW32__
-         bytesWritten = send(fd, bytes, toWrite, 0);
-         if (bytesWritten == SOCKET_ERROR) {
-            int error = WSAGetLastError();
-            if (error == WSAEWOULDBLOCK) {
-               errno = EWOULDBLOCK;
-            } else {
-               reason = g_strdup_printf(
-                  _("Error writing to tunnel HTTP socket: %d\n"),
-                  WSAGetLastError());
-               TunnelDisconnectCb(gTunnelProxy, NULL, reason, NULL);
-               return -1;
-            }
-            bytesWritten = -1;
+      bytesWritten = send(fd, bytes, toWrite, 0);
+      if (bytesWritten == SOCKET_ERROR) {
+         int error = WSAGetLastError();
+         if (error == WSAEWOULDBLOCK) {
+            errno = EWOULDBLOCK;
+         } else {
+            reason = g_strdup_printf(
+               _("Error writing to tunnel HTTP socket: %d\n"),
+               WSAGetLastError());
+            TunnelDisconnectCb(gTunnelProxy, NULL, reason, NULL);
+            g_free(reason);
+            return FALSE;
          }
+         bytesWritten = -1;
+      }
 #else
-         bytesWritten = write(fd, bytes, toWrite);
+      bytesWritten = write(fd, bytes, toWrite);
 #endif
-         if (bytesWritten < 0) {
-            if (errno != EWOULDBLOCK &&
-                errno != EAGAIN &&
-                errno != EINTR) {
-               reason = g_strdup_printf(
-                  _("Error writing to tunnel HTTP socket: %s\n"), strerror(errno));
-               TunnelDisconnectCb(gTunnelProxy, NULL, reason, NULL);
-               return -1;
-            }
-         } else {
-            toWrite -= bytesWritten;
-            bytes += bytesWritten;
+      if (bytesWritten < 0) {
+         if (errno == EINTR) {
+            continue;
+         } else if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            break;
          }
+         reason = g_strdup_printf(
+            _("Error writing to tunnel HTTP socket: %s\n"), strerror(errno));
+         TunnelDisconnectCb(gTunnelProxy, NULL, reason, NULL);
+         g_free(reason);
+         return FALSE;
       }
+      gSendOffset += bytesWritten;
    }
 
-   if (buf) {
-      g_byte_array_free(buf, TRUE);
+   if (!TunnelSocketSendPending()) {
+      if (gSendBuf) {
+         g_byte_array_set_size(gSendBuf, 0);
+      }
+      gSendOffset = 0;
+      TunnelSocketUnwatchWrite();
+   } else if (gSslWriteWantRead) {
+      TunnelSocketUnwatchWrite();
+   } else if (gSocketCb && !gSocketWriteWatched) {
+      DEBUG_IO(("Socket full, waiting for it to become writable."));
+      TunnelSocketWatchWrite(fd);
    }
 
-   return len;
+   return TRUE;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * TunnelSocketParseHeader --
+ * TunnelSocketWrite --
  *
- *      Simple HTTP header parsing.  Just looks in the DynBuf for the "\r\n\r\n"
- *      that terminates an HTTP header from the body. If found, the header is
- *      removed from the front of the DynBuf.
+ *      Write bytes to our IO channel, as TunnelSocketQueue followed by
+ *      TunnelSocketFlush.
  *
- *      XXX: Parse response header, instead of assuming server/proxy will kill
- *      connection on failure.
+ *      If len is < 0, a NIL-terminated string is assumed.
+ *
+ *      Output the socket does not take right away is kept and written
+ *      once the socket becomes writable, so this never blocks.
  *
  * Results:
- *      True if headers have been received, false otherwise.
+ *      Number of bytes accepted, or -1 on error.
  *
  * Side effects:
  *      None
@@ -432,12 +838,52 @@ TunnelSocketWrite(int fd,              // IN
  *-----------------------------------------------------------------------------
  */
 
-static gboolean
-TunnelSocketParseHeader(GByteArray *recvBuf) // IN
-{
-   char *dataStart;
-
-   if (recvBuf->len == 0) {
+static int
+TunnelSocketWrite(int fd,              // IN
+                  SSL *ssl,            // IN/OPT
+                  BIO *bio,            // IN/OPT
+                  const char *bytes,   // IN/OPT
+                  gssize len)          // IN/OPT
+{
+   if (len < 0) {
+      len = bytes ? strlen(bytes) : 0;
+   }
+
+   if (!TunnelSocketQueue(ssl, bio, bytes, len) || !TunnelSocketFlush(fd)) {
+      return -1;
+   }
+
+   return len;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelSocketParseHeader --
+ *
+ *      Simple HTTP header parsing.  Just looks in the DynBuf for the "\r\n\r\n"
+ *      that terminates an HTTP header from the body. If found, the header is
+ *      removed from the front of the DynBuf.
+ *
+ *      XXX: Parse response header, instead of assuming server/proxy will kill
+ *      connection on failure.
+ *
+ * Results:
+ *      True if headers have been received, false otherwise.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TunnelSocketParseHeader(GByteArray *recvBuf) // IN
+{
+   char *dataStart;
+
+   if (recvBuf->len == 0) {
       return FALSE;
    }
 
@@ -461,7 +907,7 @@ TunnelSocketParseHeader(GByteArray *recvBuf) // IN
  *
  *      Input callback while we are doing an ssl handshake.  This is
  *      called when we have data from the server to read; we read it
- *      into the ssl bio, and then continue with the handshake.
+ *      into the ssl bio, if any, and then continue with the handshake.
  *
  * Results:
  *      FALSE to remove this handler (it's added by
@@ -478,14 +924,19 @@ TunnelSocketSslHandshakeRecvCb(void *userData)      // IN
 {
    int fd = GPOINTER_TO_INT(userData);
 
+   if (!TunnelSocketFlush(fd)) {
+      return;
+   }
+
    /*
-    * Don't pass gSsl here since we haven't done the handshake yet.
+    * Don't pass gSsl here since we haven't done the handshake yet.  Without
+    * memory BIOs, SSL_do_handshake reads the socket itself.
     */
-   if (TunnelSocketRead(fd, NULL, gInBio, NULL) >= 0) {
+   if (!gInBio || TunnelSocketRead(fd, NULL, gInBio, NULL) >= 0) {
       // Call the connect cb again to continue the handshake.
       TunnelSocketConnectCb(fd, NULL);
    } else {
-      TunnelProxy_AddPoll(TunnelSocketSslHandshakeRecvCb, userData, fd);
+      TunnelSocketWatch(TunnelSocketSslHandshakeRecvCb, fd);
    }
 }
 
@@ -495,9 +946,10 @@ TunnelSocketSslHandshakeRecvCb(void *userData)      // IN
  *
  * TunnelSocketRecvCb --
  *
- *      AsyncSocket data received callback.  Reads available data from the
- *      tunnel socket, and pushes into the TunnelProxy using
- *      TunnelProxy_HTTPRecv.  Ignores response headers.
+ *      AsyncSocket IO callback.  Writes pending output, asking the
+ *      TunnelProxy for more once it has all been written, then reads
+ *      available data from the tunnel socket, and pushes into the
+ *      TunnelProxy using TunnelProxy_HTTPRecv.  Ignores response headers.
  *
  * Results:
  *      None
@@ -513,6 +965,19 @@ TunnelSocketRecvCb(void *userData)      // IN
 {
    int fd = GPOINTER_TO_INT(userData);
 
+   if (TunnelSocketSendPending()) {
+      if (!TunnelSocketFlush(fd)) {
+         return;
+      }
+      if (!TunnelSocketSendPending()) {
+         TunnelSendNeededCb(gTunnelProxy, NULL);
+         if (gFd != fd) {
+            /* Sending failed and the tunnel disconnected. */
+            return;
+         }
+      }
+   }
+
    if (TunnelSocketRead(fd, gSsl, gInBio, gRecvBuf) < 0) {
       return;
    }
@@ -529,7 +994,7 @@ TunnelSocketRecvCb(void *userData)      // IN
       g_byte_array_set_size(gRecvBuf, 0);
    }
 
-   TunnelProxy_AddPoll(TunnelSocketRecvCb, userData, fd);
+   TunnelSocketWatch(TunnelSocketRecvCb, fd);
 }
 
 
@@ -557,12 +1022,16 @@ TunnelSocketProxyRecvCb(void *userData)      // IN
 {
    int fd = GPOINTER_TO_INT(userData);
 
+   if (!TunnelSocketFlush(fd)) {
+      return;
+   }
+
    if (TunnelSocketRead(fd, gSsl, gInBio, gRecvBuf) < 0) {
       return;
    }
 
    if (!TunnelSocketParseHeader(gRecvBuf)) {
-      TunnelProxy_AddPoll(TunnelSocketProxyRecvCb, userData, fd);
+      TunnelSocketWatch(TunnelSocketProxyRecvCb, fd);
       return;
    }
 
@@ -580,10 +1049,13 @@ TunnelSocketProxyRecvCb(void *userData)      // IN
  *
  * TunnelSendNeededCb --
  *
- *      TunnelProxy send needed callback.  Fetches the available HTTP chunk data
- *      and performs a blocking sends over the AsyncSocket.
+ *      TunnelProxy send needed callback.  Gathers up to SENDBATCHSIZE bytes
+ *      of HTTP chunk data, encrypting it a TMPBUFSIZE record at a time, and
+ *      writes it all to the socket at once.
  *
- *      XXX: Use async send, and heap-allocated send buffer?
+ *      Nothing is fetched while earlier output is still waiting for the
+ *      socket; TunnelSocketRecvCb calls back in once it has been written.
+ *      Until then the data stays queued in the TunnelProxy.
  *
  * Results:
  *      None
@@ -599,15 +1071,27 @@ TunnelSendNeededCb(TunnelProxy *tp, // IN
                    void *userData)  // IN: not used
 {
    char sendBuf[TMPBUFSIZE];
-   int sendSize = TMPBUFSIZE;
+   int sendSize;
 
-   do {
-      sendSize = TMPBUFSIZE;
-      TunnelProxy_HTTPSend(gTunnelProxy, sendBuf, &sendSize, TRUE);
-      if (sendSize == 0) {
+   while (!TunnelSocketSendPending()) {
+      gboolean gathered = FALSE;
+
+      do {
+         sendSize = TMPBUFSIZE;
+         TunnelProxy_HTTPSend(gTunnelProxy, sendBuf, &sendSize, TRUE);
+         if (sendSize == 0) {
+            break;
+         }
+         if (!TunnelSocketQueue(gSsl, gOutBio, sendBuf, sendSize)) {
+            return;
+         }
+         gathered = TRUE;
+      } while (gSendBuf->len < SENDBATCHSIZE);
+
+      if (!gathered || !TunnelSocketFlush(gFd)) {
          break;
       }
-   } while (0 < TunnelSocketWrite(gFd, gSsl, gOutBio, sendBuf, sendSize));
+   }
 }
 
 
@@ -651,6 +1135,11 @@ TunnelSocketSslHandshake(int fd,   /* IN */
       g_assert(rv < 0);
       switch (SSL_get_error(ssl, rv)) {
       case SSL_ERROR_WANT_WRITE:
+         if (!gOutBio) {
+            gSslWantWrite = TRUE;
+            TunnelSocketWatch(TunnelSocketSslHandshakeRecvCb, fd);
+            break;
+         }
          TunnelSocketWrite(fd, NULL, gOutBio, NULL, 0);
          goto doHandshake;
       case SSL_ERROR_WANT_READ:
@@ -661,8 +1150,7 @@ TunnelSocketSslHandshake(int fd,   /* IN */
           */
          TunnelSocketWrite(fd, NULL, gOutBio, NULL, 0);
          DEBUG_IO(("Waiting for input..."));
-         TunnelProxy_AddPoll(TunnelSocketSslHandshakeRecvCb, GINT_TO_POINTER(fd),
-                        fd);
+         TunnelSocketWatch(TunnelSocketSslHandshakeRecvCb, fd);
          break;
       default:
          g_printerr("Unhandled SSL handshake error: %d\n", rv);
@@ -730,12 +1218,23 @@ TunnelSocketConnectCb(int fd,              // IN
          g_assert(!gInBio);
          g_assert(!gOutBio);
 
-         gInBio = BIO_new(BIO_s_mem());
-         gOutBio = BIO_new(BIO_s_mem());
-
          gSsl = SSL_new(gSslCtx);
-         SSL_set_mode(gSsl, SSL_MODE_AUTO_RETRY);
-         SSL_set_bio(gSsl, gInBio, gOutBio);
+         if (g_getenv("VMWARE_VIEW_TUNNEL_DIRECT_SSL")) {
+            /*
+             * Decrypt straight from the socket.  Writes may stop part way
+             * when the socket fills, and are retried from gSendBuf, which
+             * may have moved by then.
+             */
+            SSL_set_mode(gSsl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                               SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+            SSL_set_fd(gSsl, fd);
+         } else {
+            gInBio = BIO_new(BIO_s_mem());
+            gOutBio = BIO_new(BIO_s_mem());
+
+            SSL_set_mode(gSsl, SSL_MODE_AUTO_RETRY);
+            SSL_set_bio(gSsl, gInBio, gOutBio);
+         }
          SSL_set_connect_state(gSsl);
       }
 
@@ -769,7 +1268,7 @@ TunnelSocketConnectCb(int fd,              // IN
 
    /* Kick off channel reading */
    gRecvBuf = g_byte_array_new();
-   TunnelProxy_AddPoll(TunnelSocketRecvCb, GINT_TO_POINTER(fd), fd);
+   TunnelSocketWatch(TunnelSocketRecvCb, fd);
 
    {
       /* Find the local address */
@@ -856,7 +1355,7 @@ TunnelSocketProxyConnectCb(int fd,         /* IN */
 
    /* Kick off channel reading */
    gRecvBuf = g_byte_array_new();
-   TunnelProxy_AddPoll(TunnelSocketProxyRecvCb, GINT_TO_POINTER(fd), fd);
+   TunnelSocketWatch(TunnelSocketProxyRecvCb, fd);
 
    g_free(serverUrl);
    g_free(host);
@@ -867,12 +1366,14 @@ TunnelSocketProxyConnectCb(int fd,         /* IN */
 /*
  *-----------------------------------------------------------------------------
  *
- * TunnelConnectSocket --
+ * TunnelResolveCached --
  *
- *      Create a GIOChannel connected to a given hostname and port.
+ *      Look up the previous resolver result for hostname and port, if it
+ *      is less than RESOLVE_CACHE_TTL_SEC old, so that reconnecting after
+ *      a reset does not wait on DNS again.
  *
  * Results:
- *      A new GIOChannel or NULL if there was an error.
+ *      The address list, owned by the cache, or NULL if there is none.
  *
  * Side effects:
  *      None
@@ -880,30 +1381,338 @@ TunnelSocketProxyConnectCb(int fd,         /* IN */
  *-----------------------------------------------------------------------------
  */
 
-static int
-TunnelConnectSocket(const char *hostname, // IN
+static struct addrinfo *
+TunnelResolveCached(const char *hostname, // IN
                     int port)             // IN
 {
-   struct addrinfo *addrs = NULL;
-   struct addrinfo *addr = NULL;
+   GTimeVal now;
+
+   g_get_current_time(&now);
+   if (gResolveCache.addrs && gResolveCache.port == port &&
+       g_ascii_strcasecmp(gResolveCache.host, hostname) == 0 &&
+       now.tv_sec - gResolveCache.resolved.tv_sec < RESOLVE_CACHE_TTL_SEC) {
+      return gResolveCache.addrs;
+   }
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelResolveRequestFree --
+ *
+ *      Free a resolver request and whatever result it still holds.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Closes the request's wakeup pipe.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelResolveRequestFree(TunnelResolveRequest *req) // IN
+{
+   if (req->addrs) {
+      freeaddrinfo(req->addrs);
+   }
+   if (req->wakeFds[0] >= 0) {
+      close(req->wakeFds[0]);
+   }
+   if (req->wakeFds[1] >= 0) {
+      close(req->wakeFds[1]);
+   }
+   g_free(req->host);
+   g_free(req);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelResolveThread --
+ *
+ *      Resolver thread body.  Runs the blocking getaddrinfo call, then
+ *      wakes the main loop through the request's pipe, or frees the
+ *      request if the connect was cancelled in the meantime.
+ *
+ * Results:
+ *      NULL.
+ *
+ * Side effects:
+ *      Fills in req->addrs and req->err.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gpointer
+TunnelResolveThread(gpointer data) // IN: TunnelResolveRequest
+{
+   TunnelResolveRequest *req = data;
    struct addrinfo hints = { 0, 0, SOCK_STREAM };
-   int err = 0;
-   int fd = -1;
-   char *portStr = NULL;
+   char *portStr;
 
-   portStr = g_strdup_printf("%d", port);
-   err = getaddrinfo(hostname, portStr, &hints, &addrs);
+   portStr = g_strdup_printf("%d", req->port);
+   req->err = getaddrinfo(req->host, portStr, &hints, &req->addrs);
    g_free(portStr);
 
-   if (err) {
-      g_printerr("Could not resolve %s:%d: %s\n", hostname, port,
-                 gai_strerror(err));
-      return -1;
+#ifndef __MINGW32__
+   g_static_mutex_lock(&gResolveLock);
+   req->done = TRUE;
+   if (req->abandoned) {
+      TunnelResolveRequestFree(req);
+   } else if (write(req->wakeFds[1], "", 1) != 1) {
+      g_assert_not_reached();
    }
+   g_static_mutex_unlock(&gResolveLock);
+#endif
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelResolveStart --
+ *
+ *      Resolve hostname and port on a separate thread, so that a slow DNS
+ *      server does not stall the main loop.  TunnelResolveDoneCb carries
+ *      on with the connect when the result comes in.
+ *
+ *      MinGW builds have no pipe the Poll loop can wait on, and resolve
+ *      in place instead.
+ *
+ * Results:
+ *      FALSE if the lookup could not be started.
+ *
+ * Side effects:
+ *      Sets gResolving.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TunnelResolveStart(const char *hostname, // IN
+                   int port)             // IN
+{
+   TunnelResolveRequest *req;
+#ifndef __MINGW32__
+   GError *error = NULL;
+#endif
+
+   g_assert(!gResolving);
+
+   req = g_new0(TunnelResolveRequest, 1);
+   req->host = g_strdup(hostname);
+   req->port = port;
+   req->wakeFds[0] = -1;
+   req->wakeFds[1] = -1;
+
+#ifdef __MINGW32__
+   TunnelResolveThread(req);
+   gResolving = req;
+   TunnelResolveDoneCb(req);
+#else
+   if (pipe(req->wakeFds) < 0) {
+      g_printerr("Could not create resolver pipe: %s\n", strerror(errno));
+      req->wakeFds[0] = -1;
+      req->wakeFds[1] = -1;
+      TunnelResolveRequestFree(req);
+      return FALSE;
+   }
+
+   gResolving = req;
+   Poll_Callback(POLL_CS_MAIN, POLL_FLAG_READ, TunnelResolveDoneCb, req,
+                 POLL_DEVICE, req->wakeFds[0], NULL);
+
+   if (!g_thread_create(TunnelResolveThread, req, FALSE, &error)) {
+      g_printerr("Could not start resolver thread: %s\n", error->message);
+      g_error_free(error);
+      Poll_CallbackRemove(POLL_CS_MAIN, POLL_FLAG_READ, TunnelResolveDoneCb,
+                          req, POLL_DEVICE);
+      gResolving = NULL;
+      TunnelResolveRequestFree(req);
+      return FALSE;
+   }
+#endif
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelResolveCancel --
+ *
+ *      Stop waiting for the lookup in progress, if any.  The resolver
+ *      thread frees the request when it finishes, unless it already has.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Clears gResolving.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelResolveCancel(void)
+{
+   if (!gResolving) {
+      return;
+   }
+
+   Poll_CallbackRemove(POLL_CS_MAIN, POLL_FLAG_READ, TunnelResolveDoneCb,
+                       gResolving, POLL_DEVICE);
+
+   g_static_mutex_lock(&gResolveLock);
+   if (gResolving->done) {
+      TunnelResolveRequestFree(gResolving);
+   } else {
+      gResolving->abandoned = TRUE;
+   }
+   g_static_mutex_unlock(&gResolveLock);
+
+   gResolving = NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelResolveFlush --
+ *
+ *      Forget the cached resolver result.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelResolveFlush(void)
+{
+   if (gResolveCache.addrs) {
+      freeaddrinfo(gResolveCache.addrs);
+   }
+   g_free(gResolveCache.host);
+   memset(&gResolveCache, 0, sizeof gResolveCache);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelConnectCancel --
+ *
+ *      Abandon the lookup and all outstanding connection attempts.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Attempt sockets are closed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelConnectCancel(void)
+{
+   GSList *iter;
+
+   TunnelResolveCancel();
+
+   for (iter = gConnect.attempts; iter; iter = iter->next) {
+      TunnelConnectAttempt *attempt = iter->data;
+      Poll_CallbackRemove(POLL_CS_MAIN, CONNECT_ATTEMPT_POLL_FLAGS,
+                          TunnelConnectAttemptCb, attempt, POLL_DEVICE);
+      close(attempt->fd);
+      g_free(attempt);
+   }
+   g_slist_free(gConnect.attempts);
+   gConnect.attempts = NULL;
+
+   if (gConnect.timerSet) {
+      Poll_CallbackRemove(POLL_CS_MAIN, 0, TunnelConnectTimerCb, NULL,
+                          POLL_REALTIME);
+      gConnect.timerSet = FALSE;
+   }
+
+   g_free(gConnect.addrs);
+   gConnect.addrs = NULL;
+   gConnect.numAddrs = 0;
+   gConnect.nextAddr = 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelConnectFail --
+ *
+ *      Give up connecting to the tunnel server.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Calls TunnelDisconnectCb, which exits.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelConnectFail(const char *reason) // IN
+{
+   TunnelConnectCancel();
+   /* Do not keep reusing addresses that no longer work. */
+   TunnelResolveFlush();
+   TunnelDisconnectCb(gTunnelProxy, NULL, reason, NULL);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelConnectNext --
+ *
+ *      Start a non-blocking connect to the next untried address, and arm
+ *      the timer that starts the one after it if this one has not
+ *      finished within CONNECT_ATTEMPT_DELAY_US.
+ *
+ * Results:
+ *      TRUE if an attempt was started, FALSE if no addresses are left.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TunnelConnectNext(void)
+{
+   while (gConnect.nextAddr < gConnect.numAddrs) {
+      struct addrinfo *addr = gConnect.addrs[gConnect.nextAddr++];
+      TunnelConnectAttempt *attempt;
+      int fd;
+#ifndef __MINGW32__
+      long flags;
+#endif
 
-   for (addr = addrs; addr; addr = addr->ai_next) {
       if (addr->ai_canonname) {
-         g_debug("Connecting to %s:%d...", addr->ai_canonname, port);
+         g_debug("Connecting to %s:%d...", addr->ai_canonname, gConnect.port);
       }
 
       fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
@@ -912,25 +1721,14 @@ TunnelConnectSocket(const char *hostname, // IN
          continue;
       }
 
-      if (connect(fd, addr->ai_addr, addr->ai_addrlen)) {
-         g_printerr("Could not connect socket: %s\n", strerror(errno));
+#ifdef __MINGW32__
+      SET_NONBLOCKING(fd);
+      if (connect(fd, addr->ai_addr, addr->ai_addrlen) == SOCKET_ERROR &&
+          WSAGetLastError() != WSAEWOULDBLOCK) {
+         g_printerr("Could not connect socket: %d\n", WSAGetLastError());
          close(fd);
-         fd = -1;
          continue;
       }
-
-      break;
-   }
-
-   freeaddrinfo(addrs);
-   if (fd >= 0) {
-      int nodelay = 1;
-      long flags;
-      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
-                 (const void *)&nodelay, sizeof(nodelay));
-
-#ifdef __MINGW32__
-      SET_NONBLOCKING(fd);
 #else
 #ifdef O_NONBLOCK
       flags = O_NONBLOCK;
@@ -938,9 +1736,270 @@ TunnelConnectSocket(const char *hostname, // IN
       flags = O_NDELAY;
 #endif
       fcntl(fd, F_SETFL, flags);
+      if (connect(fd, addr->ai_addr, addr->ai_addrlen) && errno != EINPROGRESS) {
+         g_printerr("Could not connect socket: %s\n", strerror(errno));
+         close(fd);
+         continue;
+      }
 #endif
+
+      attempt = g_new0(TunnelConnectAttempt, 1);
+      attempt->fd = fd;
+      gConnect.attempts = g_slist_prepend(gConnect.attempts, attempt);
+      Poll_Callback(POLL_CS_MAIN, CONNECT_ATTEMPT_POLL_FLAGS,
+                    TunnelConnectAttemptCb, attempt, POLL_DEVICE, fd, NULL);
+
+      if (gConnect.timerSet) {
+         Poll_CallbackRemove(POLL_CS_MAIN, 0, TunnelConnectTimerCb, NULL,
+                             POLL_REALTIME);
+      }
+      gConnect.timerSet = gConnect.nextAddr < gConnect.numAddrs;
+      if (gConnect.timerSet) {
+         Poll_Callback(POLL_CS_MAIN, 0, TunnelConnectTimerCb, NULL,
+                       POLL_REALTIME, CONNECT_ATTEMPT_DELAY_US, NULL);
+      }
+      return TRUE;
+   }
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelConnectTimerCb --
+ *
+ *      The latest connection attempt is taking too long; start another one
+ *      in parallel.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelConnectTimerCb(void *clientData) // IN: unused
+{
+   gConnect.timerSet = FALSE;
+   TunnelConnectNext();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelConnectAttemptCb --
+ *
+ *      A connection attempt finished.  The first one to succeed becomes
+ *      the tunnel socket and the others are abandoned; a failed one is
+ *      replaced by the next address right away.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Sets gFd and starts the HTTP or proxy handshake on success.  Calls
+ *      TunnelConnectFail once every address has failed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelConnectAttemptCb(void *clientData) // IN: TunnelConnectAttempt
+{
+   TunnelConnectAttempt *attempt = clientData;
+   int fd = attempt->fd;
+   int err = 0;
+   socklen_t errLen = sizeof err;
+   int nodelay = 1;
+
+   /* The callback is one-shot, so it has already been removed. */
+   gConnect.attempts = g_slist_remove(gConnect.attempts, attempt);
+   g_free(attempt);
+
+   if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *)&err, &errLen) < 0) {
+      err = errno;
+   }
+   if (err) {
+      g_printerr("Could not connect socket: %s\n", strerror(err));
+      close(fd);
+      if (!TunnelConnectNext() && !gConnect.attempts) {
+         char *reason = g_strdup_printf(
+            _("Could not connect to the tunnel server: %s"), strerror(err));
+         TunnelConnectFail(reason);
+         g_free(reason);
+      }
+      return;
+   }
+
+   TunnelConnectCancel();
+
+   setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+              (const void *)&nodelay, sizeof(nodelay));
+   gFd = fd;
+
+   if (gConnect.viaProxy) {
+      TunnelSocketProxyConnectCb(gFd, NULL);
+   } else {
+      TunnelSocketConnectCb(gFd, NULL);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelConnectAddrs --
+ *
+ *      Start connecting to a resolved address list.  Addresses are tried
+ *      alternating between address families, starting with the family
+ *      the resolver listed first, and a new attempt is started every
+ *      CONNECT_ATTEMPT_DELAY_US until one connects ("Happy Eyeballs",
+ *      RFC 6555), so an unreachable IPv6 or IPv4 path does not stall the
+ *      connection for a full TCP timeout.
+ *
+ * Results:
+ *      FALSE if no connection attempt could be started.
+ *
+ * Side effects:
+ *      The handshake is started from TunnelConnectAttemptCb.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TunnelConnectAddrs(struct addrinfo *addrs) // IN: owned by gResolveCache
+{
+   struct addrinfo *addr;
+   struct addrinfo *preferred;
+   struct addrinfo *other;
+   int firstFamily;
+   guint n = 0;
+
+   for (addr = addrs; addr; addr = addr->ai_next) {
+      n++;
+   }
+   gConnect.addrs = g_new0(struct addrinfo *, n);
+
+   /* Interleave the preferred family with the others. */
+   firstFamily = addrs->ai_family;
+   preferred = addrs;
+   other = addrs;
+   while (preferred || other) {
+      while (preferred && preferred->ai_family != firstFamily) {
+         preferred = preferred->ai_next;
+      }
+      if (preferred) {
+         gConnect.addrs[gConnect.numAddrs++] = preferred;
+         preferred = preferred->ai_next;
+      }
+      while (other && other->ai_family == firstFamily) {
+         other = other->ai_next;
+      }
+      if (other) {
+         gConnect.addrs[gConnect.numAddrs++] = other;
+         other = other->ai_next;
+      }
+   }
+   g_assert(gConnect.numAddrs == n);
+
+   return TunnelConnectNext();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelResolveDoneCb --
+ *
+ *      The resolver thread has finished.  Cache its result and start
+ *      connecting to it.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      Calls TunnelConnectFail if the lookup failed or no connection
+ *      attempt could be started.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelResolveDoneCb(void *clientData) // IN: TunnelResolveRequest
+{
+   TunnelResolveRequest *req = clientData;
+   char *reason = NULL;
+
+   /* The callback is one-shot, so it has already been removed. */
+   g_assert(req == gResolving);
+   gResolving = NULL;
+
+   if (req->err) {
+      reason = g_strdup_printf(_("Could not resolve %s:%d: %s"), req->host,
+                               req->port, gai_strerror(req->err));
+   } else {
+      TunnelResolveFlush();
+      gResolveCache.host = req->host;
+      gResolveCache.port = req->port;
+      gResolveCache.addrs = req->addrs;
+      g_get_current_time(&gResolveCache.resolved);
+      req->host = NULL;
+      req->addrs = NULL;
+
+      if (!TunnelConnectAddrs(gResolveCache.addrs)) {
+         reason = g_strdup_printf(_("Could not connect to %s:%d"),
+                                  gResolveCache.host, gResolveCache.port);
+      }
+   }
+   TunnelResolveRequestFree(req);
+
+   if (reason) {
+      TunnelConnectFail(reason);
+      g_free(reason);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelConnectStart --
+ *
+ *      Start connecting to a given hostname and port, resolving it first
+ *      unless a recent result is cached.
+ *
+ * Results:
+ *      FALSE if the connection could not be started.  Once it has
+ *      started, failure is reported through TunnelConnectFail.
+ *
+ * Side effects:
+ *      Cancels any connect in progress.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TunnelConnectStart(const char *hostname, // IN
+                   int port,             // IN
+                   gboolean viaProxy)    // IN
+{
+   struct addrinfo *addrs;
+
+   TunnelConnectCancel();
+
+   gConnect.port = port;
+   gConnect.viaProxy = viaProxy;
+
+   addrs = TunnelResolveCached(hostname, port);
+   if (addrs) {
+      return TunnelConnectAddrs(addrs);
    }
-   return fd;
+   return TunnelResolveStart(hostname, port);
 }
 
 
@@ -958,7 +2017,8 @@ TunnelConnectSocket(const char *hostname, // IN
  *      None
  *
  * Side effects:
- *      Created socket is stored in the gAsock global.
+ *      Created socket is stored in the gAsock global.  Calls
+ *      TunnelConnectFail if the connection could not be started.
  *
  *-----------------------------------------------------------------------------
  */
@@ -966,7 +2026,6 @@ TunnelConnectSocket(const char *hostname, // IN
 static void
 TunnelConnect(void)
 {
-   char *http_proxy = NULL;
    CdkProxyType proxyType;
    const char *host;
    unsigned short port;
@@ -977,6 +2036,7 @@ TunnelConnect(void)
    gboolean serverSecure = FALSE;
    char *proxyHost = NULL;
    unsigned short proxyPort = 0;
+   char *reason = NULL;
 
    g_assert(gFd == -1);
    g_assert(!gRecvHeaderDone);
@@ -988,16 +2048,15 @@ TunnelConnect(void)
       exit(1);
    }
 
-   http_proxy = CdkProxy_GetProxyForUrl(serverUrl, &proxyType);
-   if (http_proxy && !CdkUrl_Parse(http_proxy, NULL, &proxyHost, &proxyPort,
-                                   NULL, NULL)) {
+   proxyHost = CdkProxy_GetProxyHostForUrl(serverUrl, &proxyType, &proxyPort);
+   if (!proxyHost && proxyType != CDK_PROXY_NONE) {
+      char *proxyUrl = CdkProxy_GetProxyForUrl(serverUrl, &proxyType);
       g_printerr("Invalid proxy URL '%s'.  Attempting direct connection.\n",
-                 http_proxy);
-      g_free(http_proxy);
-      http_proxy = NULL;
+                 proxyUrl);
+      g_free(proxyUrl);
    }
 
-   if (http_proxy) {
+   if (proxyHost) {
       g_debug("Connecting to tunnel server '%s:%d' over %s, via proxy server '%s:%d'.",
               serverHost, serverPort, serverSecure ? "HTTPS" : "HTTP",
               proxyHost, proxyPort);
@@ -1011,22 +2070,19 @@ TunnelConnect(void)
    }
    g_assert(host && port > 0);
 
-   gFd = TunnelConnectSocket(host, port);
-   if (gFd < 0) {
-      return;
-   }
-
-   if (http_proxy) {
-      TunnelSocketProxyConnectCb(gFd, NULL);
-   } else {
-      TunnelSocketConnectCb(gFd, NULL);
+   if (!TunnelConnectStart(host, port, proxyHost != NULL)) {
+      reason = g_strdup_printf(_("Could not connect to %s:%d"), host, port);
    }
 
-   g_free(http_proxy);
    g_free(serverUrl);
    g_free(serverProto);
    g_free(serverHost);
    g_free(proxyHost);
+
+   if (reason) {
+      TunnelConnectFail(reason);
+      g_free(reason);
+   }
 }
 
 
@@ -1080,6 +2136,13 @@ Tunnel_Main(int argc,    // IN
 #endif
    char buf[128];
 
+#ifndef __MINGW32__
+   /* For the resolver thread, see TunnelResolveStart. */
+   if (!g_thread_supported()) {
+      g_thread_init(NULL);
+   }
+#endif
+
 #ifdef VMX86_DEBUG
    g_log_set_always_fatal(G_LOG_LEVEL_CRITICAL);
 #endif
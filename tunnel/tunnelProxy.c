@@ -38,6 +38,7 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>    /* For readv */
 #else
 #include "ws2tcpip.h"
 #include "winsockerr.h"
@@ -83,9 +84,62 @@ typedef gint32 in_addr_t;
 #define TP_PORTNAME_MAXLEN 24
 #define TP_BUF_MAXLEN 1024 * 10 // Tunnel reads/writes limited to 10K due to
                                 // buffer pooling in tunnel server.
+#define TP_BUF_LARGE_MAXLEN 1024 * 64 // Largest chunk size we offer to
+                                      // negotiate with the tunnel server.
+#define TP_BUF_INITLEN 4 * TP_BUF_MAXLEN
 #define TP_MAX_UNACKNOWLEDGED 4
-#define TP_MAX_START_FLOW_CONTROL 4 * TP_MAX_UNACKNOWLEDGED
-#define TP_MIN_END_FLOW_CONTROL TP_MAX_UNACKNOWLEDGED
+
+/*
+ * Flow control window, in unacknowledged chunks.  The window starts at the
+ * old fixed limit and follows the estimated bandwidth-delay product within
+ * these bounds.  Flow control ends once the unacknowledged count falls
+ * below 1/TP_FLOW_WINDOW_END_DIVISOR of the window.
+ */
+#define TP_FLOW_WINDOW_MIN 4 * TP_MAX_UNACKNOWLEDGED
+#define TP_FLOW_WINDOW_MAX 1024
+#define TP_FLOW_WINDOW_END_DIVISOR 4
+#define TP_FLOW_WINDOW_GAIN 2        // headroom over the estimated BDP
+#define TP_MIN_RTT_LIFETIME_USEC 10 * G_USEC_PER_SEC
+
+/*
+ * Bytes a channel may read per poll wakeup, in units of maxChunkLen.  A
+ * channel that uses up its budget gets twice as much next time, and one
+ * whose socket runs dry early gets half, so bulk channels batch their
+ * reads while no single channel can starve the others.
+ */
+#define TP_READ_BUDGET_MIN 1
+#define TP_READ_BUDGET_INIT 3
+#define TP_READ_BUDGET_MAX 16
+
+/*
+ * Deficit round robin quantum of a channel, in units of maxChunkLen, by
+ * the server port of its listener.  Interactive channels (RDP input and
+ * display, and the framework channel carrying USB HID) get a larger share
+ * than bulk ones such as multimedia redirection, which get the default.
+ */
+#define TP_QUANTUM_DEFAULT 1
+
+static const struct {
+   int serverPort;
+   int quantum;
+} tpPortQuanta[] = {
+   { 3389,  4 }, // RDP
+   { 32111, 2 }, // View framework channel, including USB
+};
+
+/*
+ * Channel sockets stay registered for reading until the channel closes,
+ * and must be removed with the same flags.
+ */
+#define TP_CHANNEL_POLL_FLAGS \
+   (POLL_FLAG_PERIODIC | POLL_FLAG_READ | POLL_FLAG_SOCKET)
+
+/*
+ * Freed chunk headers and maxChunkLen body buffers are kept on free lists
+ * for reuse, up to these counts.
+ */
+#define TP_POOL_MAX_CHUNKS 256
+#define TP_POOL_MAX_BODIES 64
 
 
 typedef struct {
@@ -96,9 +150,40 @@ typedef struct {
    char msgId[TP_MSGID_MAXLEN];
    char *body;
    int len;
+   int size;        // allocated body size, not counting the trailing NUL
+   gint64 sentTime; // usecs, set when written to the tunnel
 } TPChunk;
 
 
+/*
+ * Sliding byte buffer used for framing tunnel data.  Consumed bytes are
+ * dropped by advancing start, so readers and writers only ever see
+ * pointer+length views, and the unconsumed tail is moved down only when
+ * there is no room left to append at the end.
+ */
+typedef struct {
+   char *data;
+   gsize start; // offset of the first unconsumed byte
+   gsize len;   // unconsumed bytes following start
+   gsize size;  // allocated size of data
+} TPBuf;
+
+#define TP_BUF_DATA(_buf) ((_buf)->data + (_buf)->start)
+
+
+/*
+ * Outgoing chunks for one channel.  Channels with queued chunks take turns
+ * sending using deficit round robin: each turn adds quantum * maxChunkLen
+ * bytes of credit, and chunks are sent while the credit covers them.
+ */
+typedef struct {
+   unsigned int channelId;
+   GQueue *chunks;
+   int deficit;
+   int quantum;
+} TPOutQueue;
+
+
 typedef struct {
    char msgId[TP_MSGID_MAXLEN];
    TunnelProxyMsgHandlerCb cb;
@@ -112,6 +197,7 @@ typedef struct {
    unsigned int port;
    int fd;
    gboolean singleUse;
+   int quantum; // DRR quantum of its channels, in units of maxChunkLen
 } TPListener;
 
 
@@ -121,6 +207,8 @@ typedef struct {
    char portName[TP_PORTNAME_MAXLEN];
    int fd;
    char recvByte;
+   int readBudget; // Max bytes per wakeup, in units of maxChunkLen
+   int quantum;    // DRR quantum, in units of maxChunkLen
 } TPChannel;
 
 
@@ -152,22 +240,50 @@ struct TunnelProxy
 
    unsigned int maxChannelId;
    gboolean flowStopped;
+   unsigned int flowWindow;   // Max unacknowledged chunks before stopping
+   unsigned int flowStops;    // Times flow control has started
+   gint64 echoSentTime;       // When the last ECHO_RQ was sent, or 0
+   gint64 srtt;               // Smoothed round trip time, usecs
+   gint64 minRtt;             // Lowest recent round trip time, usecs
+   gint64 minRttTime;         // When minRtt was measured
+   guint64 deliveryRate;      // Smoothed acknowledged bytes/sec
+   guint64 rateBytes;         // Bytes acknowledged since rateStart
+   gint64 rateStart;          // Start of the current rate sample
+   int maxChunkLen; // From TP_MSG_PLEASE_INIT, or TP_BUF_MAXLEN
+
+   char *recvSpare;           // Body buffer for the next channel read
+   int recvSpareSize;
+
+   // Chunk allocator free lists, see TunnelProxyNewChunk
+   GTrashStack *freeChunks;
+   GTrashStack *freeBodies;   // Buffers of freeBodySize + 1 bytes
+   int freeBodySize;
+   unsigned int freeChunkCount;
+   unsigned int freeBodyCount;
+   unsigned int liveChunks;
+   unsigned int liveChunksMax;
+   guint64 poolAllocs;        // Headers and bodies taken from the heap
+   guint64 poolReuses;        // Headers and bodies taken from free lists
+   guint64 channelWakeups;    // Channel read callbacks
+   guint64 channelBytesRead;  // Bytes read from all channels
 
    unsigned int lastChunkIdSeen;
    unsigned int lastChunkAckSeen;
    unsigned int lastChunkIdSent;
    unsigned int lastChunkAckSent;
 
-   // Outgoing fifo
-   GQueue *queueOut;
+   // Outgoing fifos
+   GQueue *queueOut;         // Messages and ACKs, always sent first
+   GQueue *queueOutChannels; // Active TPOutQueues, in round robin order
    GQueue *queueOutNeedAck;
 
-   GList *listeners;
-   GList *channels;
-   GList *msgHandlers;
+   GHashTable *outQueues;   // channelId -> TPOutQueue, for queueOutChannels
+   GHashTable *listeners;   // portName -> TPListener
+   GHashTable *channels;    // channelId -> TPChannel
+   GHashTable *msgHandlers; // lower-case msgId -> GList of TPMsgHandler
 
-   GByteArray *readBuf;
-   GByteArray *writeBuf;
+   TPBuf readBuf;
+   TPBuf writeBuf;
 };
 
 
@@ -179,9 +295,25 @@ static void TunnelProxyFireSendNeeded(TunnelProxy *tp);
 static void TunnelProxySendChunk(TunnelProxy *tp, TPChunkType type,
                                  unsigned int channelId, const char *msgId,
                                  char *body, int bodyLen);
-static void TunnelProxyFreeChunk(TPChunk *chunk);
+static void TunnelProxyQueueChunk(TunnelProxy *tp, TPChunk *chunk);
+static TPChunk *TunnelProxyNewChunk(TunnelProxy *tp, TPChunkType type,
+                                    unsigned int channelId);
+static char *TunnelProxyNewBody(TunnelProxy *tp);
+static void TunnelProxyFreeBody(TunnelProxy *tp, char *body, int size);
+static void TunnelProxyFreeChunk(TunnelProxy *tp, TPChunk *chunk);
+static TPOutQueue *TunnelProxyFindOutQueue(TunnelProxy *tp,
+                                           unsigned int channelId);
+static void TunnelProxyFreeOutQueue(TunnelProxy *tp, TPOutQueue *outQueue);
 static void TunnelProxyFreeMsgHandler(TPMsgHandler *handler);
+static gboolean TunnelProxyFreeMsgHandlers(gpointer key, gpointer value,
+                                           gpointer userData);
+static gboolean TunnelProxyFirstEntry(gpointer key, gpointer value,
+                                      gpointer userData);
+static void TunnelProxyCollectChannels(gpointer key, gpointer value,
+                                       gpointer userData);
 static void TunnelProxyResetTimeouts(TunnelProxy *tp, gboolean requeue);
+static gint64 TunnelProxyNow(void);
+static void TunnelProxyRttSample(TunnelProxy *tp, gint64 rtt);
 
 
 /* Default Msg handler callbacks */
@@ -275,6 +407,193 @@ TunnelProxy_AddPoll(PollerFunction f, /* IN */
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyBufReset --
+ *
+ *      Drop all buffered data, allocating the buffer storage if needed.
+ *      Existing storage is kept for reuse.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelProxyBufReset(TPBuf *buf) // IN/OUT
+{
+   g_assert(buf);
+
+   if (!buf->data) {
+      buf->size = TP_BUF_INITLEN;
+      buf->data = g_malloc(buf->size);
+   }
+   buf->start = 0;
+   buf->len = 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyBufFree --
+ *
+ *      Free a buffer's storage.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelProxyBufFree(TPBuf *buf) // IN/OUT
+{
+   g_assert(buf);
+
+   g_free(buf->data);
+   memset(buf, 0, sizeof(*buf));
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyBufReserve --
+ *
+ *      Ensure there are at least len bytes free at the end of the buffer.
+ *      The unconsumed data is only moved to the front of the storage when
+ *      appending would otherwise run off the end, and the storage only
+ *      grows if the data would still not fit.
+ *
+ * Results:
+ *      Pointer to the free space at the end of the buffer.  Call
+ *      TunnelProxyBufCommit once it has been filled.
+ *
+ * Side effects:
+ *      May move or reallocate the buffer contents, invalidating any views.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static char *
+TunnelProxyBufReserve(TPBuf *buf, // IN/OUT
+                      gsize len)  // IN
+{
+   g_assert(buf);
+
+   if (!buf->data) {
+      TunnelProxyBufReset(buf);
+   }
+
+   if (buf->len == 0) {
+      buf->start = 0;
+   }
+
+   if (buf->start + buf->len + len > buf->size) {
+      if (buf->start > 0) {
+         memmove(buf->data, buf->data + buf->start, buf->len);
+         buf->start = 0;
+      }
+      if (buf->len + len > buf->size) {
+         buf->size = MAX(buf->size * 2, buf->len + len);
+         buf->data = g_realloc(buf->data, buf->size);
+      }
+   }
+
+   return buf->data + buf->start + buf->len;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyBufCommit --
+ *
+ *      Account for len bytes written into space returned by
+ *      TunnelProxyBufReserve.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static inline void
+TunnelProxyBufCommit(TPBuf *buf, // IN/OUT
+                     gsize len)  // IN
+{
+   g_assert(buf->start + buf->len + len <= buf->size);
+   buf->len += len;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyBufAppend --
+ *
+ *      Copy len bytes of data to the end of the buffer.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      See TunnelProxyBufReserve.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelProxyBufAppend(TPBuf *buf,       // IN/OUT
+                     const void *data, // IN
+                     gsize len)        // IN
+{
+   memcpy(TunnelProxyBufReserve(buf, len), data, len);
+   TunnelProxyBufCommit(buf, len);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyBufConsume --
+ *
+ *      Drop len bytes from the front of the buffer.  No data is moved.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static inline void
+TunnelProxyBufConsume(TPBuf *buf, // IN/OUT
+                      gsize len)  // IN
+{
+   len = MIN(len, buf->len);
+   buf->start += len;
+   buf->len -= len;
+   if (buf->len == 0) {
+      buf->start = 0;
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -311,9 +630,19 @@ TunnelProxy_Create(const char *connectionId,             // IN
    tp->endChannelCb = endChannelCb;
    tp->endChannelCbData = endChannelCbData;
 
+   tp->maxChunkLen = TP_BUF_MAXLEN;
+   tp->flowWindow = TP_FLOW_WINDOW_MIN;
+
    tp->queueOut = g_queue_new();
+   tp->queueOutChannels = g_queue_new();
    tp->queueOutNeedAck = g_queue_new();
 
+   tp->outQueues = g_hash_table_new(g_direct_hash, g_direct_equal);
+   tp->listeners = g_hash_table_new(g_str_hash, g_str_equal);
+   tp->channels = g_hash_table_new(g_direct_hash, g_direct_equal);
+   tp->msgHandlers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           NULL);
+
 #define TP_AMH(_msg, _cb) TunnelProxy_AddMsgHandler(tp, _msg, _cb, NULL)
    TP_AMH(TP_MSG_AUTHENTICATED, TunnelProxyAuthenticatedCb);
    TP_AMH(TP_MSG_ECHO_RQ,       TunnelProxyEchoRequestCb);
@@ -366,8 +695,11 @@ TunnelProxyFireSendNeeded(TunnelProxy *tp) // IN
  * TunnelProxySendChunk --
  *
  *       Create and queue a new outgoing TPChunk object, specifying all the
- *       content.  The chunk will be appended to the TunnelProxy's outgoing
- *       queue, and the sendNeededCb passed to TunnelProxy_Connect invoked.
+ *       content.  Data chunks are appended to their channel's outgoing
+ *       queue.  Messages and ACKs are appended to the TunnelProxy's outgoing
+ *       queue, unless a channelId is given and that channel still has data
+ *       queued, in which case the message is queued behind the data.  The
+ *       sendNeededCb passed to TunnelProxy_Connect is then invoked.
  *       Body content is always duplicated.
  *
  * Results:
@@ -391,26 +723,144 @@ TunnelProxySendChunk(TunnelProxy *tp,        // IN
 
    g_assert(tp);
 
-   newChunk = g_new0(TPChunk, 1);
-   newChunk->type = type;
-
-   newChunk->channelId = channelId;
+   newChunk = TunnelProxyNewChunk(tp, type, channelId);
    if (msgId) {
       strncpy(newChunk->msgId, msgId, TP_MSGID_MAXLEN);
    }
    if (body) {
       newChunk->len = bodyLen;
+      newChunk->size = bodyLen;
       newChunk->body = g_malloc(bodyLen + 1);
       newChunk->body[bodyLen] = 0;
       memcpy(newChunk->body, body, bodyLen);
    }
 
-   g_queue_push_tail(tp->queueOut, newChunk);
-
+   TunnelProxyQueueChunk(tp, newChunk);
    TunnelProxyFireSendNeeded(tp);
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyQueueChunk --
+ *
+ *       Append a chunk to the outgoing queue it belongs in, as described
+ *       in TunnelProxySendChunk.  The TunnelProxy takes ownership of the
+ *       chunk.  Callers are responsible for calling
+ *       TunnelProxyFireSendNeeded once they are done queueing.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelProxyQueueChunk(TunnelProxy *tp,  // IN
+                      TPChunk *chunk)   // IN
+{
+   unsigned int channelId = chunk->channelId;
+
+   if (chunk->type == TP_CHUNK_TYPE_DATA) {
+      TPOutQueue *outQueue = TunnelProxyFindOutQueue(tp, channelId);
+
+      if (!outQueue) {
+         TPChannel *channel = g_hash_table_lookup(tp->channels,
+                                                  GUINT_TO_POINTER(channelId));
+
+         outQueue = g_new0(TPOutQueue, 1);
+         outQueue->channelId = channelId;
+         outQueue->chunks = g_queue_new();
+         outQueue->quantum = channel ? channel->quantum : TP_QUANTUM_DEFAULT;
+         outQueue->deficit = outQueue->quantum * tp->maxChunkLen;
+
+         /*
+          * Newly active interactive channels go to the front, so keystrokes
+          * are not stuck behind bulk channels.  Bulk channels that keep
+          * draining and refilling their queue wait their turn at the back.
+          */
+         if (outQueue->quantum > TP_QUANTUM_DEFAULT) {
+            g_queue_push_head(tp->queueOutChannels, outQueue);
+         } else {
+            g_queue_push_tail(tp->queueOutChannels, outQueue);
+         }
+         g_hash_table_insert(tp->outQueues, GUINT_TO_POINTER(channelId),
+                             outQueue);
+      }
+      g_queue_push_tail(outQueue->chunks, chunk);
+   } else {
+      TPOutQueue *outQueue = channelId > 0 ?
+         TunnelProxyFindOutQueue(tp, channelId) : NULL;
+
+      g_queue_push_tail(outQueue ? outQueue->chunks : tp->queueOut, chunk);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyFindOutQueue --
+ *
+ *       Find the outgoing queue of a channel with chunks waiting to be sent.
+ *
+ * Results:
+ *       The channel's TPOutQueue, or NULL if it has nothing queued.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static TPOutQueue *
+TunnelProxyFindOutQueue(TunnelProxy *tp,        // IN
+                        unsigned int channelId) // IN
+{
+   return g_hash_table_lookup(tp->outQueues, GUINT_TO_POINTER(channelId));
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyFreeOutQueue --
+ *
+ *       Remove a channel's outgoing queue from the round robin and free it.
+ *       Any chunks still in the queue are freed.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelProxyFreeOutQueue(TunnelProxy *tp,       // IN
+                        TPOutQueue *outQueue)  // IN
+{
+   TPChunk *chunk;
+
+   g_assert(outQueue);
+
+   while ((chunk = (TPChunk *)g_queue_pop_head(outQueue->chunks))) {
+      TunnelProxyFreeChunk(tp, chunk);
+   }
+   g_queue_free(outQueue->chunks);
+
+   g_hash_table_remove(tp->outQueues, GUINT_TO_POINTER(outQueue->channelId));
+   g_queue_remove(tp->queueOutChannels, outQueue);
+   g_free(outQueue);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -438,19 +888,35 @@ TunnelProxy_Free(TunnelProxy *tp) // IN
    TunnelProxyDisconnect(tp, NULL, TRUE, FALSE);
 
    while ((chunk = (TPChunk *)g_queue_pop_head(tp->queueOut))) {
-      TunnelProxyFreeChunk(chunk);
+      TunnelProxyFreeChunk(tp, chunk);
    }
    g_queue_free(tp->queueOut);
 
+   while (!g_queue_is_empty(tp->queueOutChannels)) {
+      TunnelProxyFreeOutQueue(tp, g_queue_peek_head(tp->queueOutChannels));
+   }
+   g_queue_free(tp->queueOutChannels);
+
    while ((chunk = (TPChunk *)g_queue_pop_head(tp->queueOutNeedAck))) {
-      TunnelProxyFreeChunk(chunk);
+      TunnelProxyFreeChunk(tp, chunk);
    }
    g_queue_free(tp->queueOutNeedAck);
 
-   while (tp->msgHandlers) {
-      TunnelProxyFreeMsgHandler((TPMsgHandler *)tp->msgHandlers->data);
-      tp->msgHandlers = g_list_delete_link(tp->msgHandlers, tp->msgHandlers);
+   g_hash_table_destroy(tp->outQueues);
+   g_hash_table_destroy(tp->listeners);
+   g_hash_table_destroy(tp->channels);
+
+   g_hash_table_foreach_remove(tp->msgHandlers, TunnelProxyFreeMsgHandlers,
+                               NULL);
+   g_hash_table_destroy(tp->msgHandlers);
+
+   TunnelProxyBufFree(&tp->readBuf);
+   TunnelProxyBufFree(&tp->writeBuf);
+   TunnelProxyFreeBody(tp, tp->recvSpare, tp->recvSpareSize);
+   while ((chunk = g_trash_stack_pop(&tp->freeChunks))) {
+      g_free(chunk);
    }
+   TunnelProxyFreeBody(tp, NULL, 0);
 
    g_free(tp->capID);
    g_free(tp->hostIp);
@@ -460,12 +926,134 @@ TunnelProxy_Free(TunnelProxy *tp) // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyNewChunk --
+ *
+ *       Allocate an empty TPChunk, reusing a freed one if available.  Chunks
+ *       are released with TunnelProxyFreeChunk.
+ *
+ * Results:
+ *       A zeroed TPChunk with the type and channelId set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static TPChunk *
+TunnelProxyNewChunk(TunnelProxy *tp,        // IN
+                    TPChunkType type,       // IN
+                    unsigned int channelId) // IN/OPT
+{
+   TPChunk *chunk = g_trash_stack_pop(&tp->freeChunks);
+
+   if (chunk) {
+      tp->freeChunkCount--;
+      tp->poolReuses++;
+      memset(chunk, 0, sizeof(*chunk));
+   } else {
+      tp->poolAllocs++;
+      chunk = g_new0(TPChunk, 1);
+   }
+
+   tp->liveChunks++;
+   tp->liveChunksMax = MAX(tp->liveChunksMax, tp->liveChunks);
+
+   chunk->type = type;
+   chunk->channelId = channelId;
+   return chunk;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyNewBody --
+ *
+ *       Allocate a chunk body buffer of maxChunkLen bytes plus a trailing
+ *       NUL, reusing a freed one if available.  Free lists holding buffers
+ *       of an older maxChunkLen are emptied first.
+ *
+ * Results:
+ *       The buffer, to be released with TunnelProxyFreeBody or as part of
+ *       a chunk with size set to maxChunkLen.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static char *
+TunnelProxyNewBody(TunnelProxy *tp) // IN
+{
+   char *body;
+
+   if (tp->freeBodySize != tp->maxChunkLen) {
+      TunnelProxyFreeBody(tp, NULL, 0);
+      tp->freeBodySize = tp->maxChunkLen;
+   }
+
+   body = g_trash_stack_pop(&tp->freeBodies);
+   if (body) {
+      tp->freeBodyCount--;
+      tp->poolReuses++;
+   } else {
+      tp->poolAllocs++;
+      body = g_malloc(tp->freeBodySize + 1);
+   }
+   return body;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyFreeBody --
+ *
+ *       Release a chunk body buffer of the given size.  Buffers of the
+ *       pooled size are kept for reuse while the free list has room.
+ *       Passing a NULL body empties the free list.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelProxyFreeBody(TunnelProxy *tp, // IN
+                    char *body,      // IN/OPT
+                    int size)        // IN
+{
+   if (!body) {
+      while ((body = g_trash_stack_pop(&tp->freeBodies))) {
+         g_free(body);
+      }
+      tp->freeBodyCount = 0;
+   } else if (size > 0 && size == tp->freeBodySize &&
+              tp->freeBodyCount < TP_POOL_MAX_BODIES) {
+      g_trash_stack_push(&tp->freeBodies, body);
+      tp->freeBodyCount++;
+   } else {
+      g_free(body);
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
  * TunnelProxyFreeChunk --
  *
- *       Free a TPChunk object, and remove it from the queue passed.
+ *       Release a TPChunk and its body.  The chunk must already be removed
+ *       from any queue.
  *
  * Results:
  *       None.
@@ -477,11 +1065,22 @@ TunnelProxy_Free(TunnelProxy *tp) // IN
  */
 
 static void
-TunnelProxyFreeChunk(TPChunk *chunk) // IN
+TunnelProxyFreeChunk(TunnelProxy *tp, // IN
+                     TPChunk *chunk)  // IN
 {
    g_assert(chunk);
-   g_free(chunk->body);
-   g_free(chunk);
+
+   if (chunk->body) {
+      TunnelProxyFreeBody(tp, chunk->body, chunk->size);
+   }
+
+   tp->liveChunks--;
+   if (tp->freeChunkCount < TP_POOL_MAX_CHUNKS) {
+      g_trash_stack_push(&tp->freeChunks, chunk);
+      tp->freeChunkCount++;
+   } else {
+      g_free(chunk);
+   }
 }
 
 
@@ -509,13 +1108,76 @@ TunnelProxyFreeMsgHandler(TPMsgHandler *handler) // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyFreeMsgHandlers --
+ *
+ *       GHRFunc to free the list of TPMsgHandlers for one msgId in the
+ *       TunnelProxy's msgHandlers table.
+ *
+ * Results:
+ *       TRUE, to remove the entry from the table.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TunnelProxyFreeMsgHandlers(gpointer key,      // IN: unused
+                           gpointer value,    // IN: GList of TPMsgHandler
+                           gpointer userData) // IN: unused
+{
+   GList *handlers = value;
+
+   while (handlers) {
+      TunnelProxyFreeMsgHandler((TPMsgHandler *)handlers->data);
+      handlers = g_list_delete_link(handlers, handlers);
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyMsgHandlerKey --
+ *
+ *       Compute the msgHandlers table key for a msgId.  msgIds are matched
+ *       case-insensitively, so the key is the lower case msgId.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelProxyMsgHandlerKey(const char *msgId,           // IN
+                         char key[TP_MSGID_MAXLEN])   // OUT
+{
+   int i;
+
+   for (i = 0; i < TP_MSGID_MAXLEN - 1 && msgId[i]; i++) {
+      key[i] = g_ascii_tolower(msgId[i]);
+   }
+   key[i] = '\0';
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
  * TunnelProxy_AddMsgHandler --
  *
  *       Allocate a new msg handler object which handles messages of the given
- *       msgId, and add it to the TunnelProxy handler queue.
+ *       msgId, and append it to the msgId's list in the TunnelProxy handler
+ *       table.
  *
  * Results:
  *       None.
@@ -533,6 +1195,8 @@ TunnelProxy_AddMsgHandler(TunnelProxy *tp,            // IN
                           void *userData)             // IN/OPT
 {
    TPMsgHandler *msgHandler;
+   char key[TP_MSGID_MAXLEN];
+   GList *handlers;
 
    g_assert(tp);
    g_assert(msgId);
@@ -542,7 +1206,60 @@ TunnelProxy_AddMsgHandler(TunnelProxy *tp,            // IN
    msgHandler->userData = userData;
    msgHandler->cb = cb;
 
-   tp->msgHandlers = g_list_append(tp->msgHandlers, msgHandler);
+   TunnelProxyMsgHandlerKey(msgId, key);
+   handlers = g_hash_table_lookup(tp->msgHandlers, key);
+   handlers = g_list_append(handlers, msgHandler);
+   g_hash_table_replace(tp->msgHandlers, g_strdup(key), handlers);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxy_RemoveMsgHandler --
+ *
+ *       Remove and free the first msg handler for the given msgId with a
+ *       matching callback and userData.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+TunnelProxy_RemoveMsgHandler(TunnelProxy *tp,            // IN
+                             const char *msgId,          // IN
+                             TunnelProxyMsgHandlerCb cb, // IN
+                             void *userData)             // IN/OPT
+{
+   char key[TP_MSGID_MAXLEN];
+   GList *handlers;
+   GList *li;
+
+   g_assert(tp);
+   g_assert(msgId);
+
+   TunnelProxyMsgHandlerKey(msgId, key);
+   handlers = g_hash_table_lookup(tp->msgHandlers, key);
+
+   for (li = handlers; li; li = li->next) {
+      TPMsgHandler *handler = (TPMsgHandler *)li->data;
+      if (handler->cb == cb && handler->userData == userData) {
+         handlers = g_list_delete_link(handlers, li);
+         TunnelProxyFreeMsgHandler(handler);
+         break;
+      }
+   }
+
+   if (handlers) {
+      g_hash_table_replace(tp->msgHandlers, g_strdup(key), handlers);
+   } else {
+      g_hash_table_remove(tp->msgHandlers, key);
+   }
 }
 
 
@@ -879,22 +1596,23 @@ TunnelProxy_Connect(TunnelProxy *tp,                      // IN
    tp->disconnectCb = disconnectCb;
    tp->disconnectCbData = disconnectCbData;
 
-   if (tp->readBuf) {
-      g_byte_array_free(tp->readBuf, TRUE);
-   }
-   tp->readBuf = g_byte_array_new();
-   if (tp->writeBuf) {
-      g_byte_array_free(tp->writeBuf, TRUE);
-   }
-   tp->writeBuf = g_byte_array_new();
+   TunnelProxyBufReset(&tp->readBuf);
+   TunnelProxyBufReset(&tp->writeBuf);
 
    if (isReconnect) {
       TPChunk *chunk;
+      TPOutQueue *outQueue;
       TunnelProxyResetTimeouts(tp, TRUE);
 
       while ((chunk = g_queue_pop_head(tp->queueOut))) {
          g_queue_push_tail(tp->queueOutNeedAck, chunk);
       }
+      while ((outQueue = g_queue_peek_head(tp->queueOutChannels))) {
+         while ((chunk = g_queue_pop_head(outQueue->chunks))) {
+            g_queue_push_tail(tp->queueOutNeedAck, chunk);
+         }
+         TunnelProxyFreeOutQueue(tp, outQueue);
+      }
 
       /* Want to ACK the last chunk ID we saw */
       tp->lastChunkAckSent = 0;
@@ -908,6 +1626,7 @@ TunnelProxy_Connect(TunnelProxy *tp,                      // IN
                             "type=S", "C", /* "simple" C client */
                             "v1=I", 3, "v2=I", 1, "v3=I", 4,
                             "cid=S", "1234",
+                            "maxChunkSize=I", TP_BUF_LARGE_MAXLEN,
                             NULL);
       TunnelProxy_SendMsg(tp, TP_MSG_INIT, initBody, initLen);
       g_free(initBody);
@@ -952,8 +1671,9 @@ TunnelProxyDisconnect(TunnelProxy *tp,       // IN
    TunnelProxyResetTimeouts(tp, FALSE);
 
    if (closeSockets) {
-      while (tp->listeners) {
-         TPListener *listener = (TPListener *)tp->listeners->data;
+      TPListener *listener;
+      while ((listener = g_hash_table_find(tp->listeners,
+                                           TunnelProxyFirstEntry, NULL))) {
          /* This will close all the channels as well */
          err = TunnelProxy_CloseListener(tp, listener->portName);
          g_assert(TP_ERR_OK == err);
@@ -994,6 +1714,59 @@ TunnelProxy_Disconnect(TunnelProxy *tp) // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyFirstEntry --
+ *
+ *       GHRFunc matching any hash table entry.
+ *
+ * Results:
+ *       TRUE.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+TunnelProxyFirstEntry(gpointer key,      // IN: unused
+                      gpointer value,    // IN: unused
+                      gpointer userData) // IN: unused
+{
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyCollectChannels --
+ *
+ *       GHFunc to prepend each TPChannel in the channels table to a list,
+ *       so the channels can be closed without modifying the table while
+ *       iterating over it.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelProxyCollectChannels(gpointer key,      // IN: unused
+                           gpointer value,    // IN: TPChannel
+                           gpointer userData) // IN/OUT: GList **
+{
+   GList **channels = userData;
+   *channels = g_list_prepend(*channels, value);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1016,29 +1789,29 @@ TunnelProxy_CloseListener(TunnelProxy *tp,      // IN
                           const char *portName) // IN
 {
    TPListener *listener = NULL;
+   char name[TP_PORTNAME_MAXLEN];
    char *unlisten = NULL;
    int unlistenLen = 0;
    TunnelProxyErr err;
+   GList *channels = NULL;
    GList *li;
 
    g_assert(tp);
    g_assert(portName);
 
-   for (li = tp->listeners; li; li = li->next) {
-      TPListener *listenerIter = (TPListener *)li->data;
-      if (strcmp(listenerIter->portName, portName) == 0) {
-         listener = listenerIter;
-         break;
-      }
-   }
+   listener = g_hash_table_lookup(tp->listeners, portName);
    if (!listener) {
       return TP_ERR_INVALID_LISTENER;
    }
 
+   /* portName may belong to the listener or a channel we are about to free */
+   strncpy(name, listener->portName, TP_PORTNAME_MAXLEN);
+   portName = name;
+
    TunnelProxy_RemovePoll(TunnelProxySocketConnectCb, listener);
    close(listener->fd);
 
-   tp->listeners = g_list_remove(tp->listeners, listener);
+   g_hash_table_remove(tp->listeners, listener->portName);
    g_free(listener);
 
    /*
@@ -1050,15 +1823,15 @@ TunnelProxy_CloseListener(TunnelProxy *tp,      // IN
    g_free(unlisten);
 
    /* Close all the channels */
-   li = tp->channels;
-   while (li) {
+   g_hash_table_foreach(tp->channels, TunnelProxyCollectChannels, &channels);
+   for (li = channels; li; li = li->next) {
       TPChannel *channel = (TPChannel *)li->data;
-      li = li->next;
       if (strcmp(channel->portName, portName) == 0) {
          err = TunnelProxy_CloseChannel(tp, channel->channelId);
          g_assert(TP_ERR_OK == err);
       }
    }
+   g_list_free(channels);
 
    return TP_ERR_OK;
 }
@@ -1087,37 +1860,26 @@ TunnelProxy_CloseChannel(TunnelProxy *tp,        // IN
                          unsigned int channelId) // IN
 {
    TPChannel *channel = NULL;
+   TPListener *listener;
    TunnelProxyErr err;
-   GList *li;
 
    g_assert(tp);
 
-   for (li = tp->channels; li; li = li->next) {
-      TPChannel *chanIter = (TPChannel *)li->data;
-      if (chanIter->channelId == channelId) {
-         channel = chanIter;
-         break;
-      }
-   }
+   channel = g_hash_table_lookup(tp->channels, GUINT_TO_POINTER(channelId));
    if (!channel) {
       return TP_ERR_INVALID_CHANNELID;
    }
 
-   for (li = tp->listeners; li; li = li->next) {
-      TPListener *listener = (TPListener *)li->data;
-
-      if (listener->singleUse &&
-          strcmp(listener->portName, channel->portName) == 0) {
-         g_debug("Closing single-use listener \"%s\" after channel \"%d\" "
-                 "disconnect.", channel->portName, channelId);
+   listener = g_hash_table_lookup(tp->listeners, channel->portName);
+   if (listener && listener->singleUse) {
+      g_debug("Closing single-use listener \"%s\" after channel \"%d\" "
+              "disconnect.", channel->portName, channelId);
 
-         err = TunnelProxy_CloseListener(tp, channel->portName);
-         g_assert(TP_ERR_OK == err);
+      err = TunnelProxy_CloseListener(tp, channel->portName);
+      g_assert(TP_ERR_OK == err);
 
-         /* Channel is no more */
-         channel = NULL;
-         break;
-      }
+      /* Channel is no more */
+      channel = NULL;
    }
 
    if (channel) {
@@ -1125,15 +1887,18 @@ TunnelProxy_CloseChannel(TunnelProxy *tp,        // IN
       int lowerLen = 0;
 
       if (channel->fd >= 0) {
-         TunnelProxy_RemovePoll(TunnelProxySocketRecvCb, channel);
+         Poll_CallbackRemove(POLL_CS_MAIN, TP_CHANNEL_POLL_FLAGS,
+                             TunnelProxySocketRecvCb, channel, POLL_DEVICE);
          close(channel->fd);
       }
 
       TunnelProxy_FormatMsg(&lower, &lowerLen, "chanID=I", channelId, NULL);
-      TunnelProxy_SendMsg(tp, TP_MSG_LOWER, lower, lowerLen);
+      /* Make sure the LOWER goes out after any data still queued. */
+      TunnelProxySendChunk(tp, TP_CHUNK_TYPE_MESSAGE, channelId, TP_MSG_LOWER,
+                           lower, lowerLen);
       g_free(lower);
 
-      tp->channels = g_list_remove(tp->channels, channel);
+      g_hash_table_remove(tp->channels, GUINT_TO_POINTER(channelId));
       g_free(channel);
    }
 
@@ -1149,19 +1914,53 @@ TunnelProxy_CloseChannel(TunnelProxy *tp,        // IN
 /*
  *-----------------------------------------------------------------------------
  *
- * TunnelProxySocketRecvCb --
+ * TunnelProxyOpenDataChunk --
  *
- *       Read IO callback handler for a given socket channel.  An attempt is
- *       made to read all data available on the socket in a non-blocking
- *       fashion.  If an error occurs while reading, TunnelProxy_CloseChannel
- *       is called.
+ *       Find the last chunk queued for a channel, if it is an unsent data
+ *       chunk with room left in its body, so further reads can be appended
+ *       to it directly and consecutive small reads go out in one chunk.
  *
- *       If any data is read, a new outgoing data chunk is queued with all the
- *       data.  Max data size for one chunk is 10K (see
- *       wswc_tunnel/conveyor.cpp).
+ * Results:
+ *       The chunk, or NULL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static TPChunk *
+TunnelProxyOpenDataChunk(TunnelProxy *tp,        // IN
+                         unsigned int channelId) // IN
+{
+   TPOutQueue *outQueue = TunnelProxyFindOutQueue(tp, channelId);
+   TPChunk *last = outQueue ? g_queue_peek_tail(outQueue->chunks) : NULL;
+
+   if (last && last->type == TP_CHUNK_TYPE_DATA && last->chunkId == 0 &&
+       last->channelId == channelId &&
+       last->len < MIN(last->size, tp->maxChunkLen)) {
+      return last;
+   }
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
  *
- *       AsyncSocket_Recv for 1 byte is issued to cause this callback to be
- *       invoked the next time there is at least one byte of data to read.
+ * TunnelProxySocketRecvCb --
+ *
+ *       Read IO callback handler for a given socket channel.  The callback
+ *       stays registered while the channel is open.  Data is read until
+ *       the socket has no more or the channel's read budget is used up,
+ *       and the budget is adjusted for the next wakeup.  If an error
+ *       occurs while reading, TunnelProxy_CloseChannel is called.
+ *
+ *       Data is read straight into chunk bodies: first into the room left
+ *       in the channel's last unsent data chunk, then into a spare body
+ *       buffer which becomes a new data chunk.  Max data size for one chunk
+ *       is 10K (see wswc_tunnel/conveyor.cpp) unless a larger size was
+ *       negotiated.
  *
  * Results:
  *       None.
@@ -1176,19 +1975,44 @@ static void
 TunnelProxySocketRecvCb(void *clientData) /* IN: TPChannel */
 {
    TPChannel *channel = clientData;
-   int throttle = 3;
-   char recvBuf[TP_BUF_MAXLEN];
-   ssize_t recvLen = 0;
+   TunnelProxy *tp;
+   int budget;
+   int bytesRead = 0;
+   gboolean drained = FALSE;
    TunnelProxyErr err;
 
    g_assert(channel);
 
-   while (throttle--) {
+   tp = channel->tp;
+   budget = channel->readBudget * tp->maxChunkLen;
+   tp->channelWakeups++;
+
+   while (bytesRead < budget) {
+      TPChunk *last = TunnelProxyOpenDataChunk(tp, channel->channelId);
+      int room = last ? MIN(last->size, tp->maxChunkLen) - last->len : 0;
+      ssize_t recvLen;
+      ssize_t wanted;
+
+      if (tp->recvSpareSize != tp->maxChunkLen) {
+         if (tp->recvSpare) {
+            TunnelProxyFreeBody(tp, tp->recvSpare, tp->recvSpareSize);
+         }
+         tp->recvSpare = TunnelProxyNewBody(tp);
+         tp->recvSpareSize = tp->maxChunkLen;
+      }
+
 #ifdef __MINGW32__
-      recvLen = recv(channel->fd, recvBuf, sizeof(recvBuf), 0);
+      if (room > 0) {
+         wanted = room;
+         recvLen = recv(channel->fd, last->body + last->len, room, 0);
+      } else {
+         wanted = tp->recvSpareSize;
+         recvLen = recv(channel->fd, tp->recvSpare, tp->recvSpareSize, 0);
+      }
       if (recvLen == SOCKET_ERROR) {
          if (WSAGetLastError() == WSAEWOULDBLOCK) {
-            goto pollAgain;
+            drained = TRUE;
+            break;
          } else {
             g_printerr(
                _("Error reading from tunnel HTTP socket: %d\n"),
@@ -1197,40 +2021,92 @@ TunnelProxySocketRecvCb(void *clientData) /* IN: TPChannel */
          }
       }
 #else
-      recvLen = read(channel->fd, recvBuf, sizeof(recvBuf));
+      {
+         struct iovec iov[2];
+         int iovCnt = 0;
+
+         if (room > 0) {
+            iov[iovCnt].iov_base = last->body + last->len;
+            iov[iovCnt].iov_len = room;
+            iovCnt++;
+         }
+         iov[iovCnt].iov_base = tp->recvSpare;
+         iov[iovCnt].iov_len = tp->recvSpareSize;
+         iovCnt++;
+
+         wanted = room + tp->recvSpareSize;
+         recvLen = readv(channel->fd, iov, iovCnt);
+      }
 #endif
       switch (recvLen) {
       case -1:
-         switch (errno) {
-         case EINTR:
-            goto loopAgain;
-         case EAGAIN:
-            goto pollAgain;
-         default:
+         if (errno == EINTR) {
+            continue;
+         } else if (errno == EAGAIN) {
+            drained = TRUE;
             break;
          }
          g_printerr("Error reading from channel \"%d\": %s\n",
                     channel->channelId, strerror(errno));
          /* fall through... */
       case 0:
-         if (channel->tp->endChannelCb) {
-            channel->tp->endChannelCb(channel->tp, channel->portName,
-                                      channel->fd,
-                                      channel->tp->endChannelCbData);
+         if (bytesRead > 0) {
+            TunnelProxyFireSendNeeded(tp);
          }
-         err = TunnelProxy_CloseChannel(channel->tp, channel->channelId);
+         if (tp->endChannelCb) {
+            tp->endChannelCb(tp, channel->portName, channel->fd,
+                             tp->endChannelCbData);
+         }
+         err = TunnelProxy_CloseChannel(tp, channel->channelId);
          g_assert(TP_ERR_OK == err);
          return;
-      default:
-         TunnelProxySendChunk(channel->tp, TP_CHUNK_TYPE_DATA,
-                              channel->channelId, NULL, recvBuf, recvLen);
+      default: {
+         int len = recvLen;
+
+         bytesRead += len;
+         tp->channelBytesRead += len;
+
+         if (room > 0) {
+            int tailLen = MIN(len, room);
+
+            last->len += tailLen;
+            last->body[last->len] = 0;
+            len -= tailLen;
+         }
+         if (len > 0) {
+            TPChunk *newChunk = TunnelProxyNewChunk(tp, TP_CHUNK_TYPE_DATA,
+                                                    channel->channelId);
+
+            newChunk->body = tp->recvSpare;
+            newChunk->size = tp->recvSpareSize;
+            newChunk->len = len;
+            newChunk->body[len] = 0;
+            TunnelProxyQueueChunk(tp, newChunk);
+
+            tp->recvSpare = NULL;
+            tp->recvSpareSize = 0;
+         }
+
+         /* A short read means the socket has nothing more for now. */
+         drained = recvLen < wanted;
+         break;
+      }
+      }
+
+      if (drained) {
          break;
       }
-   loopAgain:
-      ;
    }
-pollAgain:
-   TunnelProxy_AddPoll(TunnelProxySocketRecvCb, channel, channel->fd);
+
+   if (!drained) {
+      channel->readBudget = MIN(channel->readBudget * 2, TP_READ_BUDGET_MAX);
+   } else if (bytesRead <= budget / 2) {
+      channel->readBudget = MAX(channel->readBudget / 2, TP_READ_BUDGET_MIN);
+   }
+
+   if (bytesRead > 0) {
+      TunnelProxyFireSendNeeded(tp);
+   }
 }
 
 
@@ -1319,8 +2195,11 @@ TunnelProxySocketConnectCb(void *clientData) /* IN */
    strncpy(newChannel->portName, listener->portName, TP_PORTNAME_MAXLEN);
    newChannel->fd = fd;
    newChannel->tp = tp;
+   newChannel->readBudget = TP_READ_BUDGET_INIT;
+   newChannel->quantum = listener->quantum;
 
-   tp->channels = g_list_append(tp->channels, newChannel);
+   g_hash_table_insert(tp->channels,
+                       GUINT_TO_POINTER(newChannel->channelId), newChannel);
 
    TunnelProxy_FormatMsg(&raiseBody, &raiseLen,
                          "chanID=I", newChannel->channelId,
@@ -1595,16 +2474,25 @@ TunnelProxyHandleInChunk(TunnelProxy *tp, // IN
 
    if (chunk->ackId > 0) {
       TPChunk *outChunk;
+      gint64 lastSentTime = 0;
 
       if (chunk->ackId > tp->lastChunkIdSent) {
          g_debug("Unknown ACK ID '%d' in received tunnel message.", chunk->ackId);
       }
 
       for (outChunk = g_queue_peek_head(tp->queueOutNeedAck);
-           outChunk && chunk->chunkId >= outChunk->chunkId;
+           outChunk && chunk->ackId >= outChunk->chunkId;
            outChunk = g_queue_peek_head(tp->queueOutNeedAck)) {
          g_queue_pop_head(tp->queueOutNeedAck);
-         TunnelProxyFreeChunk(outChunk);
+         if (outChunk->type != TP_CHUNK_TYPE_ACK) {
+            lastSentTime = MAX(lastSentTime, outChunk->sentTime);
+            tp->rateBytes += outChunk->len;
+         }
+         TunnelProxyFreeChunk(tp, outChunk);
+      }
+
+      if (lastSentTime > 0) {
+         TunnelProxyRttSample(tp, TunnelProxyNow() - lastSentTime);
       }
 
       tp->lastChunkAckSeen = chunk->ackId;
@@ -1613,21 +2501,33 @@ TunnelProxyHandleInChunk(TunnelProxy *tp, // IN
    switch (chunk->type) {
    case TP_CHUNK_TYPE_MESSAGE: {
       gboolean found = FALSE;
+      char key[TP_MSGID_MAXLEN];
+      GList *handlers;
       GList *li;
 
       g_assert(chunk->msgId);
-      for (li = tp->msgHandlers; li; li = li->next) {
+      TunnelProxyMsgHandlerKey(chunk->msgId, key);
+
+      /*
+       * Handlers may add or remove handlers, themselves included, so walk
+       * a copy of the list and skip any that are gone by their turn.
+       */
+      handlers = g_list_copy(g_hash_table_lookup(tp->msgHandlers, key));
+      for (li = handlers; li; li = li->next) {
          TPMsgHandler *handler = (TPMsgHandler *)li->data;
-         if (g_ascii_strcasecmp(handler->msgId, chunk->msgId) == 0) {
-            g_assert(handler->cb);
-            found = TRUE;
-            if (handler->cb(tp, chunk->msgId, chunk->body, chunk->len,
-                            handler->userData)) {
-               /* True means the handler handled the message, so stop here. */
-               break;
-            }
+         if (!g_list_find(g_hash_table_lookup(tp->msgHandlers, key),
+                          handler)) {
+            continue;
+         }
+         g_assert(handler->cb);
+         found = TRUE;
+         if (handler->cb(tp, chunk->msgId, chunk->body, chunk->len,
+                         handler->userData)) {
+            /* True means the handler handled the message, so stop here. */
+            break;
          }
       }
+      g_list_free(handlers);
 
       if (!found) {
          DEBUG_MSG(("Unhandled message type '%s' received.", chunk->msgId));
@@ -1635,62 +2535,55 @@ TunnelProxyHandleInChunk(TunnelProxy *tp, // IN
       break;
    }
    case TP_CHUNK_TYPE_DATA: {
-      gboolean found = FALSE;
-      GList *li;
+      TPChannel *channel = g_hash_table_lookup(tp->channels,
+                                               GUINT_TO_POINTER(chunk->channelId));
+      ssize_t bytesWritten = 0;
+      char *buf = chunk->body;
+      int len = chunk->len;
+
+      if (!channel) {
+         DEBUG_MSG(("Data received for unknown channel id '%d'.",
+                    chunk->channelId));
+         break;
+      }
 
-      for (li = tp->channels; li; li = li->next) {
-         TPChannel *channel = (TPChannel *)li->data;
-
-         if (channel->channelId == chunk->channelId) {
-            ssize_t bytesWritten = 0;
-            char *buf = chunk->body;
-            int len = chunk->len;
-            /*
-             * XXX: Yes, this is a blocking write.  The data is
-             * usually small, and IOChannels are buffered, so maybe it
-             * doesn't matter? If it becomes a problem we'll need to
-             * add a writeBuf to our channel, and an G_IO_OUT callback
-             * that drains it.
-             */
-            while (len) {
+      /*
+       * XXX: Yes, this is a blocking write.  The data is
+       * usually small, and IOChannels are buffered, so maybe it
+       * doesn't matter? If it becomes a problem we'll need to
+       * add a writeBuf to our channel, and an G_IO_OUT callback
+       * that drains it.
+       */
+      while (len) {
 #ifdef __MINGW32__
-               bytesWritten = send(channel->fd, buf, len, 0);
-               if (bytesWritten == SOCKET_ERROR) {
-                  DWORD error = WSAGetLastError();
-                  if (error == WSAEWOULDBLOCK) {
-                     errno = EWOULDBLOCK;
-                  } else {
-                     g_printerr("Error writing to chunk: %d\n",
-                        WSAGetLastError());
-                  }
-                  bytesWritten = -1;
-               }
+         bytesWritten = send(channel->fd, buf, len, 0);
+         if (bytesWritten == SOCKET_ERROR) {
+            DWORD error = WSAGetLastError();
+            if (error == WSAEWOULDBLOCK) {
+               errno = EWOULDBLOCK;
+            } else {
+               g_printerr("Error writing to chunk: %d\n",
+                  WSAGetLastError());
+            }
+            bytesWritten = -1;
+         }
 #else
-               bytesWritten = write(channel->fd, buf, len);
+         bytesWritten = write(channel->fd, buf, len);
 #endif
-               if (bytesWritten < 0) {
-                  if (errno != EAGAIN &&
-                      errno != EINTR &&
-                      errno != EWOULDBLOCK) {
-                     g_printerr("Error writing to chunk: %s\n",
-                        strerror(errno));
-                     len = 0;
-                     break;
-                  }
-               } else {
-                  len -= bytesWritten;
-                  buf += bytesWritten;
-               }
+         if (bytesWritten < 0) {
+            if (errno != EAGAIN &&
+                errno != EINTR &&
+                errno != EWOULDBLOCK) {
+               g_printerr("Error writing to chunk: %s\n",
+                  strerror(errno));
+               len = 0;
+               break;
             }
-            found = TRUE;
-            break;
+         } else {
+            len -= bytesWritten;
+            buf += bytesWritten;
          }
       }
-
-      if (!found) {
-         DEBUG_MSG(("Data received for unknown channel id '%d'.",
-                    chunk->channelId));
-      }
       break;
    }
    case TP_CHUNK_TYPE_ACK:
@@ -1710,10 +2603,11 @@ TunnelProxyHandleInChunk(TunnelProxy *tp, // IN
  *       Process incoming tunnel data read from an unknown HTTP source.  The
  *       buffer contents are assumed *not* to be in HTTP chunked encoding.
  *
- *       Appends the buffer data to the TunnelProxy's readBuf, and attempts to
- *       construct and queue incoming chunks from the data by calling
- *       TunnelProxyReadChunk.  The data read from the readBuf and used
- *       to construct full chunks is removed from the front of the readBuf.
+ *       Chunks are framed in place by calling TunnelProxyReadChunk.  If
+ *       there is no partial chunk left over from a previous call, the chunks
+ *       are read directly from buf and only a trailing partial chunk is
+ *       copied into the TunnelProxy's readBuf.  Otherwise the buffer data is
+ *       appended to the readBuf and framed from there.
  *
  *       TunnelProxyHandleInChunk is called repeatedly to process any
  *       existing or newly queued incoming chunks.
@@ -1733,21 +2627,33 @@ TunnelProxy_HTTPRecv(TunnelProxy *tp,  // IN
                      int bufSize,      // IN
                      gboolean httpChunked) // IN
 {
+   gboolean direct;
    int totalReadLen = 0;
 
    g_assert(tp);
    g_assert(buf && bufSize > 0);
 
-   g_byte_array_append(tp->readBuf, buf, bufSize);
+   direct = tp->readBuf.len == 0;
+   if (!direct) {
+      TunnelProxyBufAppend(&tp->readBuf, buf, bufSize);
+   }
 
    while (TRUE) {
       unsigned int readLen;
       TPChunk chunk;
+      char *data;
+      int len;
+
+      if (direct) {
+         data = (char *)buf + totalReadLen;
+         len = bufSize - totalReadLen;
+      } else {
+         data = TP_BUF_DATA(&tp->readBuf) + totalReadLen;
+         len = tp->readBuf.len - totalReadLen;
+      }
 
       memset(&chunk, 0, sizeof(chunk));
-      readLen = TunnelProxyReadChunk(tp->readBuf->data + totalReadLen,
-                                     tp->readBuf->len - totalReadLen,
-                                     httpChunked, &chunk);
+      readLen = TunnelProxyReadChunk(data, len, httpChunked, &chunk);
       if (!readLen) {
          break;
       }
@@ -1756,13 +2662,20 @@ TunnelProxy_HTTPRecv(TunnelProxy *tp,  // IN
       totalReadLen += readLen;
    }
 
+   if (direct) {
+      /* Keep any trailing partial chunk for the next call */
+      if (totalReadLen < bufSize) {
+         TunnelProxyBufAppend(&tp->readBuf, buf + totalReadLen,
+                              bufSize - totalReadLen);
+      }
+   } else {
+      TunnelProxyBufConsume(&tp->readBuf, totalReadLen);
+   }
+
    if (!totalReadLen) {
       return;
    }
 
-   /* Shrink the front of the read buffer */
-   g_byte_array_remove_range(tp->readBuf, 0, totalReadLen);
-
    /* Reset timeouts after successfully reading a chunk. */
    TunnelProxyResetTimeouts(tp, TRUE);
 
@@ -1770,11 +2683,13 @@ TunnelProxy_HTTPRecv(TunnelProxy *tp,  // IN
    {
       unsigned int unackCnt = tp->lastChunkIdSent - tp->lastChunkAckSeen;
 
-      if ((unackCnt > TP_MAX_START_FLOW_CONTROL) && !tp->flowStopped) {
-         DEBUG_MSG(("Starting flow control (%d unacknowledged chunks)",
-                    unackCnt));
+      if ((unackCnt > tp->flowWindow) && !tp->flowStopped) {
+         DEBUG_MSG(("Starting flow control (%d unacknowledged chunks, "
+                    "window %d)", unackCnt, tp->flowWindow));
          tp->flowStopped = TRUE;
-      } else if ((unackCnt < TP_MIN_END_FLOW_CONTROL) && tp->flowStopped) {
+         tp->flowStops++;
+      } else if ((unackCnt < tp->flowWindow / TP_FLOW_WINDOW_END_DIVISOR) &&
+                 tp->flowStopped) {
          DEBUG_MSG(("Ending flow control"));
          tp->flowStopped = FALSE;
          TunnelProxyFireSendNeeded(tp);
@@ -1788,14 +2703,119 @@ TunnelProxy_HTTPRecv(TunnelProxy *tp,  // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyNextOutChunk --
+ *
+ *       Pick the next chunk to send.  Messages and ACKs in the TunnelProxy's
+ *       outgoing queue always go first.  Otherwise, unless flow control is
+ *       on, channels take turns by deficit round robin: the channel at the
+ *       head of the round robin sends while its credit covers its next
+ *       chunk, and when it does not, it earns its quantum of credit and
+ *       moves to the back.
+ *
+ * Results:
+ *       The next chunk to send, or NULL if nothing can be sent.  The chunk
+ *       is left at the head of its queue, and outQueue is set to the
+ *       channel queue it came from, or NULL.
+ *
+ * Side effects:
+ *       May rotate the round robin and add channel credit.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static TPChunk *
+TunnelProxyNextOutChunk(TunnelProxy *tp,       // IN
+                        TPOutQueue **outQueue) // OUT
+{
+   *outQueue = NULL;
+
+   if (!g_queue_is_empty(tp->queueOut)) {
+      return g_queue_peek_head(tp->queueOut);
+   }
+
+   if (tp->flowStopped) {
+      return NULL;
+   }
+
+   while (!g_queue_is_empty(tp->queueOutChannels)) {
+      TPOutQueue *head = g_queue_peek_head(tp->queueOutChannels);
+      TPChunk *chunk = g_queue_peek_head(head->chunks);
+
+      g_assert(chunk);
+      if (chunk->len <= head->deficit) {
+         *outQueue = head;
+         return chunk;
+      }
+
+      head->deficit += head->quantum * tp->maxChunkLen;
+      g_queue_push_tail(tp->queueOutChannels,
+                        g_queue_pop_head(tp->queueOutChannels));
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyWriteHex --
+ *
+ *       Inline serialization helper, the inverse of TunnelProxyReadHex.
+ *       Writes value as upper-case hex digits followed by a trailing char.
+ *       If skipZero is TRUE, a zero value is written as no digits at all
+ *       (the equivalent of printf's "%.0X").
+ *
+ * Results:
+ *       Number of chars written to buf, including the trailing char.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static inline int
+TunnelProxyWriteHex(char *buf,          // OUT
+                    unsigned int value, // IN
+                    gboolean skipZero,  // IN
+                    char trail)         // IN
+{
+   static const char hexDigits[] = "0123456789ABCDEF";
+   char digits[2 * sizeof value];
+   int numDigits = 0;
+   int len = 0;
+
+   if (value > 0 || !skipZero) {
+      do {
+         digits[numDigits++] = hexDigits[value & 0xF];
+         value >>= 4;
+      } while (value);
+   }
+
+   while (numDigits) {
+      buf[len++] = digits[--numDigits];
+   }
+   buf[len++] = trail;
+
+   return len;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
  * TunnelProxyWriteNextOutChunk --
  *
- *       Serialize the next chunk in the outgoing chunk queue into the
- *       TunnelProxy's writeBuf.  If the chunk to be serialized is a Data
- *       chunk, its body is first base64 encoded.
+ *       Serialize the next chunk picked by TunnelProxyNextOutChunk into the
+ *       TunnelProxy's writeBuf.
+ *
+ *       The chunk header is formatted into a small stack buffer and the
+ *       header, body and trailer are gathered directly into the writeBuf, so
+ *       the body is copied exactly once.
  *
  *       If the outgoing chunk doesn't have an ackId field set, the next chunk
  *       on the incoming to-be-ACK's queue is used, and is freed.
@@ -1816,19 +2836,26 @@ TunnelProxyWriteNextOutChunk(TunnelProxy *tp,  // IN
                              gboolean httpChunked) // IN
 {
    TPChunk *chunk = NULL;
-   char *msg = NULL;
-   GList *li;
-   size_t msgLen = 0;
+   TPOutQueue *outQueue = NULL;
+   /* Room for a type char and five hex fields, each with a trailing char. */
+   char chunkHdr[2 + 5 * (2 * sizeof(unsigned int) + 1)];
+   int chunkHdrLen = 0;
+   char *msgHdr = NULL;
+   int msgHdrLen = 0;
+   char httpHdr[2 * sizeof(unsigned int) + 2];
+   int httpHdrLen = 0;
+   struct {
+      const char *base;
+      gsize len;
+   } iov[6];
+   int iovCnt = 0;
+   gsize msgLen = 0;
+   char *dst;
+   int i;
 
    g_assert(tp);
 
-   for (li = g_queue_peek_head_link(tp->queueOut); li; li = li->next) {
-      TPChunk *chunkIter = (TPChunk *)li->data;
-      if (!tp->flowStopped || chunkIter->type != TP_CHUNK_TYPE_DATA) {
-         chunk = chunkIter;
-         break;
-      }
-   }
+   chunk = TunnelProxyNextOutChunk(tp, &outQueue);
    if (!chunk) {
       return FALSE;
    }
@@ -1845,47 +2872,67 @@ TunnelProxyWriteNextOutChunk(TunnelProxy *tp,  // IN
       tp->lastChunkAckSent = chunk->ackId;
    }
 
+#define IOV_ADD(_base, _len) \
+   iov[iovCnt].base = (_base); iov[iovCnt].len = (_len); \
+   msgLen += iov[iovCnt++].len;
+
+   chunkHdr[chunkHdrLen++] = chunk->type;
+   chunkHdr[chunkHdrLen++] = ';';
+
    switch (chunk->type) {
-   case TP_CHUNK_TYPE_MESSAGE: {
-      char *hdr;
-      int hdrLen = 0;
-      if (!TunnelProxy_FormatMsg(&hdr, &hdrLen, "messageType=S", chunk->msgId,
-                                 NULL)) {
+   case TP_CHUNK_TYPE_MESSAGE:
+      if (!TunnelProxy_FormatMsg(&msgHdr, &msgHdrLen, "messageType=S",
+                                 chunk->msgId, NULL)) {
          g_debug("Failed to create tunnel msg header chunkId=%d.",
                  chunk->chunkId);
          return FALSE;
       }
-      msg = g_strdup_printf("M;%X;%.0X;%X;%.*s;%X;%.*s;",
-                            chunk->chunkId, chunk->ackId,
-                            hdrLen, hdrLen, hdr, chunk->len,
-                            chunk->len, chunk->body);
-      msgLen = strlen(msg);
-      g_free(hdr);
+
+      /* M;<chunkId>;<ackId>;<hdrLen>;<hdr>;<len>;<body>; */
+      chunkHdrLen += TunnelProxyWriteHex(chunkHdr + chunkHdrLen,
+                                         chunk->chunkId, FALSE, ';');
+      chunkHdrLen += TunnelProxyWriteHex(chunkHdr + chunkHdrLen,
+                                         chunk->ackId, TRUE, ';');
+      chunkHdrLen += TunnelProxyWriteHex(chunkHdr + chunkHdrLen,
+                                         msgHdrLen, FALSE, ';');
+      IOV_ADD(chunkHdr, chunkHdrLen)
+      IOV_ADD(msgHdr, msgHdrLen)
+
+      /* Reuse the unused tail of chunkHdr for the body length. */
+      dst = chunkHdr + chunkHdrLen;
+      *dst = ';';
+      IOV_ADD(dst, 1 + TunnelProxyWriteHex(dst + 1, chunk->len, FALSE, ';'))
+      IOV_ADD(chunk->body, chunk->len)
+      IOV_ADD(";", 1)
 
       DEBUG_DATA(("SEND-MSG(id=%d, ack=%d, msgid=%s, length=%d): %.*s",
                   chunk->chunkId, chunk->ackId,
                   chunk->msgId,
                   chunk->len, chunk->len, chunk->body));
       break;
-   }
-   case TP_CHUNK_TYPE_DATA: {
-      msg = g_strdup_printf("D;%X;%.0X;%X;%X;", chunk->chunkId,
-                            chunk->ackId, chunk->channelId, chunk->len);
-      msgLen = strlen(msg);
-
-      msg = g_realloc(msg, msgLen + chunk->len + 1);
-      memcpy(msg + msgLen, chunk->body, chunk->len);
-      msg[msgLen + chunk->len] = ';';
-      msgLen += chunk->len + 1;
+   case TP_CHUNK_TYPE_DATA:
+      /* D;<chunkId>;<ackId>;<channelId>;<len>;<body>; */
+      chunkHdrLen += TunnelProxyWriteHex(chunkHdr + chunkHdrLen,
+                                         chunk->chunkId, FALSE, ';');
+      chunkHdrLen += TunnelProxyWriteHex(chunkHdr + chunkHdrLen,
+                                         chunk->ackId, TRUE, ';');
+      chunkHdrLen += TunnelProxyWriteHex(chunkHdr + chunkHdrLen,
+                                         chunk->channelId, FALSE, ';');
+      chunkHdrLen += TunnelProxyWriteHex(chunkHdr + chunkHdrLen,
+                                         chunk->len, FALSE, ';');
+      IOV_ADD(chunkHdr, chunkHdrLen)
+      IOV_ADD(chunk->body, chunk->len)
+      IOV_ADD(";", 1)
 
       DEBUG_DATA(("SEND-DATA(id=%d, ack=%d, channel=%d, length=%d)",
                   chunk->chunkId, chunk->ackId, chunk->channelId, chunk->len));
       break;
-   }
    case TP_CHUNK_TYPE_ACK:
+      /* A;<ackId>; */
       g_assert(chunk->ackId > 0);
-      msg = g_strdup_printf("A;%X;", chunk->ackId);
-      msgLen = strlen(msg);
+      chunkHdrLen += TunnelProxyWriteHex(chunkHdr + chunkHdrLen,
+                                         chunk->ackId, FALSE, ';');
+      IOV_ADD(chunkHdr, chunkHdrLen)
 
       DEBUG_DATA(("SEND-ACK(ackId=%d)", chunk->ackId));
       break;
@@ -1893,27 +2940,51 @@ TunnelProxyWriteNextOutChunk(TunnelProxy *tp,  // IN
       g_assert_not_reached();
    }
 
-   g_assert(msg);
+#undef IOV_ADD
+
+   g_assert(iovCnt > 0 && chunkHdrLen <= sizeof chunkHdr);
 
    if (httpChunked) {
-      char *chunkHdr = g_strdup_printf("%X\r\n", (int)msgLen);
-      g_byte_array_append(tp->writeBuf, chunkHdr, strlen(chunkHdr));
-      g_free(chunkHdr);
-      g_byte_array_append(tp->writeBuf, msg, msgLen);
-      g_byte_array_append(tp->writeBuf, "\r\n", 2);
-   } else {
-      g_byte_array_append(tp->writeBuf, msg, msgLen);
+      httpHdrLen = TunnelProxyWriteHex(httpHdr, msgLen, FALSE, '\r');
+      httpHdr[httpHdrLen++] = '\n';
+   }
+
+   /* Gather everything into the writeBuf with a single reservation. */
+   dst = TunnelProxyBufReserve(&tp->writeBuf,
+                               httpHdrLen + msgLen + (httpChunked ? 2 : 0));
+   memcpy(dst, httpHdr, httpHdrLen);
+   dst += httpHdrLen;
+   for (i = 0; i < iovCnt; i++) {
+      if (iov[i].len > 0) {
+         memcpy(dst, iov[i].base, iov[i].len);
+         dst += iov[i].len;
+      }
+   }
+   if (httpChunked) {
+      memcpy(dst, "\r\n", 2);
    }
+   TunnelProxyBufCommit(&tp->writeBuf,
+                        httpHdrLen + msgLen + (httpChunked ? 2 : 0));
 
    /*
     * Move outgoing Data/Message chunk to need-ACK outgoing list.
     * TunnelProxyHandleInChunk assumes queueOutNeedAck is sorted by
-    * ascending chunk ID, so queue at the end.
+    * ascending chunk ID, so queue at the end.  The send time is used to
+    * measure the round trip time once the chunk is acknowledged.
     */
-   g_queue_remove(tp->queueOut, chunk);
+   chunk->sentTime = TunnelProxyNow();
+   if (outQueue) {
+      g_queue_pop_head(outQueue->chunks);
+      outQueue->deficit -= chunk->len;
+      if (g_queue_is_empty(outQueue->chunks)) {
+         TunnelProxyFreeOutQueue(tp, outQueue);
+      }
+   } else {
+      g_queue_pop_head(tp->queueOut);
+   }
    g_queue_push_tail(tp->queueOutNeedAck, chunk);
 
-   g_free(msg);
+   g_free(msgHdr);
    return TRUE;
 }
 
@@ -1927,9 +2998,9 @@ TunnelProxyWriteNextOutChunk(TunnelProxy *tp,  // IN
  *       intended to be written to the tunnel server over HTTP.  The buffer
  *       contents are *not* separated by HTTP chunked encoding.
  *
- *       The data written from the writeBuf is removed from the front of the
- *       writeBuf and the amount of data written returned in the bufSize
- *       param.
+ *       The data written from the writeBuf is consumed from the front of the
+ *       writeBuf without moving the remainder, and the amount of data
+ *       written returned in the bufSize param.
  *
  *       TunnelProxyWriteNextOutChunk is called repeatedly to serialize any
  *       existing or newly queued outgoing chunks.
@@ -1961,13 +3032,11 @@ TunnelProxy_HTTPSend(TunnelProxy *tp,  // IN
       /* Do nothing. */
    }
 
-   *bufSize = MIN(tp->writeBuf->len, *bufSize);
-   memcpy(buf, tp->writeBuf->data, *bufSize);
+   *bufSize = MIN(tp->writeBuf.len, *bufSize);
+   memcpy(buf, TP_BUF_DATA(&tp->writeBuf), *bufSize);
 
-   if (*bufSize) {
-      /* Shrink the front of the write buffer */
-      g_byte_array_remove_range(tp->writeBuf, 0, *bufSize);
-   }
+   /* Drop the sent data from the front of the write buffer */
+   TunnelProxyBufConsume(&tp->writeBuf, *bufSize);
 }
 
 
@@ -1991,18 +3060,10 @@ TunnelProxy_HTTPSend(TunnelProxy *tp,  // IN
 gboolean
 TunnelProxy_HTTPSendNeeded(TunnelProxy *tp) // IN
 {
-   TPChunk *chunk = NULL;
-   GList *li;
-
    g_assert(tp);
 
-   for (li = g_queue_peek_head_link(tp->queueOut); li; li = li->next) {
-      chunk = (TPChunk *)li->data;
-      if (!tp->flowStopped || chunk->type != TP_CHUNK_TYPE_DATA) {
-         return TRUE;
-      }
-   }
-   return FALSE;
+   return !g_queue_is_empty(tp->queueOut) ||
+          (!tp->flowStopped && !g_queue_is_empty(tp->queueOutChannels));
 }
 
 
@@ -2043,8 +3104,8 @@ TunnelProxyEchoRequestCb(TunnelProxy *tp,   // IN
  *
  * TunnelProxyEchoReplyCb --
  *
- *       ECHO_RP tunnel msg handler.  Does nothing other than avoid "Unhandled
- *       message" in logs.
+ *       ECHO_RP tunnel msg handler.  Takes a round trip time sample if we
+ *       sent the ECHO_RQ being answered.
  *
  * Results:
  *       TRUE.
@@ -2062,6 +3123,10 @@ TunnelProxyEchoReplyCb(TunnelProxy *tp,   // IN
                        int len,           // IN
                        void *userData)    // IN: not used
 {
+   if (tp->echoSentTime > 0) {
+      TunnelProxyRttSample(tp, TunnelProxyNow() - tp->echoSentTime);
+      tp->echoSentTime = 0;
+   }
    return TRUE;
 }
 
@@ -2277,7 +3342,8 @@ TunnelProxyErrorCb(TunnelProxy *tp,   // IN/UNUSED
  * TunnelProxyPleaseInitCb --
  *
  *       PLEASE_INIT tunnel msg handler.  Sends a START message in response
- *       containing the host's ip address, hostname, and time.
+ *       containing the host's ip address, hostname, and time.  Picks up the
+ *       negotiated maximum chunk size, if the server sent one.
  *
  *       XXX: Need to figure out the host's IP address and hostname, or at
  *            least make a decent guess.
@@ -2301,6 +3367,9 @@ TunnelProxyPleaseInitCb(TunnelProxy *tp,   // IN
    /* Ignored body contents:
     *    "plugins" string array
     *    "criticalities" ?? string array
+    *
+    * Optional body contents:
+    *    "maxChunkSize" int, largest DATA chunk the server accepts
     */
    char *startBody = NULL;
    int startLen = 0;
@@ -2318,6 +3387,22 @@ TunnelProxyPleaseInitCb(TunnelProxy *tp,   // IN
       g_free(cid);
    }
 
+   /*
+    * Servers that understand large chunks echo back the chunk size they
+    * accept.  Older servers pool 10K buffers, so stay at TP_BUF_MAXLEN.
+    */
+   {
+      int maxChunkSize = 0;
+      if (TunnelProxy_ReadMsg(body, len, "maxChunkSize=I", &maxChunkSize,
+                              NULL)) {
+         tp->maxChunkLen = CLAMP(maxChunkSize, TP_BUF_MAXLEN,
+                                 TP_BUF_LARGE_MAXLEN);
+      } else {
+         tp->maxChunkLen = TP_BUF_MAXLEN;
+      }
+      g_debug("Using tunnel chunk size of %d bytes.", tp->maxChunkLen);
+   }
+
    {
       struct timeval tv;
       gettimeofday(&tv, NULL);
@@ -2370,19 +3455,12 @@ TunnelProxyRaiseReplyCb(TunnelProxy *tp,   // IN
    int chanId = 0;
    TPChannel *channel = NULL;
    TunnelProxyErr err;
-   GList *li;
 
    if (!TunnelProxy_ReadMsg(body, len, "chanID=I", &chanId, NULL)) {
       g_assert_not_reached();
    }
 
-   for (li = tp->channels; li; li = li->next) {
-      TPChannel *chanIter = (TPChannel *)li->data;
-      if (chanIter->channelId == chanId) {
-         channel = chanIter;
-         break;
-      }
-   }
+   channel = g_hash_table_lookup(tp->channels, GUINT_TO_POINTER(chanId));
    if (!channel) {
       g_debug("Invalid channel \"%d\" in raise reply.", chanId);
       return FALSE;
@@ -2396,8 +3474,10 @@ TunnelProxyRaiseReplyCb(TunnelProxy *tp,   // IN
       err = TunnelProxy_CloseChannel(tp, channel->channelId);
       g_assert(TP_ERR_OK == err);
    } else {
-      /* Kick off channel reading */
-      TunnelProxy_AddPoll(TunnelProxySocketRecvCb, channel, channel->fd);
+      /* Kick off channel reading, which continues until the channel closes */
+      Poll_Callback(POLL_CS_MAIN, TP_CHANNEL_POLL_FLAGS,
+                    TunnelProxySocketRecvCb, channel, POLL_DEVICE,
+                    channel->fd, NULL);
    }
 
    return TRUE;
@@ -2509,6 +3589,37 @@ TunnelProxyListenSocket(const char *ipStr, // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyPortQuantum --
+ *
+ *       Look up the deficit round robin quantum for channels to a server
+ *       port.
+ *
+ * Results:
+ *       Quantum in units of maxChunkLen.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+TunnelProxyPortQuantum(int serverPort) // IN
+{
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(tpPortQuanta); i++) {
+      if (tpPortQuanta[i].serverPort == serverPort) {
+         return tpPortQuanta[i].quantum;
+      }
+   }
+   return TP_QUANTUM_DEFAULT;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -2612,9 +3723,10 @@ TunnelProxyListenRequestCb(TunnelProxy *tp,   // IN
    listener->port = bindPort;
    listener->fd = fd;
    listener->singleUse = maxConns == 1;
+   listener->quantum = TunnelProxyPortQuantum(serverPort);
    listener->tp = tp;
 
-   tp->listeners = g_list_append(tp->listeners, listener);
+   g_hash_table_insert(tp->listeners, listener->portName, listener);
 
    TunnelProxy_FormatMsg(&reply, &replyLen,
                          "cid=I", cid,
@@ -2778,8 +3890,8 @@ TunnelProxyResetTimeouts(TunnelProxy *tp,  // IN
  *       Echo poll timeout callback.  Sends an ECHO_RQ with a "now" field
  *       containing the current time in millis.
  *
- *       NOTE: There is no ECHO_RP message handler currently, as the handler
- *       in wswc_tunnel does nothing.
+ *       The time the request was sent is remembered so the ECHO_RP handler
+ *       can measure the round trip time.
  *
  * Results:
  *       None.
@@ -2811,6 +3923,8 @@ TunnelProxyEchoTimeoutCb(void *userData) // IN: TunnelProxy
    TunnelProxy_FormatMsg(&req, &reqLen, "now=L", now, NULL);
    TunnelProxy_SendMsg(tp, TP_MSG_ECHO_RQ, req, reqLen);
    g_free(req);
+
+   tp->echoSentTime = TunnelProxyNow();
 }
 
 
@@ -2843,3 +3957,152 @@ TunnelProxyLostContactTimeoutCb(void *userData) // IN: TunnelProxy
    TunnelProxyDisconnect(tp, _("Client disconnected following no activity"),
                          FALSE, TRUE);
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyNow --
+ *
+ *       Get the current time in microseconds.
+ *
+ * Results:
+ *       Current time, in usecs.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gint64
+TunnelProxyNow(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxyRttSample --
+ *
+ *       Fold a round trip time sample, from a chunk ACK or an ECHO_RP, into
+ *       the smoothed and minimum RTT, update the delivery rate once per
+ *       round trip, and resize the flow control window.
+ *
+ *       The window is TP_FLOW_WINDOW_GAIN times the bandwidth-delay product
+ *       (delivery rate * min RTT) in chunks.  While the link is not queueing
+ *       the delivery rate follows the window, so the window keeps growing;
+ *       once queueing pushes the RTT up or the rate drops it stops growing
+ *       or shrinks.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       May change tp->flowWindow.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+TunnelProxyRttSample(TunnelProxy *tp, // IN
+                     gint64 rtt)      // IN: usecs
+{
+   gint64 now = TunnelProxyNow();
+   gint64 elapsed;
+
+   if (rtt <= 0) {
+      rtt = 1;
+   }
+
+   if (tp->srtt == 0) {
+      tp->srtt = rtt;
+   } else {
+      tp->srtt += (rtt - tp->srtt) / 8;
+   }
+
+   if (tp->minRtt == 0 || rtt <= tp->minRtt ||
+       now - tp->minRttTime > TP_MIN_RTT_LIFETIME_USEC) {
+      tp->minRtt = rtt;
+      tp->minRttTime = now;
+   }
+
+   if (tp->rateStart == 0) {
+      tp->rateStart = now;
+      tp->rateBytes = 0;
+      return;
+   }
+
+   elapsed = now - tp->rateStart;
+   if (elapsed < tp->srtt) {
+      return;
+   }
+
+   {
+      guint64 rate = tp->rateBytes * G_USEC_PER_SEC / elapsed;
+      guint64 bdpChunks;
+
+      if (rate >= tp->deliveryRate) {
+         tp->deliveryRate = rate;
+      } else {
+         tp->deliveryRate = (3 * tp->deliveryRate + rate) / 4;
+      }
+
+      tp->rateStart = now;
+      tp->rateBytes = 0;
+
+      bdpChunks = tp->deliveryRate * tp->minRtt / G_USEC_PER_SEC /
+                  tp->maxChunkLen + 1;
+      tp->flowWindow = CLAMP(TP_FLOW_WINDOW_GAIN * bdpChunks,
+                             TP_FLOW_WINDOW_MIN, TP_FLOW_WINDOW_MAX);
+
+      DEBUG_DATA(("Tunnel RTT %d/%d usecs, rate %d B/s, window %d chunks",
+                  (int)tp->srtt, (int)tp->minRtt, (int)tp->deliveryRate,
+                  tp->flowWindow));
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * TunnelProxy_GetStats --
+ *
+ *       Get the current flow control, channel read and chunk allocator
+ *       counters of a TunnelProxy.
+ *
+ * Results:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+TunnelProxy_GetStats(TunnelProxy *tp,          // IN
+                     TunnelProxyStats *stats)  // OUT
+{
+   g_assert(tp);
+   g_assert(stats);
+
+   memset(stats, 0, sizeof(*stats));
+   stats->flowWindow = tp->flowWindow;
+   stats->flowStops = tp->flowStops;
+   stats->unackedChunks = tp->lastChunkIdSent - tp->lastChunkAckSeen;
+   stats->srtt = tp->srtt;
+   stats->minRtt = tp->minRtt;
+   stats->deliveryRate = tp->deliveryRate;
+   stats->channelWakeups = tp->channelWakeups;
+   stats->channelBytesRead = tp->channelBytesRead;
+   stats->liveChunks = tp->liveChunks;
+   stats->liveChunksMax = tp->liveChunksMax;
+   stats->poolAllocs = tp->poolAllocs;
+   stats->poolReuses = tp->poolReuses;
+}
@@ -170,6 +170,28 @@ void TunnelProxy_HTTPSend(TunnelProxy *tp, char *buf, int *bufSize,
 gboolean TunnelProxy_HTTPSendNeeded(TunnelProxy *tp);
 
 
+/*
+ * Diagnostic counters
+ */
+
+typedef struct {
+   unsigned int flowWindow;    // Current max unacknowledged chunks
+   unsigned int flowStops;     // Times flow control has started
+   unsigned int unackedChunks; // Chunks sent but not yet acknowledged
+   gint64 srtt;                // Smoothed round trip time, usecs
+   gint64 minRtt;              // Lowest recent round trip time, usecs
+   guint64 deliveryRate;       // Acknowledged bytes/sec
+   guint64 channelWakeups;     // Channel read callbacks
+   guint64 channelBytesRead;   // Bytes read from all channels
+   unsigned int liveChunks;    // Chunks allocated and not yet freed
+   unsigned int liveChunksMax; // High-water mark of liveChunks
+   guint64 poolAllocs;         // Chunk headers and bodies malloced
+   guint64 poolReuses;         // Chunk headers and bodies recycled
+} TunnelProxyStats;
+
+void TunnelProxy_GetStats(TunnelProxy *tp, TunnelProxyStats *stats);
+
+
 /*
  * Message parsing utilities
  */
@@ -60,6 +60,8 @@
 
 #if defined(__linux__)
 #include <linux/if_ether.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <net/if.h>
 #endif
 #else // __MINGW32__
@@ -79,6 +81,7 @@
  */
 #include <net/if.h>
 #include <net/if_dl.h>
+#include <net/route.h>
 #include <ifaddrs.h>
 #include <mach-o/dyld.h>
 #include <sys/sysctl.h>
@@ -98,6 +101,9 @@ extern "C" {
 #ifdef __APPLE__
 #include "cdkProxy.h"
 #endif
+#ifndef __APPLE__
+#include "cdkTimeZone.h"
+#endif
 #include "cdkUrl.h"
 
 
@@ -697,11 +703,157 @@ GetClientHostName()
    }
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::Util::NetworkChanged --
+ *
+ *      Check whether interfaces, addresses or routes have changed since
+ *      the last call.  A non-blocking routing socket (netlink on Linux,
+ *      PF_ROUTE elsewhere) queues change notifications, so this only
+ *      drains it; nothing is polled in between.
+ *
+ * Results:
+ *      true if the network may have changed, or if changes cannot be
+ *      tracked.
+ *
+ * Side effects:
+ *      Opens the routing socket on first use.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+#if defined(__linux__) || defined(__APPLE__)
+static bool
+NetworkChanged()
+{
+   static int sRouteSock = -2;
+
+   if (sRouteSock == -2) {
+#ifdef __linux__
+      sRouteSock = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+      if (sRouteSock >= 0) {
+         struct sockaddr_nl addr;
+         memset(&addr, 0, sizeof(addr));
+         addr.nl_family = AF_NETLINK;
+         addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR |
+                          RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_IFADDR |
+                          RTMGRP_IPV6_ROUTE;
+         if (bind(sRouteSock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(sRouteSock);
+            sRouteSock = -1;
+         }
+      }
+#else
+      sRouteSock = socket(PF_ROUTE, SOCK_RAW, AF_UNSPEC);
+#endif
+      if (sRouteSock >= 0) {
+         fcntl(sRouteSock, F_SETFL, O_NONBLOCK);
+         fcntl(sRouteSock, F_SETFD, FD_CLOEXEC);
+      } else {
+         Warning("Could not open a routing socket, client info will not be "
+                 "cached: %s\n", strerror(errno));
+      }
+      return true;
+   }
+
+   if (sRouteSock < 0) {
+      return true;
+   }
+
+   bool changed = false;
+   char buf[4096];
+   while (recv(sRouteSock, buf, sizeof(buf), 0) > 0) {
+      changed = true;
+   }
+   if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      // e.g. ENOBUFS if notifications were dropped.
+      changed = true;
+   }
+   return changed;
+}
+#endif
+
+
+#ifndef __APPLE__
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * cdk::Util::GetTimeZoneId --
+ *
+ *      Get the client's time zone name: $TZ, then /etc/timezone (Debian),
+ *      then /etc/sysconfig/clock (SuSE, RHEL), then the abbreviation of
+ *      the current local time zone.  The result is reused until $TZ or
+ *      one of the files changes.
+ *
+ * Results:
+ *      The time zone name.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static string
+GetTimeZoneId()
+{
+   static const char *sFiles[] = {
+      "/etc/timezone", "/etc/sysconfig/clock", "/etc/localtime"
+   };
+   static string sTzid;
+   static string sTzidKey;
+
+   const char *tzEnv = getenv("TZ");
+   string key = tzEnv ? tzEnv : "";
+   for (size_t i = 0; i < G_N_ELEMENTS(sFiles); i++) {
+      struct stat st;
+      if (stat(sFiles[i], &st) == 0) {
+         key += Format("|%lu:%ld", (unsigned long)st.st_ino,
+                       (long)st.st_mtime);
+      } else {
+         key += "|";
+      }
+   }
+   if (!sTzidKey.empty() && key == sTzidKey) {
+      return sTzid;
+   }
+
+   char *contents = NULL;
+   if (tzEnv) {
+      sTzid = tzEnv;
+   } else if (g_file_get_contents("/etc/timezone", &contents, NULL, NULL)) {
+      // Debian
+      sTzid = g_strstrip(contents);
+   } else if (g_file_get_contents("/etc/sysconfig/clock", &contents, NULL,
+                                  NULL)) {
+      char *tzid = CdkTimeZone_ParseSysconfigClock(contents);
+      sTzid = tzid;
+      g_free(tzid);
+   } else {
+      sTzid = "";
+   }
+   g_free(contents);
+
+   if (sTzid.empty()) {
+      tzset();
+      time_t now = time(NULL);
+      struct tm tm_now;
+      localtime_r(&now, &tm_now);
+      sTzid = tm_now.tm_zone;
+   }
+   sTzidKey = key;
+   return sTzid;
+}
+#endif // !__APPLE__
+
+
 /*
  *-----------------------------------------------------------------------------
  *
  * cdk::Util::GetClientInfo --
  *      Collects information about the client and stores it in a std::map.
+ *      The network and time zone parts are cached until they change.
  *
  * Results:
  *      A mapping of the client information.
@@ -714,23 +866,43 @@ GetClientHostName()
 
 #if defined(__linux__) || defined(__APPLE__)
 ClientInfoMap
-GetClientInfo(const string broker, // IN
-              int port)            // IN
+GetClientInfo(const string broker,        // IN
+              int port,                   // IN
+              const string brokerAddress) // IN: optional
 {
-   ClientInfoMap info = GetNICInfo(broker, port);
+   static ClientInfoMap sHostInfo;
+   static string sHostInfoKey;
 
-   string hostname = GetClientHostName();
-   if (!hostname.empty()) {
-      info["Machine_Name"] = hostname;
-   }
-   char name[MAX_HOSTNAME_LENGTH + 1];
-   if (getdomainname(name, MAX_HOSTNAME_LENGTH) == 0) {
-      name[MAX_HOSTNAME_LENGTH] = '\0';
-      info["Machine_Domain"] = name;
-   } else {
-      Warning("getdomainname() failed: %s\n", strerror(errno));
+   GTimeVal start;
+   g_get_current_time(&start);
+
+   /*
+    * The network and host name part only changes with the network
+    * configuration, so it is rebuilt when the broker or its address
+    * differs or the routing socket reports a change.
+    */
+   string key = Format("%s:%d/%s", broker.c_str(), port,
+                       brokerAddress.c_str());
+   bool cached = !NetworkChanged() && key == sHostInfoKey;
+   if (!cached) {
+      sHostInfo = GetNICInfo(broker, port, brokerAddress);
+
+      string hostname = GetClientHostName();
+      if (!hostname.empty()) {
+         sHostInfo["Machine_Name"] = hostname;
+      }
+      char name[MAX_HOSTNAME_LENGTH + 1];
+      if (getdomainname(name, MAX_HOSTNAME_LENGTH) == 0) {
+         name[MAX_HOSTNAME_LENGTH] = '\0';
+         sHostInfo["Machine_Domain"] = name;
+      } else {
+         Warning("getdomainname() failed: %s\n", strerror(errno));
+      }
+      sHostInfoKey = key;
    }
 
+   ClientInfoMap info = sHostInfo;
+
    info["LoggedOn_Username"] = g_get_user_name();
 
    string lang = setlocale(LC_MESSAGES, NULL);
@@ -757,88 +929,15 @@ GetClientInfo(const string broker, // IN
 #else // !__APPLE__
    info["Type"] = "Linux";
 
-   const char *tzid = getenv("TZ");
-   char *contents = NULL;
-   if (!tzid) {
-      if (g_file_get_contents("/etc/timezone", &contents, NULL, NULL)) {
-         // Debian
-         tzid = g_strstrip(contents);
-      } else if (getuid() != 0) {
-         // Don't run as root, for security reasons.
-
-         /*
-          * SuSE, RHEL and unsupported distro cases use a child process (bash)
-          * to parse the clock file for us, so we don't have to do all of the
-          * messy * handling of edge cases here, e.g., multiple time zone key
-          * words, extraneous white space, commented out time zone key words.
-          */
-
-         // Bash script to process clock file.
-         static char tz_sh[] = {
-            "if [ -f \"/etc/sysconfig/clock\" ]; then\n"
-            "   . /etc/sysconfig/clock\n"
-            "   if [ \"${TIMEZONE}\" ]; then\n"
-            "       echo \"$TIMEZONE\"\n"
-            "       exit 0\n"
-            "   elif [ \"${ZONE}\" ]; then\n"
-            "       echo \"$ZONE\"\n"
-            "       exit 0\n"
-            "   fi\n"
-            "fi\n"
-            "exit 0\n"
-         };
-
-         char *bash[] = { (char *)"/bin/bash", NULL };
-         GPid pid = -1;
-         int std_in = -1;
-         int std_out = -1;
-
-         static const int maxTzIdLen = 64;
-         contents = (char *)g_new0(char, maxTzIdLen);
-
-         // Launch bash process
-         Bool spawned = g_spawn_async_with_pipes(
-                                NULL, bash, NULL,
-                                (GSpawnFlags)0,
-                                NULL, NULL, &pid,
-                                &std_in, &std_out, NULL,
-                                NULL);
-         ASSERT(spawned);
-
-         if (spawned) {
-            // Write time zone script to bash process stdin.
-            if ((size_t)write(std_in, tz_sh, sizeof(tz_sh)) == sizeof(tz_sh)) {
-                // Read time zone result from bash script.
-                if (read(std_out, contents, maxTzIdLen - 1) != -1) {
-                    if (contents[0] != '\0') {
-                        /*
-                         * bash script returns timezone gleaned from clock
-                         * file: strip any trailing space or newline.
-                         */
-                        tzid = g_strstrip(contents);
-                    }
-                    // else clock file did not contain an acceptable timezone.
-                }
-            }
-
-            // Cleanup
-            close(std_in);
-            close(std_out);
-            g_spawn_close_pid(pid);
-         }
-      }
-   }
-   if (tzid) {
-      info["TZID"] = tzid;
-   } else {
-      time_t now = time(NULL);
-      struct tm tm_now;
-      localtime_r(&now, &tm_now);
-      info["TZID"] = tm_now.tm_zone;
-   }
-   g_free(contents);
+   info["TZID"] = GetTimeZoneId();
 #endif // !__APPLE__
 
+   GTimeVal end;
+   g_get_current_time(&end);
+   Log("Client info %s in %ld us.\n", cached ? "reused" : "collected",
+       (long)((end.tv_sec - start.tv_sec) * G_USEC_PER_SEC +
+              end.tv_usec - start.tv_usec));
+
    return info;
 }
 #endif
@@ -861,11 +960,12 @@ GetClientInfo(const string broker, // IN
 
 #ifdef _WIN32
 ClientInfoMap
-GetClientInfo(const string broker, // IN
-              int port)            // IN
+GetClientInfo(const string broker,        // IN
+              int port,                   // IN
+              const string brokerAddress) // IN: optional
 
 {
-   ClientInfoMap info = GetNICInfo(broker, port);
+   ClientInfoMap info = GetNICInfo(broker, port, brokerAddress);
 
    string hostname = GetClientHostName();
    if (!hostname.empty()) {
@@ -1093,39 +1193,56 @@ GetMacAddr(int sock,                 // IN
 
 #if defined(__linux__) || defined(__APPLE__)
 ClientInfoMap
-GetNICInfo(const string broker, // IN
-           int port)            // IN
+GetNICInfo(const string broker,        // IN
+           int port,                   // IN
+           const string brokerAddress) // IN: optional
 {
    ClientInfoMap info;
+   struct sockaddr_in server;
+   memset(&server, 0, sizeof(server));
 
-   struct hostent *serverInfo = gethostbyname(broker.c_str());
-   if (serverInfo == NULL) {
-      Warning("Could not resolve the broker address %s while compiling client "
-              "info: %s\n", broker.c_str(), hstrerror(h_errno));
-      return info;
-   }
+   /*
+    * Prefer the address the broker connection already resolved to;
+    * looking the name up again would block the UI on DNS.  The client
+    * info is IPv4 though, so if we connected to the broker over IPv6,
+    * look up its IPv4 address as we always did.
+    */
+   if (brokerAddress.empty() ||
+       inet_pton(AF_INET, brokerAddress.c_str(), &server.sin_addr) <= 0) {
+      if (!brokerAddress.empty()) {
+         Log("Broker address %s is not IPv4; resolving %s for client "
+             "info.\n", brokerAddress.c_str(), broker.c_str());
+      }
 
-   if (serverInfo->h_addrtype != AF_INET) {
-      Warning("Skipping NIC info for non-IPv4 address of type %d\n",
-              serverInfo->h_addrtype);
-      return info;
-   }
+      struct hostent *serverInfo = gethostbyname(broker.c_str());
+      if (serverInfo == NULL) {
+         Warning("Could not resolve the broker address %s while compiling "
+                 "client info: %s\n", broker.c_str(), hstrerror(h_errno));
+         return info;
+      }
 
-   struct sockaddr_in server;
-   if ((size_t)serverInfo->h_length > sizeof(server.sin_addr.s_addr)) {
-      Warning("Server address is larger than expected socket address\n");
-      return info;
+      if (serverInfo->h_addrtype != AF_INET) {
+         Warning("Skipping NIC info for non-IPv4 address of type %d\n",
+                 serverInfo->h_addrtype);
+         return info;
+      }
+
+      if ((size_t)serverInfo->h_length > sizeof(server.sin_addr.s_addr)) {
+         Warning("Server address is larger than expected socket address\n");
+         return info;
+      }
+      memcpy(&server.sin_addr.s_addr, serverInfo->h_addr,
+             serverInfo->h_length);
    }
 
-   int sock = socket(serverInfo->h_addrtype, SOCK_DGRAM, 0);
+   int sock = socket(AF_INET, SOCK_DGRAM, 0);
    if (sock < 0) {
       Warning("socket() failed while compiling client info: %s\n",
               strerror(errno));
       return info;
    }
 
-   memcpy(&server.sin_addr.s_addr, serverInfo->h_addr, serverInfo->h_length);
-   server.sin_family = serverInfo->h_addrtype;
+   server.sin_family = AF_INET;
    server.sin_port = htons(port);
 
    if (connect(sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
@@ -1187,8 +1304,9 @@ GetNICInfo(const string broker, // IN
 
 #ifdef _WIN32
 ClientInfoMap
-GetNICInfo(const string broker, // IN
-           int port)            // IN
+GetNICInfo(const string broker,        // IN
+           int port,                   // IN
+           const string brokerAddress) // IN: optional
 {
    // XXX - need windows implementation.
    ClientInfoMap info;
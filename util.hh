@@ -139,9 +139,11 @@ string ParseHostLabel(const string &label, unsigned short *port, bool *secure);
 string GetHostLabel(const string &hostname, unsigned short port, bool secure);
 
 string GetClientHostName();
-ClientInfoMap GetClientInfo(const string broker, int port);
+ClientInfoMap GetClientInfo(const string broker, int port,
+                            const string brokerAddress = "");
 string GetMacAddr(int sock, struct sockaddr_in *addr);
-ClientInfoMap GetNICInfo(const string broker, int port);
+ClientInfoMap GetNICInfo(const string broker, int port,
+                         const string brokerAddress = "");
 
 int Utf8Casecmp(const char *str1, const char *str2);
 